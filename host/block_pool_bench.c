@@ -0,0 +1,158 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program stress tests midi_block_pool.c with a producer thread and a
+// consumer thread on a Linux host, the same way core 0 and core 1 share the
+// MIDI OUT port queues in dual core mode. The producer keeps queue 0 as full
+// as it can while it pushes short bursts to the other queues; the consumer
+// drains queue 0 slowly and the others quickly, like a long SysEx dump to
+// one port while the other ports play notes. The consumer checks every
+// byte, and the producer checks that an empty queue always has room for its
+// reserved blocks however much queue 0 has borrowed. The program reports
+// the most bytes queue 0 held at once.
+//
+//   block_pool_bench [nbytes]
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+
+#include "tusb.h"
+#include "midi_block_pool.h"
+
+// Sized like main.c's MIDI OUT port pool
+#define NQUEUES 6
+#define POOL_BLOCKS (NQUEUES * (CFG_MIDI_OUT_RESERVED_BLOCKS + 1) + CFG_MIDI_OUT_SHARED_BLOCKS)
+
+static midi_block_pool_t pool;
+static uint8_t pool_blocks[POOL_BLOCKS][CFG_MIDI_OUT_BLOCK_SIZE];
+static uint8_t pool_lists[2 * POOL_BLOCKS];
+static midi_block_queue_t queues[NQUEUES];
+static uint64_t total_bytes;
+static _Atomic bool producer_done;
+
+// The byte at position idx of queue's test sequence
+static inline uint8_t sequence_byte(uint32_t queue, uint64_t idx)
+{
+  return (uint8_t)((idx + queue * 37) % 251);
+}
+
+static void* producer(void* arg)
+{
+  (void)arg;
+  uint8_t chunk[64];
+  uint64_t sent[NQUEUES] = {0};
+  uint32_t high_water = 0;
+  uint32_t rng = 12345;
+  while (sent[0] < total_bytes) {
+    for (uint32_t queue = 0; queue < NQUEUES; queue++) {
+      rng = rng * 1103515245u + 12345u;
+      // Queue 0 gets as much as fits, the others a message now and then
+      uint32_t nbytes = queue == 0 ? sizeof(chunk) : ((rng >> 16) % 8 == 0 ? 3 : 0);
+      if (queue != 0 && midi_block_queue_count(&queues[queue]) == 0 &&
+          midi_block_queue_space(&queues[queue]) < CFG_MIDI_OUT_RESERVED_BLOCKS * CFG_MIDI_OUT_BLOCK_SIZE) {
+        fprintf(stderr, "FAILED: empty queue %u has room for only %u bytes\n", queue,
+                midi_block_queue_space(&queues[queue]));
+        exit(EXIT_FAILURE);
+      }
+      for (uint32_t idx = 0; idx < nbytes; idx++)
+        chunk[idx] = sequence_byte(queue, sent[queue] + idx);
+      sent[queue] += midi_block_queue_push(&queues[queue], chunk, nbytes);
+    }
+    uint32_t count = midi_block_queue_count(&queues[0]);
+    if (count > high_water)
+      high_water = count;
+    sched_yield(); // the host may have fewer CPUs than threads
+  }
+  atomic_store(&producer_done, true);
+  printf("queue 0 held up to %u bytes of a %u byte pool\n", high_water, POOL_BLOCKS * CFG_MIDI_OUT_BLOCK_SIZE);
+  return NULL;
+}
+
+static void* consumer(void* arg)
+{
+  (void)arg;
+  uint64_t received[NQUEUES] = {0};
+  uint32_t pass = 0;
+  for (;;) {
+    bool done = atomic_load(&producer_done);
+    uint32_t nwaiting = 0;
+    for (uint32_t queue = 0; queue < NQUEUES; queue++) {
+      // Queue 0 drains at a fraction of the rate the others do
+      if (queue == 0 && pass++ % 4 != 0 && !done)
+        continue;
+      const uint8_t* bytes;
+      uint32_t nbytes = midi_block_queue_peek(&queues[queue], &bytes);
+      if (queue == 0 && nbytes > 5)
+        nbytes = 5;
+      for (uint32_t idx = 0; idx < nbytes; idx++) {
+        if (bytes[idx] != sequence_byte(queue, received[queue] + idx)) {
+          fprintf(stderr, "FAILED: queue %u byte %llu is %u, expected %u\n", queue,
+                  (unsigned long long)(received[queue] + idx), bytes[idx], sequence_byte(queue, received[queue] + idx));
+          exit(EXIT_FAILURE);
+        }
+      }
+      midi_block_queue_consume(&queues[queue], nbytes);
+      received[queue] += nbytes;
+      nwaiting += midi_block_queue_count(&queues[queue]);
+    }
+    if (done && nwaiting == 0)
+      break;
+    sched_yield();
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+  total_bytes = 1024 * 1024;
+  if (argc > 1)
+    total_bytes = strtoull(argv[1], NULL, 0);
+  midi_block_pool_init(&pool, &pool_blocks[0][0], CFG_MIDI_OUT_BLOCK_SIZE, POOL_BLOCKS, pool_lists,
+                       CFG_MIDI_OUT_RESERVED_BLOCKS + 1);
+  for (uint32_t queue = 0; queue < NQUEUES; queue++)
+    midi_block_queue_init(&queues[queue], &pool);
+
+  pthread_t producer_thread, consumer_thread;
+  pthread_create(&consumer_thread, NULL, consumer, NULL);
+  pthread_create(&producer_thread, NULL, producer, NULL);
+  pthread_join(producer_thread, NULL);
+  pthread_join(consumer_thread, NULL);
+
+  // Every block is back in the pool but the one each queue keeps
+  for (uint32_t queue = 0; queue < NQUEUES; queue++) {
+    if (midi_block_queue_space(&queues[queue]) < (POOL_BLOCKS - NQUEUES - (NQUEUES - 1) * CFG_MIDI_OUT_RESERVED_BLOCKS) *
+        CFG_MIDI_OUT_BLOCK_SIZE) {
+      fprintf(stderr, "FAILED: blocks went missing\n");
+      return EXIT_FAILURE;
+    }
+  }
+  printf("%llu bytes through queue 0, all bytes in order\n", (unsigned long long)total_bytes);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,230 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program sends a burst of SysEx data much larger than the MIDI OUT
+// port queues from a simulated USB host through midi_demux_dispatch() and
+// midi_out_port.c to simulated 31250 baud serial lines, with and without
+// the CFG_MIDI_USB_RX_FLOW_CONTROL behavior of main.c. The host sends one
+// 64 byte transfer per 1 ms USB frame, but only when the device's receive
+// FIFO has room for it; otherwise the device NAKs the transfer and the host
+// tries again next frame. The firmware's scheduler tick runs every
+// CFG_MIDI_SCHED_TICK_US. The program reports the bytes dropped, the NAKed
+// frames and how long the burst took, and checks that every byte that
+// reached a serial line arrived in order.
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "tusb.h"
+#include "midi_device_multistream.h"
+#include "midi_out_port.h"
+
+#define NPORTS 6
+#define STEP_US 10
+#define BYTE_US 320
+#define FRAME_US 1000
+#define FIFO_PACKETS (CFG_TUD_MIDI_RX_BUFSIZE / 4)
+#define TX_BUFFER_SIZE 128      // the pio_midi_uart_lib transmit ring buffer
+#define MAX_PACKETS 65536
+
+// The USB host's packets and the device's receive FIFO
+static uint8_t host_packets[MAX_PACKETS][4];
+static uint32_t host_npackets, host_next;
+static uint8_t fifo[FIFO_PACKETS][4];
+static uint32_t fifo_head, fifo_tail;
+
+bool tud_midi_n_packet_read(uint8_t itf, uint8_t packet[4])
+{
+  (void)itf;
+  if (fifo_head == fifo_tail)
+    return false;
+  memcpy(packet, fifo[fifo_tail++ % FIFO_PACKETS], 4);
+  return true;
+}
+
+// A simulated MIDI OUT port: the transmit buffer and serial line
+typedef struct {
+  uint8_t tx_buffer[TX_BUFFER_SIZE];
+  uint32_t tx_head, tx_tail;
+  uint32_t line_busy_until;
+  uint32_t nsent;         // bytes sent on the line
+  uint32_t nexpected;     // bytes the host sent on this port's cable
+  bool in_order;          // every byte sent so far matched the host's stream
+} sim_port_t;
+
+static sim_port_t ports[NPORTS];
+static midi_out_port_t out_ports[NPORTS];
+// The MIDI OUT port queue pool, sized like main.c's
+#define POOL_BLOCKS (NPORTS * (CFG_MIDI_OUT_RESERVED_BLOCKS + 1) + CFG_MIDI_OUT_SHARED_BLOCKS)
+static midi_block_pool_t pool;
+static uint8_t pool_blocks[POOL_BLOCKS][CFG_MIDI_OUT_BLOCK_SIZE];
+static uint8_t pool_lists[2 * POOL_BLOCKS];
+static uint8_t realtime_bufs[NPORTS][CFG_MIDI_OUT_REALTIME_QUEUE_SIZE];
+static bool flow_control;
+static bool usb_rx_stalled;
+static uint32_t ndropped;
+static midi_demux_ctx_t demux;
+
+static uint32_t write_tx_buffer(void* port, const uint8_t* bytes, uint32_t nbytes)
+{
+  sim_port_t* sim = port;
+  uint32_t nwritten = 0;
+  while (nwritten < nbytes && sim->tx_head - sim->tx_tail < TX_BUFFER_SIZE)
+    sim->tx_buffer[sim->tx_head++ % TX_BUFFER_SIZE] = bytes[nwritten++];
+  return nwritten;
+}
+
+// The byte at position idx of the SysEx message of length len sent on cable
+static uint8_t sysex_byte(uint8_t cable, uint32_t idx, uint32_t len)
+{
+  return idx == 0 ? 0xF0 : idx == len - 1 ? 0xF7 : (uint8_t)((idx * 7 + cable) & 0x7F);
+}
+
+static uint32_t sysex_len;
+
+static void run_lines(uint32_t now)
+{
+  for (uint8_t cable = 0; cable < NPORTS; cable++) {
+    sim_port_t* sim = &ports[cable];
+    if ((int32_t)(now - sim->line_busy_until) < 0 || sim->tx_head == sim->tx_tail)
+      continue;
+    uint8_t byte = sim->tx_buffer[sim->tx_tail++ % TX_BUFFER_SIZE];
+    if (byte != sysex_byte(cable, sim->nsent % sysex_len, sysex_len))
+      sim->in_order = false;
+    sim->nsent++;
+    sim->line_busy_until = now + BYTE_US;
+  }
+}
+
+// Like write_cable_tx() in main.c
+static uint32_t write_cable_tx(void* context, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+  (void)context;
+  uint32_t npushed = midi_out_port_write(&out_ports[cable_num], bytes, nbytes);
+  if (flow_control) {
+    if (npushed != nbytes)
+      usb_rx_stalled = true;
+    return npushed;
+  }
+  ndropped += nbytes - npushed;
+  return nbytes;
+}
+
+// Make the host's packets: one SysEx message of len bytes on each of
+// ncables cables, interleaved one packet at a time
+static void make_burst(uint8_t ncables, uint32_t len)
+{
+  host_npackets = 0;
+  sysex_len = len;
+  for (uint32_t idx = 0; idx < len; idx += 3) {
+    uint32_t nbytes = len - idx < 3 ? len - idx : 3;
+    uint8_t cin = idx + nbytes < len ? MIDI_CIN_SYSEX_START : MIDI_CIN_SYSEX_END_1BYTE + nbytes - 1;
+    for (uint8_t cable = 0; cable < ncables; cable++) {
+      uint8_t* packet = host_packets[host_npackets++];
+      memset(packet, 0, 4);
+      packet[0] = (uint8_t)(cable << 4 | cin);
+      for (uint32_t byte = 0; byte < nbytes; byte++)
+        packet[1 + byte] = sysex_byte(cable, idx + byte, len);
+    }
+  }
+}
+
+static void run(const char* name, uint8_t ncables, uint32_t len, bool with_flow_control)
+{
+  make_burst(ncables, len);
+  flow_control = with_flow_control;
+  usb_rx_stalled = false;
+  ndropped = 0;
+  host_next = fifo_head = fifo_tail = 0;
+  midi_demux_init(&demux, 0);
+  midi_block_pool_init(&pool, &pool_blocks[0][0], CFG_MIDI_OUT_BLOCK_SIZE, POOL_BLOCKS, pool_lists,
+                       CFG_MIDI_OUT_RESERVED_BLOCKS + 1);
+  for (uint8_t cable = 0; cable < NPORTS; cable++) {
+    memset(&ports[cable], 0, sizeof(ports[cable]));
+    ports[cable].in_order = true;
+    ports[cable].nexpected = cable < ncables ? len : 0;
+    midi_out_port_init(&out_ports[cable], write_tx_buffer, &ports[cable], &pool, realtime_bufs[cable], CFG_MIDI_OUT_REALTIME_QUEUE_SIZE, CFG_MIDI_OUT_PACING_BYTES);
+  }
+  uint32_t nnaks = 0;
+  uint32_t now = 0;
+  bool busy = true;
+  for (; busy; now += STEP_US) {
+    run_lines(now);
+    if (now % FRAME_US == 0 && host_next < host_npackets) {
+      // The device only takes a whole transfer
+      if (FIFO_PACKETS - (fifo_head - fifo_tail) >= CFG_TUD_MIDI_RX_BUFSIZE / 4) {
+        for (uint32_t idx = 0; idx < CFG_TUD_MIDI_RX_BUFSIZE / 4 && host_next < host_npackets; idx++)
+          memcpy(fifo[fifo_head++ % FIFO_PACKETS], host_packets[host_next++], 4);
+      }
+      else {
+        nnaks++;
+      }
+    }
+    if (now % CFG_MIDI_SCHED_TICK_US != 0)
+      continue;
+    // The firmware's USB receive task, posted by tud_midi_rx_cb() or the tick
+    usb_rx_stalled = false;
+    midi_demux_dispatch(&demux, write_cable_tx, NULL);
+    busy = host_next < host_npackets || fifo_head != fifo_tail || demux.packet_ok;
+    for (uint8_t cable = 0; cable < NPORTS; cable++) {
+      if (midi_out_port_service(&out_ports[cable], now))
+        busy = true;
+      if (ports[cable].tx_head != ports[cable].tx_tail)
+        busy = true;
+    }
+  }
+  uint32_t nexpected = 0, nsent = 0;
+  bool in_order = true;
+  for (uint8_t cable = 0; cable < NPORTS; cable++) {
+    nexpected += ports[cable].nexpected;
+    nsent += ports[cable].nsent;
+    if (!ports[cable].in_order || (flow_control && ports[cable].nsent != ports[cable].nexpected))
+      in_order = false;
+  }
+  printf("%-22s %-5s %9u %9u %9u %7u %9.3f %s\n", name, with_flow_control ? "on" : "off",
+         nexpected, nsent, ndropped, nnaks, now / 1e6,
+         in_order ? "ok" : (flow_control ? "FAILED" : "corrupt"));
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t len = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 4096;
+  if (len < 2 || len * NPORTS / 3 + NPORTS > MAX_PACKETS) {
+    fprintf(stderr, "usage: %s [sysex length (2-%u)]\n", argv[0], (MAX_PACKETS - NPORTS) * 3 / NPORTS);
+    return 1;
+  }
+  printf("%-22s %-5s %9s %9s %9s %7s %9s %s\n", "burst", "flow", "sent", "on wire", "dropped", "NAKs", "seconds", "stream");
+  char name[32];
+  snprintf(name, sizeof(name), "1 cable x %u bytes", len);
+  run(name, 1, len, false);
+  run(name, 1, len, true);
+  snprintf(name, sizeof(name), "%u cables x %u bytes", NPORTS, len);
+  run(name, NPORTS, len, false);
+  run(name, NPORTS, len, true);
+  return 0;
+}
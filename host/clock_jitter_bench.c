@@ -0,0 +1,175 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program measures how long MIDI Clock bytes wait to go out on a
+// MIDI OUT port while the port's queue is full of SysEx data. It
+// simulates the port in steps of 10 microseconds: the serial line sends one
+// byte every 320us from a transmit buffer the size of the
+// pio_midi_uart_lib ring buffer, and the firmware's scheduler tick runs
+// every CFG_MIDI_SCHED_TICK_US. The host keeps the SysEx queue full and
+// sends MIDI Clock at 24 pulses per quarter note at 120 BPM.
+//
+// It runs the simulation twice: once writing every byte straight to the
+// transmit buffer, the way the firmware did before midi_out_port.c, and once
+// through midi_out_port.c with its System Real-Time priority lane.
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "tusb.h" // the stand-in in host/include, for tusb_config.h
+#include "midi_out_port.h"
+
+#define STEP_US 10
+#define BYTE_US 320
+#define CLOCK_US 20833          // 24 PPQN at 120 BPM
+#define TX_BUFFER_SIZE 128      // the pio_midi_uart_lib transmit ring buffer
+#define MAX_CLOCKS 4096
+
+// The simulated port transmit buffer and serial line
+static uint8_t tx_buffer[TX_BUFFER_SIZE];
+static uint32_t tx_head, tx_tail;
+static uint32_t line_busy_until;
+
+// When each MIDI Clock was written and when it started on the line
+static uint32_t clock_write_us[MAX_CLOCKS];
+static uint32_t nclocks_written, nclocks_sent;
+static double latency_sum, latency_sq_sum;
+static uint32_t latency_min, latency_max;
+static uint64_t sysex_bytes_sent;
+
+static uint32_t write_tx_buffer(void* port, const uint8_t* bytes, uint32_t nbytes)
+{
+  (void)port;
+  uint32_t nwritten = 0;
+  while (nwritten < nbytes && tx_head - tx_tail < TX_BUFFER_SIZE)
+    tx_buffer[tx_head++ % TX_BUFFER_SIZE] = bytes[nwritten++];
+  return nwritten;
+}
+
+// Start sending the next byte if the line is idle
+static void run_line(uint32_t now)
+{
+  if ((int32_t)(now - line_busy_until) < 0 || tx_head == tx_tail)
+    return;
+  uint8_t byte = tx_buffer[tx_tail++ % TX_BUFFER_SIZE];
+  line_busy_until = now + BYTE_US;
+  if (byte == 0xF8) {
+    uint32_t latency = now - clock_write_us[nclocks_sent++];
+    latency_sum += latency;
+    latency_sq_sum += (double)latency * latency;
+    if (latency < latency_min)
+      latency_min = latency;
+    if (latency > latency_max)
+      latency_max = latency;
+  }
+  else {
+    sysex_bytes_sent++;
+  }
+}
+
+// The next byte of an endless stream of 256 byte SysEx messages
+static uint8_t next_sysex_byte(void)
+{
+  static uint32_t idx;
+  uint32_t pos = idx++ % 256;
+  return pos == 0 ? 0xF0 : pos == 255 ? 0xF7 : (uint8_t)(pos & 0x7F);
+}
+
+static void run(bool priority_lane, uint32_t seconds)
+{
+  // One port with all of the shared blocks to itself
+  enum { POOL_BLOCKS = CFG_MIDI_OUT_RESERVED_BLOCKS + 1 + CFG_MIDI_OUT_SHARED_BLOCKS };
+  static midi_out_port_t out_port;
+  static midi_block_pool_t pool;
+  static uint8_t pool_blocks[POOL_BLOCKS][CFG_MIDI_OUT_BLOCK_SIZE];
+  static uint8_t pool_lists[2 * POOL_BLOCKS];
+  static uint8_t realtime_buf[CFG_MIDI_OUT_REALTIME_QUEUE_SIZE];
+  midi_block_pool_init(&pool, &pool_blocks[0][0], CFG_MIDI_OUT_BLOCK_SIZE, POOL_BLOCKS, pool_lists,
+                       CFG_MIDI_OUT_RESERVED_BLOCKS + 1);
+  midi_out_port_init(&out_port, write_tx_buffer, NULL, &pool, realtime_buf, sizeof(realtime_buf),
+                     CFG_MIDI_OUT_PACING_BYTES);
+  tx_head = tx_tail = 0;
+  line_busy_until = 0;
+  nclocks_written = nclocks_sent = 0;
+  latency_sum = latency_sq_sum = 0;
+  latency_min = UINT32_MAX;
+  latency_max = 0;
+  sysex_bytes_sent = 0;
+
+  uint8_t pending_sysex = next_sysex_byte();
+  uint32_t next_clock_us = CLOCK_US / 2;
+  bool clock_pending = false;
+  uint32_t end_us = seconds * 1000000u;
+  for (uint32_t now = 0; now < end_us; now += STEP_US) {
+    run_line(now);
+    if ((int32_t)(now - next_clock_us) >= 0 && nclocks_written < MAX_CLOCKS) {
+      clock_write_us[nclocks_written++] = next_clock_us;
+      next_clock_us += CLOCK_US;
+      clock_pending = true;
+    }
+    if (now % CFG_MIDI_SCHED_TICK_US != 0)
+      continue;
+    // The scheduler tick: the USB host writes MIDI Clock as soon as it is due
+    // and as much SysEx as the port takes, then the port task runs.
+    static const uint8_t clock = 0xF8;
+    if (priority_lane) {
+      if (clock_pending)
+        clock_pending = midi_out_port_write(&out_port, &clock, 1) != 1;
+      while (midi_out_port_write(&out_port, &pending_sysex, 1) == 1)
+        pending_sysex = next_sysex_byte();
+      midi_out_port_service(&out_port, now);
+    }
+    else {
+      if (clock_pending)
+        clock_pending = write_tx_buffer(NULL, &clock, 1) != 1;
+      while (write_tx_buffer(NULL, &pending_sysex, 1) == 1)
+        pending_sysex = next_sysex_byte();
+    }
+  }
+  double mean = latency_sum / nclocks_sent;
+  double stddev = sqrt(latency_sq_sum / nclocks_sent - mean * mean);
+  printf("%-24s %7u %9u %9.0f %9u %9.0f %11.0f\n",
+         priority_lane ? "midi_out_port priority" : "direct to tx buffer",
+         nclocks_sent, latency_min, mean, latency_max, stddev,
+         sysex_bytes_sent * 1e6 / end_us);
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t seconds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 60;
+  if (seconds == 0 || seconds * 1000000ull / CLOCK_US + 1 > MAX_CLOCKS) {
+    fprintf(stderr, "usage: %s [seconds (1-%u)]\n", argv[0], MAX_CLOCKS * CLOCK_US / 1000000);
+    return 1;
+  }
+  printf("MIDI Clock latency in microseconds behind a full SysEx queue, %u s simulated\n", seconds);
+  printf("%-24s %7s %9s %9s %9s %9s %11s\n", "path", "clocks", "min", "mean", "max", "stddev", "sysex B/s");
+  run(false, seconds);
+  run(true, seconds);
+  return 0;
+}
@@ -0,0 +1,380 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program benchmarks tud_midi_demux_stream_read() and
+// tud_midi_demux_dispatch() on a Linux host.
+// It replaces tinyusb's USB MIDI receive FIFO with a stand-in that
+// delivers pre-generated USB-MIDI event packets 64 bytes (one Full Speed
+// bulk transfer) at a time, then calls the demultiplexer the same way
+// poll_usb_rx() in main.c does. Before timing each traffic mix, it checks
+// that the demultiplexed streams match the streams that went in.
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "tusb.h"
+#include "midi_device_multistream.h"
+
+#define BENCH_NUM_PACKETS 65536
+#define BENCH_PACKETS_PER_XFER 16 // 64 byte Full Speed bulk transfer
+#define BENCH_MAX_CABLES 16
+#define BENCH_ROUNDS 5
+
+//--------------------------------------------------------------------+
+// USB MIDI receive FIFO stand-in
+//--------------------------------------------------------------------+
+static uint8_t traffic[BENCH_NUM_PACKETS][4];
+static uint32_t traffic_count;
+static uint64_t traffic_bytes; // MIDI stream bytes in the traffic
+static uint32_t fifo_rd_idx;  // next packet tud_midi_n_packet_read() returns
+static uint32_t fifo_wr_idx;  // packets before this index are in the FIFO
+
+bool tud_midi_n_packet_read(uint8_t itf, uint8_t packet[4])
+{
+  (void)itf;
+  if (fifo_rd_idx == fifo_wr_idx)
+    return false;
+  memcpy(packet, traffic[fifo_rd_idx++], 4);
+  return true;
+}
+
+// Simulate tud_task() receiving the next bulk transfer from the host
+static bool fifo_receive_xfer(void)
+{
+  if (fifo_wr_idx >= traffic_count)
+    return false;
+  fifo_wr_idx += BENCH_PACKETS_PER_XFER;
+  if (fifo_wr_idx > traffic_count)
+    fifo_wr_idx = traffic_count;
+  return true;
+}
+
+static void fifo_rewind(void)
+{
+  fifo_rd_idx = 0;
+  fifo_wr_idx = 0;
+  tud_midi_demux_reset();
+}
+
+//--------------------------------------------------------------------+
+// Traffic generators
+//--------------------------------------------------------------------+
+static void add_packet(uint8_t cable, uint8_t cin, uint8_t b0, uint8_t b1, uint8_t b2)
+{
+  uint8_t* packet = traffic[traffic_count++];
+  packet[0] = (uint8_t)((cable << 4) | cin);
+  packet[1] = b0;
+  packet[2] = b1;
+  packet[3] = b2;
+}
+
+static void add_channel_message(uint8_t cable, uint8_t status, uint8_t d1, uint8_t d2)
+{
+  add_packet(cable, status >> 4, status, d1, d2);
+}
+
+// Dense Note On/Note Off traffic all on cable 0
+static void gen_single_cable_notes(void)
+{
+  uint8_t note = 0;
+  while (traffic_count < BENCH_NUM_PACKETS) {
+    add_channel_message(0, 0x90, note, 0x64);
+    add_channel_message(0, 0x80, note, 0x00);
+    note = (note + 1) & 0x7f;
+  }
+}
+
+// All 6 OUT cables in use; each cable gets a short run of
+// Note, Control Change and Program Change messages in turn
+static void gen_six_cable_interleave(void)
+{
+  uint8_t cable = 0;
+  uint8_t value = 0;
+  while (traffic_count + 4 <= BENCH_NUM_PACKETS) {
+    add_channel_message(cable, 0x90 | cable, value, 0x40);
+    add_channel_message(cable, 0xB0 | cable, 7, value);
+    add_channel_message(cable, 0xC0 | cable, value, 0);
+    add_channel_message(cable, 0x80 | cable, value, 0);
+    value = (value + 1) & 0x7f;
+    cable = (cable + 1) % 6;
+  }
+}
+
+// 4 kbyte SysEx dumps to cable 2, interrupted by MIDI Clock like a DAW does
+static void gen_long_sysex(void)
+{
+  const uint32_t dump_len = 4096;
+  while (traffic_count + dump_len / 3 + dump_len / 96 + 2 < BENCH_NUM_PACKETS) {
+    uint8_t bytes[3];
+    uint32_t idx = 0;
+    uint32_t nbytes = 0;
+    for (uint32_t byte_idx = 0; byte_idx < dump_len; byte_idx++) {
+      uint8_t byte = byte_idx == 0 ? 0xF0 : (byte_idx == dump_len - 1 ? 0xF7 : (uint8_t)(byte_idx & 0x7f));
+      bytes[idx++] = byte;
+      nbytes++;
+      if (byte == 0xF7) {
+        static const uint8_t end_cin[] = {MIDI_CIN_SYSEX_END_1BYTE, MIDI_CIN_SYSEX_END_2BYTE, MIDI_CIN_SYSEX_END_3BYTE};
+        add_packet(2, end_cin[idx - 1], bytes[0], idx > 1 ? bytes[1] : 0, idx > 2 ? bytes[2] : 0);
+      }
+      else if (idx == 3) {
+        add_packet(2, MIDI_CIN_SYSEX_START, bytes[0], bytes[1], bytes[2]);
+        idx = 0;
+      }
+      if (nbytes % 96 == 0)
+        add_packet(2, MIDI_CIN_1BYTE_DATA, 0xF8, 0, 0);
+    }
+  }
+}
+
+// Worst case: every packet is a single byte real-time message on a
+// different cable than the packet before it
+static void gen_cable_change_every_packet(void)
+{
+  uint8_t cable = 0;
+  while (traffic_count < BENCH_NUM_PACKETS) {
+    add_packet(cable, MIDI_CIN_1BYTE_DATA, 0xF8, 0, 0);
+    cable = (cable + 1) % 6;
+  }
+}
+
+typedef struct {
+  const char* name;
+  void (*generate)(void);
+} scenario_t;
+
+static const scenario_t scenarios[] = {
+  {"single cable notes", gen_single_cable_notes},
+  {"6 cable interleave", gen_six_cable_interleave},
+  {"long sysex + clock", gen_long_sysex},
+  {"cable change/packet", gen_cable_change_every_packet},
+};
+
+//--------------------------------------------------------------------+
+// Verification
+//--------------------------------------------------------------------+
+typedef struct {
+  uint32_t hash[BENCH_MAX_CABLES];
+  uint32_t nbytes[BENCH_MAX_CABLES];
+} stream_digest_t;
+
+static void digest_bytes(stream_digest_t* digest, uint8_t cable, const uint8_t* bytes, uint32_t nbytes)
+{
+  // FNV-1a
+  uint32_t hash = digest->hash[cable];
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    hash ^= bytes[idx];
+    hash *= 16777619u;
+  }
+  digest->hash[cable] = hash;
+  digest->nbytes[cable] += nbytes;
+}
+
+static void digest_init(stream_digest_t* digest)
+{
+  for (int cable = 0; cable < BENCH_MAX_CABLES; cable++) {
+    digest->hash[cable] = 2166136261u;
+    digest->nbytes[cable] = 0;
+  }
+}
+
+// Compute what the demultiplexed streams must contain straight from the packets
+static void expected_digest(stream_digest_t* digest)
+{
+  static const uint8_t payload_len[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+  digest_init(digest);
+  for (uint32_t idx = 0; idx < traffic_count; idx++) {
+    digest_bytes(digest, traffic[idx][0] >> 4, traffic[idx] + 1, payload_len[traffic[idx][0] & 0xf]);
+  }
+}
+
+// Keep the compiler from optimizing away the demultiplexed data
+static volatile uint32_t sink;
+// Number of times the data went to a MIDI OUT port write function
+static uint64_t nwrites;
+
+static void consume(stream_digest_t* digest, uint8_t cable, const uint8_t* bytes, uint32_t nbytes)
+{
+  ++nwrites;
+  if (digest)
+    digest_bytes(digest, cable, bytes, nbytes);
+  else
+    sink += bytes[0] + cable + nbytes;
+}
+
+// Each drain function empties the FIFO stand-in the way poll_usb_rx() would
+// with the API under test and returns the number of API calls it made
+static uint32_t drain_stream_read(stream_digest_t* digest, uint32_t bufsize)
+{
+  uint8_t rx[256];
+  uint8_t cable_num;
+  uint32_t ncalls = 1;
+  uint32_t nread = tud_midi_demux_stream_read(&cable_num, rx, bufsize);
+  while (nread > 0) {
+    consume(digest, cable_num, rx, nread);
+    nread = tud_midi_demux_stream_read(&cable_num, rx, bufsize);
+    ++ncalls;
+  }
+  return ncalls;
+}
+
+static uint32_t dispatch_write_cb(void* context, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+  consume((stream_digest_t*)context, cable_num, bytes, nbytes);
+  return nbytes;
+}
+
+static uint32_t drain_dispatch(stream_digest_t* digest, uint32_t bufsize)
+{
+  (void)bufsize;
+  tud_midi_demux_dispatch(dispatch_write_cb, digest);
+  return 1;
+}
+
+typedef struct {
+  const char* name;
+  uint32_t (*drain)(stream_digest_t* digest, uint32_t bufsize);
+} demux_api_t;
+
+static const demux_api_t apis[] = {
+  {"stream_read", drain_stream_read},
+  {"dispatch", drain_dispatch},
+};
+
+static uint64_t expected_bytes(void)
+{
+  stream_digest_t expected;
+  uint64_t total = 0;
+  expected_digest(&expected);
+  for (int cable = 0; cable < BENCH_MAX_CABLES; cable++)
+    total += expected.nbytes[cable];
+  return total;
+}
+
+static bool verify(const demux_api_t* api, uint32_t bufsize)
+{
+  stream_digest_t expected, actual;
+  expected_digest(&expected);
+  digest_init(&actual);
+  fifo_rewind();
+  while (fifo_receive_xfer()) {
+    api->drain(&actual, bufsize);
+  }
+  return memcmp(&expected, &actual, sizeof(expected)) == 0;
+}
+
+//--------------------------------------------------------------------+
+// Timing
+//--------------------------------------------------------------------+
+static uint64_t now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t now_cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#elif defined(__aarch64__)
+  uint64_t ticks;
+  __asm__ volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+  return ticks;
+#else
+  return now_ns();
+#endif
+}
+
+static void run_scenario(const scenario_t* scenario, const demux_api_t* api, uint32_t iterations, uint32_t bufsize)
+{
+  uint64_t total_calls = 0;
+
+  nwrites = 0;
+  if (!verify(api, bufsize)) {
+    printf("%-22s %-14s FAILED: demultiplexed streams do not match the USB packets\r\n", scenario->name, api->name);
+    exit(EXIT_FAILURE);
+  }
+
+  // Report the fastest round so that other work on the host
+  // disturbs the results as little as possible
+  uint64_t best_ns = UINT64_MAX;
+  uint64_t best_cycles = UINT64_MAX;
+  for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+    nwrites = 0;
+    total_calls = 0;
+    uint64_t start_ns = now_ns();
+    uint64_t start_cycles = now_cycles();
+    for (uint32_t iteration = 0; iteration < iterations; iteration++) {
+      fifo_rewind();
+      while (fifo_receive_xfer()) {
+        total_calls += api->drain(NULL, bufsize);
+      }
+    }
+    uint64_t elapsed_cycles = now_cycles() - start_cycles;
+    uint64_t elapsed_ns = now_ns() - start_ns;
+    if (elapsed_cycles < best_cycles)
+      best_cycles = elapsed_cycles;
+    if (elapsed_ns < best_ns)
+      best_ns = elapsed_ns;
+  }
+
+  double seconds = (double)best_ns / 1e9;
+  double packets = (double)traffic_count * iterations;
+  double bytes = (double)traffic_bytes * iterations;
+  printf("%-22s %-14s %10.2f %10.2f %10.2f %12.2f %13.2f\r\n", scenario->name, api->name,
+    bytes / seconds / 1e6, packets / seconds / 1e6,
+    (double)best_cycles / packets, (double)total_calls / packets, (double)nwrites / packets);
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t iterations = 40;
+  uint32_t bufsize = 48; // same as the rx[] buffer in poll_usb_rx()
+  if (argc > 1)
+    iterations = (uint32_t)strtoul(argv[1], NULL, 0);
+  if (argc > 2)
+    bufsize = (uint32_t)strtoul(argv[2], NULL, 0);
+  if (iterations == 0 || bufsize < 3 || bufsize > 256) {
+    fprintf(stderr, "usage: %s [iterations [bufsize (3-256)]]\r\n", argv[0]);
+    return EXIT_FAILURE;
+  }
+  printf("%u packets x %u iterations, best of %u rounds, %u byte stream buffer\r\n", BENCH_NUM_PACKETS, iterations, BENCH_ROUNDS, bufsize);
+  printf("%-22s %-14s %10s %10s %10s %12s %13s\r\n", "traffic", "api", "Mbyte/s", "Mpacket/s", "cyc/packet", "calls/packet", "writes/packet");
+  for (size_t idx = 0; idx < TU_ARRAY_SIZE(scenarios); idx++) {
+    traffic_count = 0;
+    scenarios[idx].generate();
+    traffic_bytes = expected_bytes();
+    for (size_t api_idx = 0; api_idx < TU_ARRAY_SIZE(apis); api_idx++) {
+      run_scenario(&scenarios[idx], &apis[api_idx], iterations, bufsize);
+    }
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,217 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program reads the telemetry counters from the adapter over USB
+// with libusb and prints them, once or every interval seconds. It can also
+// reset them. The adapter answers the vendor specific control requests in
+// midi_telemetry.h while it carries MIDI data. With -t it instead saves the
+// adapter's trace ring to a trace file and starts a new trace; that needs
+// firmware built with CFG_MIDI_TRACE (See midi_trace.h). With -p it also
+// prints the latency and CPU cycle histograms of firmware built with
+// CFG_MIDI_PROFILE (See midi_profile.h), and -r empties them too.
+//
+//   midi_telemetry_tool [-r] [-p] [interval]
+//   midi_telemetry_tool -t file
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <libusb.h>
+
+#include "midi_telemetry.h"
+#include "midi_trace.h"
+#include "midi_profile.h"
+
+// The adapter's IDs from usb_descriptors.c: MIDI and vendor interfaces, and
+// with CFG_MIDI_UMP the UMP alternate setting
+#define ADAPTER_VID 0xCafe
+#define ADAPTER_PID (0x4000 | (1 << 3) | (1 << 4))
+#define ADAPTER_UMP_PID (ADAPTER_PID | (1 << 5))
+
+static void print_cables(const char* direction, const midi_telemetry_cable_t* cables, uint32_t ncables)
+{
+  for (uint32_t cable = 0; cable < ncables && cable < MIDI_TELEMETRY_MAX_CABLES; cable++) {
+    printf("%-4s %5u %12u %10u %10u %10u\n", direction, cable, cables[cable].bytes,
+           cables[cable].dropped, cables[cable].high_water, cables[cable].filtered);
+  }
+}
+
+static void print_hist(const char* name, const midi_profile_hist_t* hist, uint8_t shift)
+{
+  printf("%-8s %10u %10u %10u %10u %10u\n", name, hist->count, midi_profile_percentile(hist, shift, 50),
+         midi_profile_percentile(hist, shift, 90), midi_profile_percentile(hist, shift, 99), hist->max);
+}
+
+// Read the adapter's histograms and print them. Return 0 on success.
+static int print_profile(libusb_device_handle* handle)
+{
+  const uint8_t request_type_in = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+  midi_profile_t profile;
+  memset(&profile, 0, sizeof(profile));
+  int nread = libusb_control_transfer(handle, request_type_in, MIDI_PROFILE_REQUEST_GET, 0, 0,
+                                      (unsigned char*)&profile, sizeof(profile), 1000);
+  if (nread < (int)sizeof(profile) || profile.version != MIDI_PROFILE_VERSION) {
+    fprintf(stderr, "profile request failed; is the firmware built with CFG_MIDI_PROFILE?\n");
+    return 1;
+  }
+  // The percentiles are the limits of the buckets they fall in
+  printf("%-8s %10s %10s %10s %10s %10s\n", "latency", "batches", "p50 us", "p90 us", "p99 us", "max us");
+  print_hist("in", &profile.in_latency, MIDI_PROFILE_LATENCY_SHIFT);
+  print_hist("out", &profile.out_latency, MIDI_PROFILE_LATENCY_SHIFT);
+  printf("%-8s %10s %10s %10s %10s %10s   at %u MHz\n", "task", "runs", "p50 cyc", "p90 cyc", "p99 cyc", "max cyc",
+         profile.cpu_hz / 1000000);
+  for (uint32_t task_id = 0; task_id < profile.ntasks && task_id < MIDI_PROFILE_MAX_TASKS; task_id++) {
+    char name[sizeof(profile.tasks[task_id].name) + 1] = {0};
+    memcpy(name, profile.tasks[task_id].name, sizeof(profile.tasks[task_id].name));
+    print_hist(name, &profile.tasks[task_id].cycles, MIDI_PROFILE_CYCLES_SHIFT);
+  }
+  return 0;
+}
+
+// Freeze the adapter's trace ring, write it to the trace file path and
+// start a new trace. Return 0 on success.
+static int save_trace(libusb_device_handle* handle, const midi_telemetry_t* telemetry, const char* path)
+{
+  const uint8_t request_type_in = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+  const uint8_t request_type_out = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+  if (libusb_control_transfer(handle, request_type_out, MIDI_TRACE_REQUEST_FREEZE, 0, 0, NULL, 0, 1000) < 0) {
+    fprintf(stderr, "freeze request failed; is the firmware built with CFG_MIDI_TRACE?\n");
+    return 1;
+  }
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+  midi_trace_header_t header = {
+    .magic = {'M', 'T', 'R', 'C'},
+    .version = MIDI_TRACE_VERSION,
+    .num_cables_in = (uint8_t)telemetry->num_cables_in,
+    .num_cables_out = (uint8_t)telemetry->num_cables_out,
+  };
+  fwrite(&header, sizeof(header), 1, file);
+  uint32_t nrecords = 0;
+  int result = 0;
+  while (nrecords <= 0xFFFF) {
+    midi_trace_record_t records[512];
+    int nread = libusb_control_transfer(handle, request_type_in, MIDI_TRACE_REQUEST_READ, (uint16_t)nrecords, 0,
+                                        (unsigned char*)records, sizeof(records), 1000);
+    if (nread < 0) {
+      fprintf(stderr, "read request failed\n");
+      result = 1;
+      break;
+    }
+    if (nread == 0)
+      break;
+    fwrite(records, sizeof(records[0]), (size_t)nread / sizeof(records[0]), file);
+    nrecords += (uint32_t)nread / sizeof(records[0]);
+  }
+  if (fclose(file) != 0) {
+    perror(path);
+    result = 1;
+  }
+  if (libusb_control_transfer(handle, request_type_out, MIDI_TRACE_REQUEST_START, 0, 0, NULL, 0, 1000) < 0) {
+    fprintf(stderr, "start request failed\n");
+    result = 1;
+  }
+  if (result == 0)
+    printf("saved %u trace records to %s\n", nrecords, path);
+  return result;
+}
+
+int main(int argc, char* argv[])
+{
+  int reset = 0;
+  int profile = 0;
+  int interval = 0;
+  const char* trace_path = NULL;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "-r") == 0)
+      reset = 1;
+    else if (strcmp(argv[arg], "-p") == 0)
+      profile = 1;
+    else if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc)
+      trace_path = argv[++arg];
+    else
+      interval = atoi(argv[arg]);
+  }
+  if (libusb_init(NULL) != 0) {
+    fprintf(stderr, "libusb_init failed\n");
+    return 1;
+  }
+  libusb_device_handle* handle = libusb_open_device_with_vid_pid(NULL, ADAPTER_VID, ADAPTER_PID);
+  if (handle == NULL)
+    handle = libusb_open_device_with_vid_pid(NULL, ADAPTER_VID, ADAPTER_UMP_PID);
+  if (handle == NULL) {
+    fprintf(stderr, "adapter %04x:%04x or %04x:%04x not found\n", ADAPTER_VID, ADAPTER_PID, ADAPTER_VID, ADAPTER_UMP_PID);
+    libusb_exit(NULL);
+    return 1;
+  }
+  const uint8_t request_type_in = LIBUSB_ENDPOINT_IN | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+  const uint8_t request_type_out = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
+  int result = 0;
+  if (reset && libusb_control_transfer(handle, request_type_out, MIDI_TELEMETRY_REQUEST_RESET, 0, 0, NULL, 0, 1000) < 0) {
+    fprintf(stderr, "reset request failed\n");
+    result = 1;
+  }
+  if (reset && profile &&
+      libusb_control_transfer(handle, request_type_out, MIDI_PROFILE_REQUEST_RESET, 0, 0, NULL, 0, 1000) < 0) {
+    fprintf(stderr, "profile reset request failed; is the firmware built with CFG_MIDI_PROFILE?\n");
+    result = 1;
+  }
+  while (result == 0) {
+    midi_telemetry_t telemetry;
+    memset(&telemetry, 0, sizeof(telemetry));
+    int nread = libusb_control_transfer(handle, request_type_in, MIDI_TELEMETRY_REQUEST_GET, 0, 0,
+                                        (unsigned char*)&telemetry, sizeof(telemetry), 1000);
+    if (nread < (int)offsetof(midi_telemetry_t, out) || telemetry.version != MIDI_TELEMETRY_VERSION) {
+      fprintf(stderr, "get request failed or returned an unknown version\n");
+      result = 1;
+      break;
+    }
+    if (trace_path != NULL) {
+      result = save_trace(handle, &telemetry, trace_path);
+      break;
+    }
+    printf("USB OUT packets %u, receive FIFO high water %u bytes, stalls %u\n",
+           telemetry.usb_out_packets, telemetry.usb_out_fifo_high_water, telemetry.usb_out_stalls);
+    printf("%-4s %5s %12s %10s %10s %10s\n", "dir", "cable", "bytes", "dropped", "high water", "filtered");
+    print_cables("out", telemetry.out, telemetry.num_cables_out);
+    print_cables("in", telemetry.in, telemetry.num_cables_in);
+    if (profile && (result = print_profile(handle)) != 0)
+      break;
+    if (interval <= 0)
+      break;
+    printf("\n");
+    sleep((unsigned)interval);
+  }
+  libusb_close(handle);
+  libusb_exit(NULL);
+  return result;
+}
@@ -0,0 +1,88 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program prints a trace file (See midi_trace.h), one record per
+// line: the time in microseconds since the first record, the kind, and the
+// USB MIDI event packet or the MIDI port and byte. With -n it leaves out
+// the times, so that diff shows where two traces of the same input carried
+// different data.
+//
+//   midi_trace_tool [-n] trace
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "midi_trace.h"
+
+int main(int argc, char* argv[])
+{
+  int times = 1;
+  const char* path = NULL;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "-n") == 0)
+      times = 0;
+    else
+      path = argv[arg];
+  }
+  if (path == NULL) {
+    fprintf(stderr, "usage: midi_trace_tool [-n] trace\n");
+    return 2;
+  }
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return 1;
+  }
+  midi_trace_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "MTRC", 4) != 0 ||
+      header.version != MIDI_TRACE_VERSION) {
+    fprintf(stderr, "%s is not a version %u trace file\n", path, MIDI_TRACE_VERSION);
+    fclose(file);
+    return 1;
+  }
+  printf("# %u IN cables, %u OUT cables\n", header.num_cables_in, header.num_cables_out);
+  static const char* const kinds[4] = {"usb-out", "usb-in", "din-in", "din-out"};
+  midi_trace_record_t record;
+  uint64_t time_us = 0;
+  uint32_t prev_time = 0, nrecords = 0;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    if (nrecords++ > 0)
+      time_us += midi_trace_elapsed(prev_time, &record);
+    prev_time = midi_trace_time(&record);
+    if (times)
+      printf("%12llu ", (unsigned long long)time_us);
+    uint8_t kind = midi_trace_kind(&record);
+    if (kind == MIDI_TRACE_USB_OUT || kind == MIDI_TRACE_USB_IN)
+      printf("%-7s cable %2u  %02x %02x %02x %02x\n", kinds[kind], record.data[0] >> 4, record.data[0],
+             record.data[1], record.data[2], record.data[3]);
+    else
+      printf("%-7s port  %c   %02x\n", kinds[kind], 'A' + record.data[0], record.data[1]);
+  }
+  fclose(file);
+  return 0;
+}
@@ -0,0 +1,1019 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program runs the whole firmware (main.c and the modules it uses)
+// against mocks of tinyusb, pio_midi_uart_lib and the pico-sdk, which
+// model 1 ms full speed USB frames and 31250 baud serial lines (See
+// sim.h). Each scenario plays a USB host application and the MIDI devices
+// plugged into the MIDI IN ports, and follows every byte through the
+// adapter. For each path it reports how many bytes arrived and their
+// latency percentiles, the high water mark of the firmware's queue for the
+// path, the bytes the firmware or a port's receive buffer dropped, the bytes
+// that never arrived and the bytes that arrived out of order or changed.
+//
+// USB to MIDI OUT latency runs from when the host application queued the
+// byte until its stop bit ends on the MIDI OUT pin. MIDI IN to USB latency
+// runs from when the byte's stop bit ended on the MIDI IN pin until the
+// host received its USB transfer. Bytes follow the routing table the
+// firmware loaded, but thru routes would mix bytes into the MIDI OUT paths,
+// so the scenarios expect none.
+//
+// Each scenario runs in a child process, because the firmware never
+// returns from its main loop and keeps its state in static variables.
+//
+// -r replays the USB MIDI OUT packets and MIDI IN bytes of a trace file
+// (See midi_trace.h), such as one saved from an adapter in the field, at
+// their recorded times. -w saves the firmware's own trace of each scenario
+// to dir/scenario.trace. -u has the host select the UMP alternate setting
+// and send and receive UMP messages, in the group of each virtual cable.
+// -p adds the firmware's own latency and CPU cycle histograms (See
+// midi_profile.h) to the report; the cycles count the host CPU's time.
+//
+//   firmware_sim [-u] [-p] [-r trace] [-w dir] [scenario ...]
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <math.h>
+
+#include "tusb.h"
+#include "hardware/clocks.h"
+#include "midi_ports.h"
+#include "midi_route_table.h"
+#include "midi_telemetry.h"
+#include "midi_trace.h"
+#include "midi_profile.h"
+#if CFG_MIDI_TIMED_OUT
+#include "midi_timed_out.h"
+#endif
+#if CFG_MIDI_UMP
+#include "midi_ump.h"
+#endif
+#include "sim.h"
+
+#define STAMPS_SIZE   65536     // must be a power of 2
+#define START_US      10000     // when the scenarios start, after the device is mounted
+#define DRAIN_US      2000000   // how long the last bytes may take to arrive
+#define CONFIG_CABLE  (CFG_TUD_MIDI_NUMCABLES_OUT - 1) // the MIDI CONFIG virtual cable
+
+// main.c, built with main renamed
+int firmware_main(void);
+
+static const uint8_t in_gpios[] = {CFG_MIDI_IN_GPIOS};
+static const uint8_t out_gpios[] = {CFG_MIDI_OUT_GPIOS};
+
+// A byte on its way through the adapter and when it set off
+typedef struct {
+  uint32_t time_us;
+  uint8_t byte;
+} stamp_t;
+
+// The bytes on their way along one path through the adapter and the
+// latencies of the ones that arrived
+typedef struct {
+  stamp_t stamps[STAMPS_SIZE];
+  uint32_t head, tail;
+  uint32_t* latencies;
+  uint32_t nlatencies, max_latencies;
+  uint32_t errors;    // bytes that arrived out of order or changed
+} sim_path_t;
+
+// USB host to MIDI OUT port, for System Real-Time bytes, which may overtake
+// the others, and the rest
+static sim_path_t out_paths[MIDI_PORTS_NUM_OUT];
+static sim_path_t out_realtime_paths[MIDI_PORTS_NUM_OUT];
+// MIDI IN port to USB host
+static sim_path_t in_paths[MIDI_PORTS_NUM_IN];
+// Packets from the device on a cable with no MIDI IN port
+static uint32_t stray_in_packets;
+// The spacing of the MIDI Clock ticks sent on each MIDI OUT port
+typedef struct {
+  uint32_t last_us;       // when the last tick was sent
+  uint32_t nticks;
+  uint32_t nintervals;    // the intervals between ticks, not counting pauses
+  double sum, sum_sq;
+  uint32_t min, max;
+} sim_clock_t;
+static sim_clock_t out_clocks[MIDI_PORTS_NUM_OUT];
+// The running status of the device on each MIDI OUT port in
+// CFG_MIDI_RUNNING_STATUS_PORTS, or 0
+static uint8_t out_running_status[MIDI_PORTS_NUM_OUT];
+// Where the firmware's filters are in the data from the host on each
+// virtual cable and in the data from each MIDI IN port, so that the bytes
+// they drop are not expected anywhere
+static midi_filter_state_t out_filter_states[MIDI_ROUTE_MAX_CABLES];
+static midi_filter_state_t in_filter_states[MIDI_PORTS_NUM_IN];
+
+typedef struct {
+  const char* name;
+  const char* description;
+  uint32_t duration_us;           // how long the scenario sends MIDI data
+  void (*step)(uint32_t time_us); // sends the data due time_us into the scenario
+} scenario_t;
+
+static const scenario_t* scenario;
+static FILE* report;
+// Where -w saves the firmware's traces, or NULL
+static const char* trace_dir;
+static bool show_profile;  // -p
+
+// byte set off along path at time_us
+static void stamp_at(sim_path_t* path, uint8_t byte, uint32_t time_us)
+{
+  if (path->head - path->tail == STAMPS_SIZE)
+    panic("Too many bytes on their way");
+  stamp_t* entry = &path->stamps[path->head++ % STAMPS_SIZE];
+  entry->time_us = time_us;
+  entry->byte = byte;
+}
+
+static void stamp(sim_path_t* path, uint8_t byte)
+{
+  stamp_at(path, byte, (uint32_t)sim_now_us);
+}
+
+static void arrive(sim_path_t* path, uint8_t byte)
+{
+  if (path->head == path->tail) {
+    path->errors++;
+    return;
+  }
+  stamp_t* entry = &path->stamps[path->tail++ % STAMPS_SIZE];
+  if (entry->byte != byte)
+    path->errors++;
+  if (path->nlatencies == path->max_latencies) {
+    path->max_latencies = path->max_latencies ? 2 * path->max_latencies : 4096;
+    path->latencies = realloc(path->latencies, path->max_latencies * sizeof(uint32_t));
+    if (path->latencies == NULL)
+      panic("Out of memory");
+  }
+  path->latencies[path->nlatencies++] = (uint32_t)sim_now_us - entry->time_us;
+}
+
+// Return true if the filter with setting passes the next byte of the stream at state
+static bool filter_passes(midi_filter_setting_t setting, midi_filter_state_t* state, uint8_t byte)
+{
+  midi_filter_t filter;
+  midi_filter_init(&filter, setting);
+  return midi_filter_byte(&filter, state, byte);
+}
+
+// The path from the USB host through virtual cable cable_num for byte, or
+// NULL if the cable goes nowhere or the MIDI OUT port's filter drops it
+static sim_path_t* out_path(uint8_t cable_num, uint8_t byte)
+{
+  uint8_t port = midi_route_table.cable_ports[cable_num];
+  if (port >= MIDI_PORTS_NUM_OUT ||
+      !filter_passes(midi_route_table.out_filters[port], &out_filter_states[cable_num], byte))
+    return NULL;
+  return byte >= 0xF8 ? &out_realtime_paths[port] : &out_paths[port];
+}
+
+// Queue a USB MIDI event packet with code index number cin and nbytes
+// bytes for the host to send on virtual cable cable_num, without expecting
+// the bytes anywhere
+static void host_write(uint8_t cable_num, uint8_t cin, const uint8_t* bytes, uint8_t nbytes)
+{
+  uint8_t packet[4] = {(uint8_t)((cable_num << 4) | cin), 0, 0, 0};
+  memcpy(&packet[1], bytes, nbytes);
+#if CFG_MIDI_UMP
+  if (sim_usb_ump) {
+    uint32_t words[2];
+    uint8_t nwords = midi_ump_from_packet(packet, words);
+    for (uint8_t word = 0; word < nwords; word++) {
+      uint8_t word_bytes[4];
+      midi_ump_word_bytes(words[word], word_bytes);
+      if (!sim_usb_host_write(word_bytes))
+        panic("The USB host's queue is full");
+    }
+  }
+  else
+#endif
+  if (!sim_usb_host_write(packet))
+    panic("The USB host's queue is full");
+}
+
+// Like host_write(), but expect the bytes at the MIDI OUT port, latency
+// counting from time_us
+static void host_send_at(uint8_t cable_num, uint8_t cin, const uint8_t* bytes, uint8_t nbytes, uint32_t time_us)
+{
+  host_write(cable_num, cin, bytes, nbytes);
+  for (uint8_t idx = 0; idx < nbytes; idx++) {
+    sim_path_t* path = out_path(cable_num, bytes[idx]);
+    if (path != NULL)
+      stamp_at(path, bytes[idx], time_us);
+  }
+}
+
+static void host_send(uint8_t cable_num, uint8_t cin, const uint8_t* bytes, uint8_t nbytes)
+{
+  host_send_at(cable_num, cin, bytes, nbytes, (uint32_t)sim_now_us);
+}
+
+// Send the System Exclusive message in bytes, from 0xF0 to 0xF7, on virtual
+// cable cable_num with send, which is host_write() or host_send()
+static void host_sysex(void (*send)(uint8_t, uint8_t, const uint8_t*, uint8_t), uint8_t cable_num,
+                       const uint8_t* bytes, uint32_t nbytes)
+{
+  for (uint32_t idx = 0; idx < nbytes; idx += 3) {
+    uint8_t npacket = (uint8_t)tu_min32(nbytes - idx, 3);
+    uint8_t cin = idx + npacket < nbytes ? MIDI_CIN_SYSEX_START : (uint8_t)(MIDI_CIN_SYSEX_END_1BYTE + npacket - 1);
+    send(cable_num, cin, &bytes[idx], npacket);
+  }
+}
+
+static void host_send_sysex(uint8_t cable_num, const uint8_t* bytes, uint32_t nbytes)
+{
+  host_sysex(host_send, cable_num, bytes, nbytes);
+}
+
+#if CFG_MIDI_TIMED_OUT
+// The host's clock in the units of midi_timed_out.h
+static uint16_t host_time(uint64_t time_us)
+{
+  return (uint16_t)(time_us / MIDI_TIMED_TICK_US);
+}
+
+// Tell the adapter the time on the host's clock: a JR Clock message in UMP,
+// or else a clock envelope on virtual cable cable_num
+static void host_send_clock(uint8_t cable_num)
+{
+  uint16_t now = host_time(sim_now_us);
+#if CFG_MIDI_UMP
+  if (sim_usb_ump) {
+    uint8_t word[4];
+    midi_ump_word_bytes(((uint32_t)MIDI_UMP_UTILITY_JR_CLOCK << 20) | now, word);
+    if (!sim_usb_host_write(word))
+      panic("The USB host's queue is full");
+    return;
+  }
+#endif
+  uint8_t envelope[] = {0xF0, MIDI_TIMED_SYSEX_ID, MIDI_TIMED_CMD_CLOCK, now & 0x7F, (now >> 7) & 0x7F, now >> 14, 0xF7};
+  host_sysex(host_write, cable_num, envelope, sizeof(envelope));
+}
+
+// Send a Note On, or a Note On with velocity 0, on virtual cable cable_num
+// ahead of time, to go out at time_us
+static void host_send_timed_note(uint8_t cable_num, uint8_t note, bool on, uint32_t time_us)
+{
+  uint16_t timestamp = host_time(time_us);
+#if CFG_MIDI_UMP
+  if (sim_usb_ump) {
+    uint8_t word[4];
+    midi_ump_word_bytes(((uint32_t)MIDI_UMP_UTILITY_JR_TIMESTAMP << 20) | timestamp, word);
+    if (!sim_usb_host_write(word))
+      panic("The USB host's queue is full");
+  }
+  else
+#endif
+  {
+    uint8_t envelope[] = {0xF0, MIDI_TIMED_SYSEX_ID, MIDI_TIMED_CMD_TIMESTAMP, timestamp & 0x7F, (timestamp >> 7) & 0x7F,
+                          timestamp >> 14, 0xF7};
+    host_sysex(host_write, cable_num, envelope, sizeof(envelope));
+  }
+  uint8_t msg[3] = {0x90, note, on ? 0x40 : 0};
+  host_send_at(cable_num, MIDI_CIN_NOTE_ON, msg, sizeof(msg), time_us);
+}
+#endif
+
+// Send a Note On, or a Note Off as a Note On with velocity 0, on virtual cable cable_num
+static void host_send_note(uint8_t cable_num, uint8_t note, bool on)
+{
+  uint8_t msg[3] = {0x90, note, on ? 0x40 : 0};
+  host_send(cable_num, MIDI_CIN_NOTE_ON, msg, sizeof(msg));
+}
+
+// Play a Note On, or a Note On with velocity 0, into MIDI IN port in_port
+static void din_send_note(uint8_t in_port, uint8_t note, bool on)
+{
+  uint8_t msg[3] = {0x90, note, on ? 0x40 : 0};
+  for (uint8_t idx = 0; idx < sizeof(msg); idx++) {
+    if (!sim_midi_in_write(in_gpios[in_port], msg[idx]))
+      panic("Too many bytes on their way to MIDI IN %c", 'A' + in_port);
+  }
+}
+
+// Return true once every period_us, at phase_us into the period
+static bool every(uint32_t time_us, uint32_t period_us, uint32_t phase_us)
+{
+  return time_us >= phase_us && (time_us - phase_us) % period_us < SIM_STEP_US;
+}
+
+//--------------------------------------------------------------------+
+// Scenarios
+//--------------------------------------------------------------------+
+static void out_notes_step(uint32_t time_us)
+{
+  for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_OUT; cable++) {
+    if (every(time_us, 1000, cable * 100))
+      host_send_note(cable, (uint8_t)(60 + cable), (time_us / 1000) % 2 == 0);
+  }
+}
+
+static void out_overload_step(uint32_t time_us)
+{
+  if (every(time_us, 480, 0))
+    host_send_note(0, 60, (time_us / 480) % 2 == 0);
+  if (MIDI_PORTS_NUM_OUT > 1 && every(time_us, 10000, 0))
+    host_send_note(1, 61, (time_us / 10000) % 2 == 0);
+}
+
+static void sysex_clock_step(uint32_t time_us)
+{
+  static uint32_t sysex_packets;
+  if (every(time_us, 1000, 0)) {
+    // 3072 bytes of SysEx at about the rate the port sends them
+    uint8_t bytes[3] = {0x10, 0x20, 0x30};
+    if (sysex_packets == 0) {
+      bytes[0] = 0xF0;
+      host_send(0, MIDI_CIN_SYSEX_START, bytes, 3);
+    }
+    else if (sysex_packets < 1023) {
+      host_send(0, MIDI_CIN_SYSEX_START, bytes, 3);
+    }
+    else if (sysex_packets == 1023) {
+      bytes[2] = 0xF7;
+      host_send(0, MIDI_CIN_SYSEX_END_3BYTE, bytes, 3);
+    }
+    sysex_packets++;
+  }
+  // MIDI Clock at 120 BPM
+  if (every(time_us, 20833, 500)) {
+    uint8_t clock = 0xF8;
+    host_send(0, MIDI_CIN_1BYTE_DATA, &clock, 1);
+  }
+}
+
+static void in_notes_step(uint32_t time_us)
+{
+  // Back to back: a 3 byte message takes 960 us
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (every(time_us, 3 * SIM_BYTE_US, port * 100))
+      din_send_note(port, (uint8_t)(60 + port), (time_us / 960) % 2 == 0);
+  }
+}
+
+static void clock_step(uint32_t time_us)
+{
+  // The same 120 BPM MIDI Clock on OUT A and OUT B, with a Stop and a Continue
+  static const struct {
+    uint32_t time_ms;
+    uint8_t byte;
+  } messages[] = {{0, 0xFA}, {1500, 0xFC}, {1700, 0xFB}};
+  for (uint8_t cable = 0; cable < 2 && cable < MIDI_PORTS_NUM_OUT; cable++) {
+    for (size_t idx = 0; idx < TU_ARRAY_SIZE(messages); idx++) {
+      if (every(time_us, 4000000, messages[idx].time_ms * 1000))
+        host_send(cable, MIDI_CIN_1BYTE_DATA, &messages[idx].byte, 1);
+    }
+    if (every(time_us, 20833, 300)) {
+      uint8_t clock = 0xF8;
+      host_send(cable, MIDI_CIN_1BYTE_DATA, &clock, 1);
+    }
+  }
+}
+
+#if CFG_MIDI_TIMED_OUT
+// A note every 10 ms on OUT A and OUT B, which the host application sends
+// up to 2 ms late because of its own scheduling. It sends the notes for
+// OUT A when it wakes up, and the ones for OUT B 5 ms ahead of time with
+// timestamps. The latencies count from when each note should play.
+static void timed_step(uint32_t time_us)
+{
+  static uint32_t live_notes, timed_notes;
+  if (every(time_us, 50000, 0) && MIDI_PORTS_NUM_OUT > 1)
+    host_send_clock(1);
+  // The same scheduling delay for each note on both cables
+  for (int cable = 0; cable < 2 && cable < MIDI_PORTS_NUM_OUT; cable++) {
+    uint32_t* nnotes = cable ? &timed_notes : &live_notes;
+    uint32_t play_us = 10000 + *nnotes * 10000;
+    uint32_t late_us = (*nnotes * 2654435761u >> 16) % 2000 / SIM_STEP_US * SIM_STEP_US;
+    if (play_us + late_us - (cable ? 5000 : 0) != time_us)
+      continue;
+    bool on = *nnotes % 2 == 0;
+    if (cable)
+      host_send_timed_note(1, 64, on, START_US + play_us);
+    else
+      host_send_at(0, MIDI_CIN_NOTE_ON, (const uint8_t[]){0x90, 64, on ? 0x40 : 0}, 3, START_US + play_us);
+    (*nnotes)++;
+  }
+}
+#endif
+
+static void filter_step(uint32_t time_us)
+{
+  static bool configured;
+  if (!configured) {
+    // Drop MIDI Clock and Active Sensing on every MIDI OUT port but A, and
+    // Active Sensing from MIDI IN A
+    configured = true;
+    uint8_t cmd[] = {0xF0, MIDI_ROUTE_SYSEX_ID, MIDI_ROUTE_CMD_SET_OUT_FILTER, 0, 0x00, 0x20, 0x01, 0, 0, 0, 0xF7};
+    for (uint8_t port = 1; port < MIDI_PORTS_NUM_OUT; port++) {
+      cmd[3] = port;
+      host_send_sysex(CONFIG_CABLE, cmd, sizeof(cmd));
+    }
+    cmd[2] = MIDI_ROUTE_CMD_SET_IN_FILTER;
+    cmd[3] = 0;
+    cmd[5] = 0x00;
+    host_send_sysex(CONFIG_CABLE, cmd, sizeof(cmd));
+  }
+  // Give the firmware a few ms to apply the filters
+  if (time_us < 5000)
+    return;
+  for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_OUT; cable++) {
+    // A Control Change every ms is most of the line, then 96 PPQN clock at 120 BPM
+    if (every(time_us, 1000, 5000 + cable * 100)) {
+      uint8_t msg[3] = {0xB0, 7, (uint8_t)((time_us / 1000) & 0x7F)};
+      host_send(cable, MIDI_CIN_CONTROL_CHANGE, msg, sizeof(msg));
+    }
+    if (every(time_us, 5208, 5050)) {
+      uint8_t clock = 0xF8;
+      host_send(cable, MIDI_CIN_1BYTE_DATA, &clock, 1);
+    }
+    if (every(time_us, 300000, 5000)) {
+      uint8_t sensing = 0xFE;
+      host_send(cable, MIDI_CIN_1BYTE_DATA, &sensing, 1);
+    }
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (every(time_us, 4 * SIM_BYTE_US, 5000 + port * 100))
+      din_send_note(port, (uint8_t)(60 + port), (time_us / 1280) % 2 == 0);
+    if (every(time_us, 4 * SIM_BYTE_US, 5000 + port * 100 + 3 * SIM_BYTE_US) &&
+        !sim_midi_in_write(in_gpios[port], 0xFE))
+      panic("Too many bytes on their way to MIDI IN %c", 'A' + port);
+  }
+}
+
+#if CFG_MIDI_RUNNING_STATUS_PORTS & 0x01
+// Notes on OUT A three times as fast as the line sends them with running
+// status, so the port's queue fills in the middle of runs of messages with
+// the same status. Every eighth is a Note Off, which changes the status.
+static void running_status_step(uint32_t time_us)
+{
+  static uint32_t nnotes;
+  if (every(time_us, 200, 0)) {
+    uint8_t msg[3] = {nnotes % 8 == 7 ? 0x80 : 0x90, (uint8_t)(60 + nnotes % 12), 0x40};
+    host_send(0, msg[0] >> 4, msg, sizeof(msg));
+    nnotes++;
+  }
+}
+#endif
+
+// The host filters Control Changes from MIDI IN A and suspends the bus.
+// MIDI Clock, Active Sensing and a Control Change into MIDI IN A must not
+// wake it, but the Note On after them does. In case nothing wakes the host,
+// it resumes the bus by itself at 150 ms.
+static void suspend_step(uint32_t time_us)
+{
+  if (every(time_us, 1000000, 0)) {
+    uint8_t cmd[] = {0xF0, MIDI_ROUTE_SYSEX_ID, MIDI_ROUTE_CMD_SET_IN_FILTER, 0, MIDI_FILTER_CONTROL_CHANGE, 0, 0, 0, 0, 0, 0xF7};
+    host_send_sysex(CONFIG_CABLE, cmd, sizeof(cmd));
+  }
+  // Give the firmware a few ms to apply the filter
+  if (every(time_us, 1000000, 5000))
+    sim_usb_suspend();
+  for (uint8_t byte = 0xF8; byte != 0; byte = byte == 0xF8 ? 0xFE : 0) {
+    if (every(time_us, 1000000, byte == 0xF8 ? 10000 : 20000) && !sim_midi_in_write(in_gpios[0], byte))
+      panic("Too many bytes on their way to MIDI IN A");
+  }
+  if (every(time_us, 1000000, 30000)) {
+    const uint8_t msg[] = {0xB0, 7, 0x40};
+    for (uint8_t idx = 0; idx < sizeof(msg); idx++) {
+      if (!sim_midi_in_write(in_gpios[0], msg[idx]))
+        panic("Too many bytes on their way to MIDI IN A");
+    }
+  }
+  if (every(time_us, 1000000, 49000) && sim_usb_stats.remote_wakeups != 0)
+    panic("A filtered message woke the host");
+  if (every(time_us, 1000000, 50000))
+    din_send_note(0, 60, true);
+  if (every(time_us, 1000000, 100000))
+    din_send_note(0, 60, false);
+  if (every(time_us, 1000000, 150000))
+    sim_usb_resume();
+  // The stdio UART and any other peripheral run from clk_peri
+  if (every(time_us, 1000000, 152000) && clock_get_hz(clk_peri) != clock_get_hz(clk_sys))
+    panic("clk_peri stayed at %u Hz after the bus resumed", clock_get_hz(clk_peri));
+}
+
+static void mixed_step(uint32_t time_us)
+{
+  in_notes_step(time_us);
+  for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_OUT; cable++) {
+    if (every(time_us, 2000, cable * 300))
+      host_send_note(cable, (uint8_t)(48 + cable), (time_us / 2000) % 2 == 0);
+  }
+}
+
+// The records of the -r trace file and the time of each from the start of
+// the replay
+static midi_trace_record_t* replay_records;
+static uint32_t* replay_times;
+static uint32_t replay_nrecords, replay_next;
+
+static void replay_step(uint32_t time_us)
+{
+  static const uint8_t cin_nbytes[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+  for (; replay_next < replay_nrecords && replay_times[replay_next] <= time_us; replay_next++) {
+    const midi_trace_record_t* record = &replay_records[replay_next];
+    switch (midi_trace_kind(record)) {
+      case MIDI_TRACE_USB_OUT:
+        if ((record->data[0] >> 4) < CFG_TUD_MIDI_NUMCABLES_OUT)
+          host_send(record->data[0] >> 4, record->data[0] & 0xF, &record->data[1], cin_nbytes[record->data[0] & 0xF]);
+        break;
+      case MIDI_TRACE_DIN_IN:
+        if (record->data[0] < MIDI_PORTS_NUM_IN && !sim_midi_in_write(in_gpios[record->data[0]], record->data[1]))
+          panic("Too many bytes on their way to MIDI IN %c", 'A' + record->data[0]);
+        break;
+      default:
+        break; // the adapter's output
+    }
+  }
+}
+
+// Load the trace file path for the replay scenario. The firmware read each
+// MIDI IN byte when its stop bit had ended, so the replay starts sending it
+// SIM_BYTE_US earlier. Return the time from the start of the replay to the
+// last record, or 0 if the file cannot be read.
+static uint32_t load_replay(const char* path)
+{
+  FILE* file = fopen(path, "rb");
+  if (file == NULL) {
+    perror(path);
+    return 0;
+  }
+  midi_trace_header_t header;
+  if (fread(&header, sizeof(header), 1, file) != 1 || memcmp(header.magic, "MTRC", 4) != 0 ||
+      header.version != MIDI_TRACE_VERSION) {
+    fprintf(stderr, "%s is not a version %u trace file\n", path, MIDI_TRACE_VERSION);
+    fclose(file);
+    return 0;
+  }
+  midi_trace_record_t record;
+  uint32_t max_records = 0, prev_time = 0, time_us = SIM_BYTE_US;
+  while (fread(&record, sizeof(record), 1, file) == 1) {
+    if (replay_nrecords == max_records) {
+      max_records = max_records ? 2 * max_records : 4096;
+      replay_records = realloc(replay_records, max_records * sizeof(*replay_records));
+      replay_times = realloc(replay_times, max_records * sizeof(*replay_times));
+      if (replay_records == NULL || replay_times == NULL)
+        panic("Out of memory");
+    }
+    if (replay_nrecords > 0)
+      time_us += midi_trace_elapsed(prev_time, &record);
+    prev_time = midi_trace_time(&record);
+    replay_records[replay_nrecords] = record;
+    replay_times[replay_nrecords++] = midi_trace_kind(&record) == MIDI_TRACE_DIN_IN ? time_us - SIM_BYTE_US : time_us;
+  }
+  fclose(file);
+  if (replay_nrecords == 0)
+    fprintf(stderr, "%s has no records\n", path);
+  return replay_nrecords ? time_us + SIM_STEP_US : 0;
+}
+
+static scenario_t replay_scenario = {"replay", "The USB MIDI OUT packets and MIDI IN bytes of a trace file", 0, replay_step};
+
+static const scenario_t scenarios[] = {
+  {"out-notes", "Note On/Off every 1 ms on every MIDI OUT cable for 500 ms", 500000, out_notes_step},
+  {"out-overload", "Notes at twice the line rate on OUT A and one every 10 ms on OUT B for 200 ms", 200000, out_overload_step},
+  {"sysex-clock", "3 kbyte SysEx on OUT A, 3 bytes per ms, with 120 BPM MIDI Clock mixed in", 1100000, sysex_clock_step},
+  {"in-notes", "Notes back to back into every MIDI IN port for 500 ms", 500000, in_notes_step},
+  {"mixed", "in-notes plus a note every 2 ms on every MIDI OUT cable for 500 ms", 500000, mixed_step},
+  {"filter", "Control Changes, 96 PPQN clock and Active Sensing on every MIDI OUT cable, and notes with Active Sensing "
+             "into every MIDI IN port for 500 ms, with Clock and Active Sensing filtered off OUT B and up and Active "
+             "Sensing off IN A",
+   505000, filter_step},
+  {"clock", "120 BPM MIDI Clock with Start, Stop and Continue on OUT A and OUT B for 3 s", 3000000, clock_step},
+#if CFG_MIDI_TIMED_OUT
+  {"timed", "A note every 10 ms sent up to 2 ms late on OUT A, and 5 ms ahead with timestamps on OUT B, for 1 s",
+   1000000, timed_step},
+#endif
+#if CFG_MIDI_RUNNING_STATUS_PORTS & 0x01
+  {"running-status", "Notes every 200 us on OUT A, which sends them with running status, for 300 ms", 300000,
+   running_status_step},
+#endif
+  {"suspend", "The host filters Control Changes from MIDI IN A and suspends the bus at 5 ms; MIDI Clock, Active "
+              "Sensing and a Control Change into MIDI IN A at 10, 20 and 30 ms, then a Note On at 50 ms that wakes "
+              "the host and a Note Off at 100 ms",
+   155000, suspend_step},
+};
+
+//--------------------------------------------------------------------+
+// Mock callbacks
+//--------------------------------------------------------------------+
+// A MIDI Clock tick went out on MIDI OUT port port
+static void clock_sent(uint8_t port)
+{
+  sim_clock_t* clock = &out_clocks[port];
+  uint32_t interval = (uint32_t)sim_now_us - clock->last_us;
+  // Ticks more than 125 ms apart, under 20 BPM, are a pause
+  if (clock->nticks > 0 && interval <= 125000) {
+    if (clock->nintervals == 0 || interval < clock->min)
+      clock->min = interval;
+    if (interval > clock->max)
+      clock->max = interval;
+    clock->sum += interval;
+    clock->sum_sq += (double)interval * interval;
+    clock->nintervals++;
+  }
+  clock->last_us = (uint32_t)sim_now_us;
+  clock->nticks++;
+}
+
+void sim_midi_out_sent(uint gpio, uint8_t byte)
+{
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    if (out_gpios[port] == gpio) {
+      if (CFG_MIDI_RUNNING_STATUS_PORTS & (1u << port)) {
+        // Like a MIDI receiver, take a data byte where a status byte the
+        // same as the running status is due to mean that status byte first
+        sim_path_t* path = &out_paths[port];
+        uint8_t* status = &out_running_status[port];
+        if (byte < 0x80 && *status != 0 && path->head != path->tail &&
+            path->stamps[path->tail % STAMPS_SIZE].byte == *status)
+          arrive(path, *status);
+        else if (byte >= 0x80 && byte < 0xF0)
+          *status = byte;
+        else if (byte >= 0xF0 && byte < 0xF8)
+          *status = 0;
+      }
+      arrive(byte >= 0xF8 ? &out_realtime_paths[port] : &out_paths[port], byte);
+      if (byte == 0xF8)
+        clock_sent(port);
+      return;
+    }
+  }
+  panic("Byte sent on pin %u, which is not a MIDI OUT pin", gpio);
+}
+
+void sim_midi_in_received(uint gpio, uint8_t byte)
+{
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (in_gpios[port] == gpio) {
+      if (filter_passes(midi_route_table.in_filters[port], &in_filter_states[port], byte))
+        stamp(&in_paths[port], byte);
+      return;
+    }
+  }
+}
+
+#if CFG_MIDI_UMP
+// The USB host received a UMP word
+static void host_received_ump(const uint8_t bytes[4])
+{
+  static uint32_t words[4];
+  static uint8_t nwords;
+  words[nwords++] = midi_ump_word(bytes);
+  if (nwords < midi_ump_num_words(words[0]))
+    return;
+  nwords = 0;
+  uint8_t group = midi_ump_group(words[0]);
+  if (group >= MIDI_PORTS_NUM_IN) {
+    stray_in_packets++;
+    return;
+  }
+  uint8_t msg[MIDI_UMP_MAX_BYTES];
+  uint8_t nbytes = midi_ump_to_bytes(words, msg);
+  for (uint8_t idx = 0; idx < nbytes; idx++) {
+    arrive(&in_paths[group], msg[idx]);
+  }
+}
+#endif
+
+void sim_usb_host_received(const uint8_t packet[4])
+{
+#if CFG_MIDI_UMP
+  if (sim_usb_ump) {
+    host_received_ump(packet);
+    return;
+  }
+#endif
+  // MIDI 1.0 Table 4-1: the number of MIDI bytes for each code index number
+  static const uint8_t cin_nbytes[16] = {0, 0, 2, 3, 3, 1, 2, 3, 3, 3, 3, 3, 2, 2, 3, 1};
+  uint8_t cable_num = packet[0] >> 4;
+  if (cable_num >= MIDI_PORTS_NUM_IN) {
+    stray_in_packets++;
+    return;
+  }
+  for (uint8_t idx = 0; idx < cin_nbytes[packet[0] & 0xF]; idx++) {
+    arrive(&in_paths[cable_num], packet[1 + idx]);
+  }
+}
+
+//--------------------------------------------------------------------+
+// Running a scenario
+//--------------------------------------------------------------------+
+static bool path_done(const sim_path_t* path)
+{
+  return path->head == path->tail;
+}
+
+static bool all_arrived(void)
+{
+  if (sim_usb_host_backlog() != 0)
+    return false;
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    if (!path_done(&out_paths[port]) || !path_done(&out_realtime_paths[port]))
+      return false;
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (!path_done(&in_paths[port]) || sim_midi_in_pending(in_gpios[port]) != 0)
+      return false;
+  }
+  return true;
+}
+
+static int compare_latency(const void* a, const void* b)
+{
+  uint32_t x = *(const uint32_t*)a;
+  uint32_t y = *(const uint32_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const sim_path_t* path, uint32_t percent)
+{
+  return path->latencies[(uint64_t)(path->nlatencies - 1) * percent / 100];
+}
+
+// Print one row of the report. Return the path's errors.
+static uint32_t report_path(const char* name, sim_path_t* path, uint32_t queue_high_water, uint32_t dropped)
+{
+  fprintf(report, "  %-16s %7u", name, path->nlatencies);
+  if (path->nlatencies > 0) {
+    qsort(path->latencies, path->nlatencies, sizeof(uint32_t), compare_latency);
+    fprintf(report, " %7u %7u %7u %7u", percentile(path, 50), percentile(path, 90), percentile(path, 99),
+            path->latencies[path->nlatencies - 1]);
+  }
+  else {
+    fprintf(report, " %7s %7s %7s %7s", "-", "-", "-", "-");
+  }
+  fprintf(report, " %6u %7u %6u %6u\n", queue_high_water, dropped, path->head - path->tail, path->errors);
+  return path->errors;
+}
+
+// Save the firmware's trace to trace_dir/scenario.trace
+static void save_trace(void)
+{
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s.trace", trace_dir, scenario->name);
+  FILE* file = fopen(path, "wb");
+  if (file == NULL) {
+    perror(path);
+    return;
+  }
+  midi_trace_header_t header = {
+    .magic = {'M', 'T', 'R', 'C'},
+    .version = MIDI_TRACE_VERSION,
+    .num_cables_in = CFG_TUD_MIDI_NUMCABLES_IN,
+    .num_cables_out = CFG_TUD_MIDI_NUMCABLES_OUT,
+  };
+  fwrite(&header, sizeof(header), 1, file);
+  midi_trace_freeze();
+  const midi_trace_record_t* records;
+  uint32_t nrecords = 0, count;
+  while ((count = midi_trace_peek(nrecords, &records)) > 0) {
+    fwrite(records, sizeof(*records), count, file);
+    nrecords += count;
+  }
+  fclose(file);
+  fprintf(report, "  saved %u trace records to %s\n", nrecords, path);
+}
+
+#if CFG_MIDI_PROFILE
+static void report_hist(const char* name, const midi_profile_hist_t* hist, uint8_t shift)
+{
+  fprintf(report, "  %-16s %7u %7u %7u %7u %7u\n", name, hist->count, midi_profile_percentile(hist, shift, 50),
+          midi_profile_percentile(hist, shift, 90), midi_profile_percentile(hist, shift, 99), hist->max);
+}
+
+// Report the firmware's histograms. Their percentiles are the limits of
+// the buckets they fall in.
+static void report_profile(void)
+{
+  fprintf(report, "  %-16s %7s %7s %7s %7s %7s\n", "firmware latency", "batches", "p50 us", "p90 us", "p99 us",
+          "max us");
+  report_hist("MIDI IN > USB", &midi_profile.in_latency, MIDI_PROFILE_LATENCY_SHIFT);
+  report_hist("USB > MIDI OUT", &midi_profile.out_latency, MIDI_PROFILE_LATENCY_SHIFT);
+  fprintf(report, "  %-16s %7s %7s %7s %7s %7s\n", "task cycles", "runs", "p50", "p90", "p99", "max");
+  for (uint32_t task_id = 0; task_id < midi_profile.ntasks; task_id++) {
+    const midi_profile_task_t* task = &midi_profile.tasks[task_id];
+    if (task->cycles.count != 0)
+      report_hist(task->name, &task->cycles, MIDI_PROFILE_CYCLES_SHIFT);
+  }
+}
+#endif
+
+static void finish(void)
+{
+  fprintf(report, "%s: %s%s\n", scenario->name, scenario->description, sim_usb_ump ? ", in UMP" : "");
+  fprintf(report, "  %-16s %7s %7s %7s %7s %7s %6s %7s %6s %6s\n", "path", "bytes", "p50 us", "p90 us", "p99 us",
+          "max us", "queue", "dropped", "lost", "errors");
+  uint32_t errors = 0;
+  char name[32];
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    sim_path_t* path = &out_paths[port];
+    // The telemetry counts by virtual cable
+    uint8_t cable;
+    for (cable = 0; cable < MIDI_ROUTE_MAX_CABLES && midi_route_table.cable_ports[cable] != port; cable++) {
+    }
+    const midi_telemetry_cable_t* counters = &midi_telemetry.out[cable < MIDI_ROUTE_MAX_CABLES ? cable : port];
+    if (path->head != 0) {
+      snprintf(name, sizeof(name), "USB > OUT %c", 'A' + port);
+      errors += report_path(name, path, counters->high_water, counters->dropped);
+    }
+    path = &out_realtime_paths[port];
+    if (path->head != 0) {
+      snprintf(name, sizeof(name), "USB > OUT %c RT", 'A' + port);
+      errors += report_path(name, path, 0, 0);
+    }
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    sim_path_t* path = &in_paths[port];
+    uint32_t overruns = sim_midi_in_overruns(in_gpios[port]);
+    if (path->head != 0 || overruns != 0) {
+      snprintf(name, sizeof(name), "IN %c > USB", 'A' + port);
+      errors += report_path(name, path, midi_telemetry.in[port].high_water, midi_telemetry.in[port].dropped + overruns);
+    }
+  }
+  fprintf(report, "  USB OUT: %u transfers, %u NAKed frames, receive FIFO high water %u bytes, %u stalls\n",
+          sim_usb_stats.out_transfers, sim_usb_stats.out_naks, midi_telemetry.usb_out_fifo_high_water,
+          midi_telemetry.usb_out_stalls);
+  fprintf(report, "  USB IN:  %u transfers, %.1f packets per transfer, transmit FIFO high water %u bytes",
+          sim_usb_stats.in_transfers,
+          sim_usb_stats.in_transfers ? (double)sim_usb_stats.in_packets / sim_usb_stats.in_transfers : 0.0,
+          sim_usb_stats.in_fifo_high_water);
+  if (stray_in_packets)
+    fprintf(report, ", %u packets on unknown cables", stray_in_packets);
+  uint32_t filtered_out = 0, filtered_in = 0;
+  for (uint8_t cable = 0; cable < MIDI_TELEMETRY_MAX_CABLES; cable++) {
+    filtered_out += midi_telemetry.out[cable].filtered;
+    filtered_in += midi_telemetry.in[cable].filtered;
+  }
+  if (filtered_out || filtered_in)
+    fprintf(report, "\n  filtered: %u bytes from the USB host, %u bytes from the MIDI IN ports", filtered_out, filtered_in);
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    const sim_clock_t* clock = &out_clocks[port];
+    if (clock->nintervals < 2)
+      continue;
+    double mean = clock->sum / clock->nintervals;
+    double variance = clock->sum_sq / clock->nintervals - mean * mean;
+    fprintf(report, "\n  clock on OUT %c%s: %u ticks %.0f us apart, std dev %.0f us, min %u us, max %u us", 'A' + port,
+            CFG_MIDI_CLOCK_REGEN_PORTS & (1u << port) ? " (regenerated)" : "", clock->nticks, mean,
+            variance > 0 ? sqrt(variance) : 0.0, clock->min, clock->max);
+  }
+  if (sim_usb_stats.suspends)
+    fprintf(report, "\n  USB suspend: %u suspends, %u remote wakeups, %.1f ms suspended", sim_usb_stats.suspends,
+            sim_usb_stats.remote_wakeups, (double)sim_usb_stats.suspended_us / 1000);
+  if (sim_pico_stats.min_sys_clock_hz)
+    fprintf(report, ", clk_sys down to %.0f MHz", (double)sim_pico_stats.min_sys_clock_hz / 1000000);
+  fprintf(report, "\n  took %.1f ms, core 0 slept on %.0f%% of main loop passes\n", (double)(sim_now_us - START_US) / 1000,
+          100.0 * sim_pico_stats.sleeps / (double)(sim_now_us / SIM_STEP_US));
+#if CFG_MIDI_PROFILE
+  if (show_profile)
+    report_profile();
+#endif
+  if (trace_dir != NULL)
+    save_trace();
+  fprintf(report, "\n");
+  fclose(report);
+  exit(errors || stray_in_packets ? 1 : 0);
+}
+
+void sim_step(void)
+{
+  sim_now_us += SIM_STEP_US;
+  uint64_t end_us = START_US + scenario->duration_us;
+  if (sim_now_us >= START_US && sim_now_us < end_us)
+    scenario->step((uint32_t)(sim_now_us - START_US));
+  sim_pico_step();
+  sim_midi_step();
+  sim_usb_step();
+  if (sim_now_us >= end_us && (all_arrived() || sim_now_us >= end_us + DRAIN_US))
+    finish();
+}
+
+// Run the firmware with the_scenario in a child process. Return true if
+// nothing arrived out of order or changed.
+static bool run(const scenario_t* the_scenario)
+{
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+  if (pid == 0) {
+    scenario = the_scenario;
+    for (uint8_t cable = 0; cable < MIDI_ROUTE_MAX_CABLES; cable++) {
+      midi_filter_state_init(&out_filter_states[cable]);
+    }
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+      midi_filter_state_init(&in_filter_states[port]);
+    }
+    // The report goes to stdout and anything the firmware prints to stderr
+    report = fdopen(dup(STDOUT_FILENO), "w");
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    setvbuf(stdout, NULL, _IOLBF, 0);
+    firmware_main();
+    exit(1); // not reached
+  }
+  int status;
+  waitpid(pid, &status, 0);
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+  const char* replay_path = NULL;
+  int nnames = 0;
+  for (int arg = 1; arg < argc; arg++) {
+    if (strcmp(argv[arg], "-u") == 0) {
+      if (!CFG_MIDI_UMP) {
+        printf("-u needs a tusb_config.h with CFG_MIDI_UMP set\n");
+        return 2;
+      }
+      sim_usb_ump = true;
+      argv[arg] = NULL;
+      continue;
+    }
+    if (strcmp(argv[arg], "-p") == 0) {
+      if (!CFG_MIDI_PROFILE) {
+        printf("-p needs a tusb_config.h with CFG_MIDI_PROFILE set\n");
+        return 2;
+      }
+      show_profile = true;
+      argv[arg] = NULL;
+      continue;
+    }
+    if (strcmp(argv[arg], "-r") == 0 || strcmp(argv[arg], "-w") == 0) {
+      if (arg + 1 == argc) {
+        printf("%s needs a file or directory\n", argv[arg]);
+        return 2;
+      }
+      if (argv[arg][1] == 'r')
+        replay_path = argv[arg + 1];
+      else
+        trace_dir = argv[arg + 1];
+      argv[arg++] = NULL;
+      argv[arg] = NULL;
+      continue;
+    }
+    nnames++;
+    size_t idx;
+    for (idx = 0; idx < TU_ARRAY_SIZE(scenarios) && strcmp(argv[arg], scenarios[idx].name) != 0; idx++) {
+    }
+    if (idx == TU_ARRAY_SIZE(scenarios)) {
+      printf("Unknown scenario %s. The scenarios are:\n", argv[arg]);
+      for (idx = 0; idx < TU_ARRAY_SIZE(scenarios); idx++) {
+        printf("  %-14s %s\n", scenarios[idx].name, scenarios[idx].description);
+      }
+      return 2;
+    }
+  }
+  uint32_t nfailed = 0;
+  if (replay_path != NULL) {
+    replay_scenario.duration_us = load_replay(replay_path);
+    if (replay_scenario.duration_us == 0)
+      return 2;
+    if (!run(&replay_scenario)) {
+      printf("%s FAILED\n\n", replay_scenario.name);
+      nfailed++;
+    }
+  }
+  for (size_t idx = 0; idx < TU_ARRAY_SIZE(scenarios); idx++) {
+    // With -r, only the scenarios named
+    bool selected = nnames == 0 && replay_path == NULL;
+    for (int arg = 1; arg < argc; arg++) {
+      selected |= argv[arg] != NULL && strcmp(argv[arg], scenarios[idx].name) == 0;
+    }
+    if (selected && !run(&scenarios[idx])) {
+      printf("%s FAILED\n\n", scenarios[idx].name);
+      nfailed++;
+    }
+  }
+  return nfailed ? 1 : 0;
+}
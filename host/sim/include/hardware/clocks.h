@@ -0,0 +1,61 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of the pico-sdk's hardware/clocks.h for the firmware simulation
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KHZ 1000
+#define MHZ 1000000
+
+enum clock_index {
+  clk_ref = 4,
+  clk_sys = 5,
+  clk_peri = 6,
+  CLK_COUNT = 10,
+};
+
+#define CLOCKS_CLK_PERI_CTRL_AUXSRC_LSB 5
+#define CLOCKS_CLK_PERI_CTRL_AUXSRC_BITS 0x000000e0
+#define CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS 0x0
+#define CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB 0x2
+
+typedef struct {
+  uint32_t ctrl;
+  uint32_t div;
+  uint32_t selected;
+} clock_hw_t;
+
+typedef struct {
+  clock_hw_t clk[CLK_COUNT];
+} clocks_hw_t;
+
+// Only the auxiliary source of clk_peri means anything
+extern clocks_hw_t* const clocks_hw;
+
+uint32_t clock_get_hz(enum clock_index clk_index);
+// Only clk_peri can be configured
+bool clock_configure(enum clock_index clk_index, uint32_t src, uint32_t auxsrc, uint32_t src_freq, uint32_t freq);
@@ -0,0 +1,69 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of the pico-sdk's hardware/pio.h for the firmware simulation: just
+// the calls midi_multi_tx.c and midi_ports.c make. sim_midi.c runs each
+// claimed state machine as a serial transmitter for every pin it drives,
+// and counts the state machines pio_midi_uart_lib.h takes too. It stops if
+// a state machine's clock divider does not give 31250 baud at clk_sys.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+#define NUM_PIOS 2
+#define NUM_PIO_STATE_MACHINES 4
+
+#define PIO_SM0_CLKDIV_INT_LSB  16
+#define PIO_SM0_CLKDIV_FRAC_LSB 8
+
+typedef struct {
+  uint32_t clkdiv;
+} pio_sm_hw_t;
+
+typedef struct {
+  pio_sm_hw_t sm[NUM_PIO_STATE_MACHINES];
+} pio_hw_t;
+
+typedef pio_hw_t* PIO;
+extern PIO pio0, pio1;
+
+typedef struct {
+  const uint16_t* instructions;
+  uint8_t length;
+  int8_t origin;
+} pio_program_t;
+
+bool pio_can_add_program(PIO pio, const pio_program_t* program);
+uint pio_add_program(PIO pio, const pio_program_t* program);
+int pio_claim_unused_sm(PIO pio, bool required);
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm);
+void pio_sm_put(PIO pio, uint sm, uint32_t data);
+bool pio_sm_is_claimed(PIO pio, uint sm);
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac);
+
+// Simulation only: make state machine sm drive pin_count pins from pin_base
+// with the pins in pin_mask
+void sim_pio_sm_init_out_pins(PIO pio, uint sm, uint pin_base, uint pin_count, uint32_t pin_mask);
@@ -0,0 +1,46 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Stands in for the header pioasm generates from midi_multi_tx.pio. The
+// program sends 16 pins' worth of bits every 8 cycles at 8 * 31250 Hz, so
+// the simulation only needs to know which pins it drives.
+#pragma once
+#include "hardware/pio.h"
+
+static const uint16_t midi_multi_tx_program_instructions[] = {
+  0x6710, // out pins, 16 [7]
+};
+
+static const pio_program_t midi_multi_tx_program = {
+  .instructions = midi_multi_tx_program_instructions,
+  .length = 1,
+  .origin = -1,
+};
+
+static inline void midi_multi_tx_program_init(PIO pio, uint sm, uint offset, uint pin_base, uint pin_count, uint32_t pin_mask)
+{
+  (void)offset;
+  sim_pio_sm_init_out_pins(pio, sm, pin_base, pin_count, pin_mask);
+}
@@ -0,0 +1,45 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of pio_midi_uart_lib for the firmware simulation. sim_midi.c models
+// each UART's ring buffers and its serial lines at 31250 baud. As in the
+// library, bytes written to a transmit buffer go out once
+// pio_midi_*_drain_tx_buffer() starts the transmitter, which then keeps
+// sending until the buffer is empty.
+#pragma once
+#include <stdint.h>
+#include "pico/stdlib.h"
+
+// The sizes of the library's ring buffers
+#define PIO_MIDI_UART_TX_BUFSIZE 128
+#define PIO_MIDI_UART_RX_BUFSIZE 128
+
+void* pio_midi_uart_create(uint txgpio, uint rxgpio);
+void* pio_midi_out_create(uint txgpio);
+uint8_t pio_midi_uart_poll_rx_buffer(void* instance, uint8_t* buffer, uint8_t buflen);
+uint8_t pio_midi_uart_write_tx_buffer(void* instance, uint8_t* buffer, uint8_t buflen);
+uint8_t pio_midi_out_write_tx_buffer(void* instance, uint8_t* buffer, uint8_t buflen);
+void pio_midi_uart_drain_tx_buffer(void* instance);
+void pio_midi_out_drain_tx_buffer(void* instance);
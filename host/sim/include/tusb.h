@@ -0,0 +1,273 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of tinyusb's tusb.h for the firmware simulation. It adds the device
+// stack API and descriptor macros that main.c, usb_descriptors.c,
+// midi_telemetry.c and midi_ump_driver.c use to the benchmark stand-in in
+// host/include, which is next on the include path. sim_usb.c implements the functions. The
+// definitions match tinyusb's.
+#pragma once
+#include_next "tusb.h"
+
+#define TU_BIT(n)              (1UL << (n))
+#define U16_TO_U8S_LE(_u16)    ((uint8_t)((_u16) & 0xff)), ((uint8_t)(((_u16) >> 8) & 0xff))
+#define TU_VERIFY(_cond)       do { if (!(_cond)) return false; } while (0)
+
+static inline uint8_t tu_u16_high(uint16_t ui16) { return (uint8_t)(ui16 >> 8); }
+static inline uint8_t tu_u16_low(uint16_t ui16) { return (uint8_t)(ui16 & 0x00ff); }
+static inline uint16_t tu_min16(uint16_t x, uint16_t y) { return (x < y) ? x : y; }
+
+typedef enum
+{
+  TUSB_DESC_DEVICE        = 0x01,
+  TUSB_DESC_CONFIGURATION = 0x02,
+  TUSB_DESC_STRING        = 0x03,
+  TUSB_DESC_INTERFACE     = 0x04,
+  TUSB_DESC_ENDPOINT      = 0x05,
+  TUSB_DESC_INTERFACE_ASSOCIATION = 0x0B,
+  TUSB_DESC_CS_INTERFACE  = 0x24,
+  TUSB_DESC_CS_ENDPOINT   = 0x25,
+} tusb_desc_type_t;
+
+enum
+{
+  TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP = TU_BIT(5),
+  TUSB_DESC_CONFIG_ATT_SELF_POWERED  = TU_BIT(6),
+};
+
+enum
+{
+  TUSB_CLASS_AUDIO           = 1,
+  TUSB_CLASS_MISC            = 0xEF,
+  TUSB_CLASS_VENDOR_SPECIFIC = 0xFF,
+};
+
+enum
+{
+  MISC_SUBCLASS_COMMON = 2,
+  MISC_PROTOCOL_IAD    = 1,
+};
+
+enum { TUSB_XFER_BULK = 2 };
+
+typedef enum
+{
+  TUSB_DIR_OUT = 0,
+  TUSB_DIR_IN  = 1,
+} tusb_dir_t;
+
+enum
+{
+  TUSB_REQ_GET_DESCRIPTOR = 6,
+  TUSB_REQ_GET_INTERFACE  = 10,
+  TUSB_REQ_SET_INTERFACE  = 11,
+};
+
+enum
+{
+  TUSB_REQ_TYPE_STANDARD = 0,
+  TUSB_REQ_TYPE_CLASS,
+  TUSB_REQ_TYPE_VENDOR,
+};
+
+enum
+{
+  TUSB_REQ_RCPT_DEVICE = 0,
+  TUSB_REQ_RCPT_INTERFACE,
+  TUSB_REQ_RCPT_ENDPOINT,
+};
+
+enum
+{
+  AUDIO_FUNCTION_SUBCLASS_UNDEFINED = 0x00,
+  AUDIO_SUBCLASS_CONTROL        = 0x01,
+  AUDIO_SUBCLASS_MIDI_STREAMING = 0x03,
+  AUDIO_FUNC_PROTOCOL_CODE_UNDEF = 0x00,
+  AUDIO_CS_AC_INTERFACE_HEADER  = 0x01,
+};
+
+enum
+{
+  MIDI_CS_INTERFACE_HEADER   = 0x01,
+  MIDI_CS_INTERFACE_IN_JACK  = 0x02,
+  MIDI_CS_INTERFACE_OUT_JACK = 0x03,
+  MIDI_CS_ENDPOINT_GENERAL   = 0x01,
+};
+
+enum
+{
+  MIDI_JACK_EMBEDDED = 0x01,
+  MIDI_JACK_EXTERNAL = 0x02,
+};
+
+typedef struct __attribute__ ((packed))
+{
+  uint8_t  bLength;
+  uint8_t  bDescriptorType;
+  uint16_t bcdUSB;
+  uint8_t  bDeviceClass;
+  uint8_t  bDeviceSubClass;
+  uint8_t  bDeviceProtocol;
+  uint8_t  bMaxPacketSize0;
+  uint16_t idVendor;
+  uint16_t idProduct;
+  uint16_t bcdDevice;
+  uint8_t  iManufacturer;
+  uint8_t  iProduct;
+  uint8_t  iSerialNumber;
+  uint8_t  bNumConfigurations;
+} tusb_desc_device_t;
+
+typedef struct __attribute__ ((packed))
+{
+  uint8_t  bLength;
+  uint8_t  bDescriptorType;
+  uint8_t  bInterfaceNumber;
+  uint8_t  bAlternateSetting;
+  uint8_t  bNumEndpoints;
+  uint8_t  bInterfaceClass;
+  uint8_t  bInterfaceSubClass;
+  uint8_t  bInterfaceProtocol;
+  uint8_t  iInterface;
+} tusb_desc_interface_t;
+
+typedef struct __attribute__ ((packed))
+{
+  uint8_t  bLength;
+  uint8_t  bDescriptorType;
+  uint8_t  bEndpointAddress;
+  uint8_t  bmAttributes;
+  uint16_t wMaxPacketSize;
+  uint8_t  bInterval;
+} tusb_desc_endpoint_t;
+
+static inline uint8_t const* tu_desc_next(void const* desc)
+{
+  uint8_t const* desc8 = (uint8_t const*)desc;
+  return desc8 + desc8[0];
+}
+
+static inline uint8_t tu_desc_type(void const* desc)
+{
+  return ((uint8_t const*)desc)[1];
+}
+
+static inline uint8_t tu_desc_len(void const* desc)
+{
+  return ((uint8_t const*)desc)[0];
+}
+
+static inline tusb_dir_t tu_edpt_dir(uint8_t addr)
+{
+  return (addr & 0x80) ? TUSB_DIR_IN : TUSB_DIR_OUT;
+}
+
+typedef struct __attribute__ ((packed))
+{
+  union {
+    struct __attribute__ ((packed)) {
+      uint8_t recipient :  5;
+      uint8_t type      :  2;
+      uint8_t direction :  1;
+    } bmRequestType_bit;
+
+    uint8_t bmRequestType;
+  };
+
+  uint8_t  bRequest;
+  uint16_t wValue;
+  uint16_t wIndex;
+  uint16_t wLength;
+} tusb_control_request_t;
+
+enum
+{
+  CONTROL_STAGE_IDLE,
+  CONTROL_STAGE_SETUP,
+  CONTROL_STAGE_DATA,
+  CONTROL_STAGE_ACK
+};
+
+#define TUD_CONFIG_DESC_LEN   (9)
+#define TUD_CONFIG_DESCRIPTOR(config_num, _itfcount, _stridx, _total_len, _attribute, _power_ma) \
+  9, TUSB_DESC_CONFIGURATION, U16_TO_U8S_LE(_total_len), _itfcount, config_num, _stridx, TU_BIT(7) | _attribute, (_power_ma)/2
+
+#define TUD_VENDOR_DESC_LEN  (9+7+7)
+#define TUD_VENDOR_DESCRIPTOR(_itfnum, _stridx, _epout, _epin, _epsize) \
+  9, TUSB_DESC_INTERFACE, _itfnum, 0, 2, TUSB_CLASS_VENDOR_SPECIFIC, 0x00, 0x00, _stridx,\
+  7, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  7, TUSB_DESC_ENDPOINT, _epin, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0
+
+#define TUD_MIDI_DESC_HEAD_LEN (9 + 9 + 9 + 7)
+#define TUD_MIDI_DESC_EP_LEN(_numcables) (9 + 4 + (_numcables))
+#define TUD_MIDI_DESC_EP(_epout, _epsize, _numcables) \
+  9, TUSB_DESC_ENDPOINT, _epout, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0, 0, 0, \
+  4 + (_numcables), TUSB_DESC_CS_ENDPOINT, MIDI_CS_ENDPOINT_GENERAL, _numcables
+
+// Device stack
+bool tud_init(uint8_t rhport);
+void tud_task(void);
+bool tud_task_event_ready(void);
+bool tud_mounted(void);
+bool tud_remote_wakeup(void);
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const* request, void* buffer, uint16_t len);
+bool tud_control_status(uint8_t rhport, tusb_control_request_t const* request);
+
+// MIDI class driver
+bool tud_midi_n_mounted(uint8_t itf);
+uint32_t tud_midi_n_available(uint8_t itf, uint8_t cable_num);
+uint32_t tud_midi_n_stream_write(uint8_t itf, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize);
+bool tud_midi_n_packet_write(uint8_t itf, uint8_t const packet[4]);
+
+static inline bool tud_midi_mounted(void)
+{
+  return tud_midi_n_mounted(0);
+}
+
+static inline uint32_t tud_midi_available(void)
+{
+  return tud_midi_n_available(0, 0);
+}
+
+static inline uint32_t tud_midi_stream_write(uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize)
+{
+  return tud_midi_n_stream_write(0, cable_num, buffer, bufsize);
+}
+
+static inline bool tud_midi_packet_write(uint8_t const packet[4])
+{
+  return tud_midi_n_packet_write(0, packet);
+}
+
+// Callbacks the application provides
+void tud_mount_cb(void);
+void tud_umount_cb(void);
+void tud_suspend_cb(bool remote_wakeup_en);
+void tud_resume_cb(void);
+void tud_midi_rx_cb(uint8_t itf);
+uint8_t const* tud_descriptor_device_cb(void);
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index);
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid);
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request);
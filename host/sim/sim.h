@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// How the parts of the firmware simulation talk to each other. The firmware
+// runs unchanged on one thread. Each pass of its main loop calls
+// tud_task_event_ready(), which calls sim_step() to advance simulated time
+// by SIM_STEP_US and run the mocks: the Pico's repeating timer (sim_pico.c),
+// the serial lines of the MIDI ports (sim_midi.c) and the USB host and bus
+// (sim_usb.c). firmware_sim.c runs the scenarios, which play the USB host
+// and the MIDI devices on the other ends of the cables.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "pico/stdlib.h"
+
+#define SIM_STEP_US  5      // simulated time per pass of the firmware's main loop
+#define SIM_BIT_US   32     // one bit at 31250 baud
+#define SIM_BYTE_US  320    // one byte with its start and stop bits
+#define SIM_FRAME_US 1000   // one full speed USB frame
+
+// The simulated time in microseconds
+extern uint64_t sim_now_us;
+
+// firmware_sim.c: advance simulated time one step
+void sim_step(void);
+
+// sim_pico.c: run the repeating timer and alarm callbacks that are due
+void sim_pico_step(void);
+
+typedef struct {
+  uint32_t sleeps;            // __wfi() calls, one per main loop pass with nothing to do
+  uint32_t clock_changes;     // times clk_sys changed
+  uint32_t min_sys_clock_hz;  // the slowest clk_sys after a change, or 0
+} sim_pico_stats_t;
+
+extern sim_pico_stats_t sim_pico_stats;
+
+// sim_midi.c: move the serial lines on to sim_now_us
+void sim_midi_step(void);
+// Start sending byte to MIDI IN pin gpio after the bytes already on the way.
+// Return false if too many bytes are on the way.
+bool sim_midi_in_write(uint gpio, uint8_t byte);
+// Bytes the MIDI IN port on pin gpio lost because its receive buffer was full
+uint32_t sim_midi_in_overruns(uint gpio);
+// The number of bytes on their way to MIDI IN pin gpio
+uint32_t sim_midi_in_pending(uint gpio);
+// firmware_sim.c: the stop bit of byte ended on MIDI OUT pin gpio
+void sim_midi_out_sent(uint gpio, uint8_t byte);
+// firmware_sim.c: byte arrived at MIDI IN pin gpio and the port received it
+void sim_midi_in_received(uint gpio, uint8_t byte);
+
+// sim_usb.c: move the USB host and bus on to sim_now_us
+void sim_usb_step(void);
+// Set before the firmware starts for the USB host to select the UMP
+// alternate setting once the device is mounted. Then the packets below are
+// UMP words.
+extern bool sim_usb_ump;
+// The USB host queues a USB MIDI event packet for the Bulk OUT endpoint.
+// Return false if the host's queue is full.
+bool sim_usb_host_write(const uint8_t packet[4]);
+// The number of packets the USB host has not sent yet
+uint32_t sim_usb_host_backlog(void);
+// firmware_sim.c: the USB host received a packet from the Bulk IN endpoint
+void sim_usb_host_received(const uint8_t packet[4]);
+// The host suspends the bus: it stops sending frames, and the device sees
+// the suspend 3 ms later. If the host enabled remote wakeup, it resumes the
+// bus 20 ms after the device asks with tud_remote_wakeup().
+void sim_usb_suspend(void);
+// The host resumes the bus now if it is suspended
+void sim_usb_resume(void);
+
+typedef struct {
+  uint32_t out_transfers;       // Bulk OUT transfers the device took
+  uint32_t out_naks;            // frames with packets to send that the device NAKed
+  uint32_t in_transfers;        // Bulk IN transfers the host received
+  uint32_t in_packets;          // USB MIDI event packets in them
+  uint32_t in_fifo_high_water;  // the most bytes in the device's transmit FIFO at once
+  uint32_t suspends;            // times the device saw the bus suspended
+  uint32_t remote_wakeups;      // times the device woke the host
+  uint64_t suspended_us;        // how long the device saw the bus suspended
+} sim_usb_stats_t;
+
+extern sim_usb_stats_t sim_usb_stats;
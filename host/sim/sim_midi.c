@@ -0,0 +1,398 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of pio_midi_uart_lib and of the PIO state machine that
+// midi_multi_tx.c drives, with serial lines that send one byte every
+// SIM_BYTE_US. The mock hands out the RP2040's 8 state machines the way
+// the library and midi_multi_tx.c claim them, so a configuration that runs
+// out of them fails here too. Each claimed state machine starts with the
+// clock divider for 31250 baud, and whenever it sends or receives a byte its
+// divider must still give 31250 baud at the current clk_sys.
+#include <string.h>
+#include "pio_midi_uart_lib.h"
+#include "hardware/pio.h"
+#include "hardware/clocks.h"
+#include "sim.h"
+
+#define MAX_UARTS   (NUM_PIOS * NUM_PIO_STATE_MACHINES)
+#define NUM_GPIOS   30
+#define WIRE_SIZE   4096  // must be a power of 2
+#define FIFO_WORDS  8     // a state machine's joined TX FIFO
+#define CYCLES_PER_BIT 8  // state machine cycles per bit time
+
+static pio_hw_t pios[NUM_PIOS];
+static uint8_t claimed[NUM_PIOS];  // a bit for each state machine in use
+PIO pio0 = &pios[0];
+PIO pio1 = &pios[1];
+
+// A pio_midi_uart_lib instance: a MIDI OUT port, and a MIDI IN port if rx_gpio >= 0
+typedef struct {
+  uint tx_gpio;
+  int rx_gpio;
+  uint8_t pio;          // the PIO of the transmit and receive state machines
+  uint8_t tx_sm, rx_sm;
+  uint8_t tx_buf[PIO_MIDI_UART_TX_BUFSIZE];
+  uint32_t tx_head, tx_tail;
+  bool tx_running;      // the transmitter sends until tx_buf is empty
+  bool tx_sending;      // tx_byte is on the line
+  uint8_t tx_byte;
+  uint64_t tx_done_us;  // when tx_byte's stop bit ends
+  uint8_t rx_buf[PIO_MIDI_UART_RX_BUFSIZE];
+  uint32_t rx_head, rx_tail;
+} sim_uart_t;
+
+static sim_uart_t uarts[MAX_UARTS];
+static uint8_t nuarts;
+
+// The bytes on their way to a MIDI IN pin from the device plugged into it
+typedef struct {
+  uint8_t bytes[WIRE_SIZE];
+  uint32_t head, tail;
+  bool busy;            // the byte at tail is on the line
+  uint64_t done_us;     // when it has arrived
+  uint32_t overruns;    // bytes lost because the receive buffer was full
+} sim_wire_t;
+
+static sim_wire_t wires[NUM_GPIOS];
+
+// A state machine running midi_multi_tx.pio. Each bit time it drives the
+// pins from the next 16 bits it pulled from its FIFO. A UART receiver on
+// each of its pins turns the bit times back into bytes.
+typedef struct {
+  bool out_pins;        // set up by sim_pio_sm_init_out_pins()
+  uint pin_base;
+  uint32_t pin_mask;    // bit n is pin pin_base + n
+  uint32_t fifo[FIFO_WORDS];
+  uint32_t fifo_head, fifo_tail;
+  uint32_t osr;         // the word being shifted out
+  uint8_t osr_bit_times;
+  bool running;         // pins hold a bit time that ends at bit_end_us
+  uint16_t pins;
+  uint64_t bit_end_us;
+  uint8_t rx_state[16]; // 0 idle, 1-8 data bits, 9 stop bit
+  uint8_t rx_data[16];
+} sim_sm_t;
+
+static sim_sm_t sms[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+
+// Claim a state machine in PIO pio and set its divider for 31250 baud. Return it or -1.
+static int claim_sm(int pio)
+{
+  for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+    if (!(claimed[pio] & (1u << sm))) {
+      claimed[pio] |= 1u << sm;
+      uint32_t div = (clock_get_hz(clk_sys) * 256ull + 31250 * CYCLES_PER_BIT / 2) / (31250 * CYCLES_PER_BIT);
+      pios[pio].sm[sm].clkdiv = div << PIO_SM0_CLKDIV_FRAC_LSB;
+      return sm;
+    }
+  }
+  return -1;
+}
+
+// Stop unless state machine sm of PIO pio runs at 31250 baud, within the 1% MIDI allows
+static void check_baud(int pio, uint sm)
+{
+  uint64_t div = pios[pio].sm[sm].clkdiv >> PIO_SM0_CLKDIV_FRAC_LSB;
+  uint64_t baud = div ? (uint64_t)clock_get_hz(clk_sys) * 256 / (div * CYCLES_PER_BIT) : 0;
+  if (baud * 100 < 31250 * 99 || baud * 100 > 31250 * 101)
+    panic("PIO%d state machine %u runs at %llu baud", pio, sm, (unsigned long long)baud);
+}
+
+// Claim nsms state machines in the same PIO for uart. Return false if no PIO has that many left.
+static bool claim_sms(sim_uart_t* uart, uint8_t nsms)
+{
+  for (int idx = 0; idx < NUM_PIOS; idx++) {
+    uint8_t nfree = (uint8_t)(NUM_PIO_STATE_MACHINES - __builtin_popcount(claimed[idx]));
+    if (nfree >= nsms) {
+      uart->pio = (uint8_t)idx;
+      uart->tx_sm = uart->rx_sm = (uint8_t)claim_sm(idx);
+      if (nsms > 1)
+        uart->rx_sm = (uint8_t)claim_sm(idx);
+      return true;
+    }
+  }
+  return false;
+}
+
+static void* create_uart(uint txgpio, int rxgpio, uint8_t nsms)
+{
+  if (nuarts == MAX_UARTS || txgpio >= NUM_GPIOS || rxgpio >= NUM_GPIOS)
+    return NULL;
+  sim_uart_t* uart = &uarts[nuarts];
+  memset(uart, 0, sizeof(*uart));
+  if (!claim_sms(uart, nsms))
+    return NULL;
+  nuarts++;
+  uart->tx_gpio = txgpio;
+  uart->rx_gpio = rxgpio;
+  return uart;
+}
+
+void* pio_midi_uart_create(uint txgpio, uint rxgpio)
+{
+  return create_uart(txgpio, (int)rxgpio, 2);
+}
+
+void* pio_midi_out_create(uint txgpio)
+{
+  return create_uart(txgpio, -1, 1);
+}
+
+uint8_t pio_midi_uart_poll_rx_buffer(void* instance, uint8_t* buffer, uint8_t buflen)
+{
+  sim_uart_t* uart = instance;
+  uint8_t nread = 0;
+  while (nread < buflen && uart->rx_tail != uart->rx_head) {
+    buffer[nread++] = uart->rx_buf[uart->rx_tail++ % PIO_MIDI_UART_RX_BUFSIZE];
+  }
+  return nread;
+}
+
+uint8_t pio_midi_uart_write_tx_buffer(void* instance, uint8_t* buffer, uint8_t buflen)
+{
+  sim_uart_t* uart = instance;
+  uint8_t nwritten = 0;
+  while (nwritten < buflen && uart->tx_head - uart->tx_tail < PIO_MIDI_UART_TX_BUFSIZE) {
+    uart->tx_buf[uart->tx_head++ % PIO_MIDI_UART_TX_BUFSIZE] = buffer[nwritten++];
+  }
+  return nwritten;
+}
+
+uint8_t pio_midi_out_write_tx_buffer(void* instance, uint8_t* buffer, uint8_t buflen)
+{
+  return pio_midi_uart_write_tx_buffer(instance, buffer, buflen);
+}
+
+void pio_midi_uart_drain_tx_buffer(void* instance)
+{
+  sim_uart_t* uart = instance;
+  if (uart->tx_head != uart->tx_tail)
+    uart->tx_running = true;
+}
+
+void pio_midi_out_drain_tx_buffer(void* instance)
+{
+  pio_midi_uart_drain_tx_buffer(instance);
+}
+
+bool pio_can_add_program(PIO pio, const pio_program_t* program)
+{
+  (void)pio;
+  (void)program;
+  return true;
+}
+
+uint pio_add_program(PIO pio, const pio_program_t* program)
+{
+  (void)pio;
+  (void)program;
+  return 0;
+}
+
+int pio_claim_unused_sm(PIO pio, bool required)
+{
+  int sm = claim_sm((int)(pio - pios));
+  if (sm < 0 && required)
+    panic("No free state machines in PIO%d", (int)(pio - pios));
+  return sm;
+}
+
+void sim_pio_sm_init_out_pins(PIO pio, uint sm, uint pin_base, uint pin_count, uint32_t pin_mask)
+{
+  sim_sm_t* state = &sms[pio - pios][sm];
+  memset(state, 0, sizeof(*state));
+  state->out_pins = true;
+  state->pin_base = pin_base;
+  state->pin_mask = (pin_mask >> pin_base) & ((1u << pin_count) - 1);
+}
+
+uint pio_sm_get_tx_fifo_level(PIO pio, uint sm)
+{
+  sim_sm_t* state = &sms[pio - pios][sm];
+  return state->fifo_head - state->fifo_tail;
+}
+
+bool pio_sm_is_claimed(PIO pio, uint sm)
+{
+  return claimed[pio - pios] & (1u << sm);
+}
+
+void pio_sm_set_clkdiv_int_frac(PIO pio, uint sm, uint16_t div_int, uint8_t div_frac)
+{
+  pio->sm[sm].clkdiv = ((uint32_t)div_int << PIO_SM0_CLKDIV_INT_LSB) | ((uint32_t)div_frac << PIO_SM0_CLKDIV_FRAC_LSB);
+}
+
+void pio_sm_put(PIO pio, uint sm, uint32_t data)
+{
+  sim_sm_t* state = &sms[pio - pios][sm];
+  // Like the hardware, drop the word if the FIFO is full
+  if (state->fifo_head - state->fifo_tail < FIFO_WORDS)
+    state->fifo[state->fifo_head++ % FIFO_WORDS] = data;
+}
+
+bool sim_midi_in_write(uint gpio, uint8_t byte)
+{
+  if (gpio >= NUM_GPIOS || wires[gpio].head - wires[gpio].tail == WIRE_SIZE)
+    return false;
+  sim_wire_t* wire = &wires[gpio];
+  wire->bytes[wire->head++ % WIRE_SIZE] = byte;
+  return true;
+}
+
+uint32_t sim_midi_in_overruns(uint gpio)
+{
+  return gpio < NUM_GPIOS ? wires[gpio].overruns : 0;
+}
+
+uint32_t sim_midi_in_pending(uint gpio)
+{
+  return gpio < NUM_GPIOS ? wires[gpio].head - wires[gpio].tail : 0;
+}
+
+static sim_uart_t* uart_for_rx(uint gpio)
+{
+  for (uint8_t idx = 0; idx < nuarts; idx++) {
+    if (uarts[idx].rx_gpio == (int)gpio)
+      return &uarts[idx];
+  }
+  return NULL;
+}
+
+static void uart_tx_step(sim_uart_t* uart)
+{
+  uint64_t start_us = sim_now_us;
+  while (1) {
+    if (uart->tx_sending) {
+      if (uart->tx_done_us > sim_now_us)
+        break;
+      uart->tx_sending = false;
+      start_us = uart->tx_done_us;
+      sim_midi_out_sent(uart->tx_gpio, uart->tx_byte);
+    }
+    if (!uart->tx_running || uart->tx_head == uart->tx_tail) {
+      uart->tx_running = false;
+      break;
+    }
+    check_baud(uart->pio, uart->tx_sm);
+    uart->tx_byte = uart->tx_buf[uart->tx_tail++ % PIO_MIDI_UART_TX_BUFSIZE];
+    uart->tx_sending = true;
+    uart->tx_done_us = start_us + SIM_BYTE_US;
+  }
+}
+
+static void wire_step(uint gpio)
+{
+  sim_wire_t* wire = &wires[gpio];
+  uint64_t start_us = sim_now_us;
+  while (wire->head != wire->tail) {
+    if (!wire->busy) {
+      wire->busy = true;
+      wire->done_us = start_us + SIM_BYTE_US;
+    }
+    if (wire->done_us > sim_now_us)
+      break;
+    uint8_t byte = wire->bytes[wire->tail++ % WIRE_SIZE];
+    wire->busy = false;
+    start_us = wire->done_us;
+    sim_uart_t* uart = uart_for_rx(gpio);
+    if (uart != NULL)
+      check_baud(uart->pio, uart->rx_sm);
+    if (uart != NULL && uart->rx_head - uart->rx_tail < PIO_MIDI_UART_RX_BUFSIZE) {
+      uart->rx_buf[uart->rx_head++ % PIO_MIDI_UART_RX_BUFSIZE] = byte;
+      sim_midi_in_received(gpio, byte);
+    }
+    else {
+      wire->overruns++;
+    }
+  }
+}
+
+// Receive the bit time that just ended on every pin of sm
+static void sm_receive_bit_time(sim_sm_t* sm)
+{
+  for (uint pin = 0; pin < 16; pin++) {
+    if (!(sm->pin_mask & (1u << pin)))
+      continue;
+    uint8_t bit = (sm->pins >> pin) & 1;
+    uint8_t* state = &sm->rx_state[pin];
+    if (*state == 0) {
+      if (!bit) {
+        *state = 1; // start bit
+        sm->rx_data[pin] = 0;
+      }
+    }
+    else if (*state <= 8) {
+      sm->rx_data[pin] |= (uint8_t)(bit << (*state - 1));
+      (*state)++;
+    }
+    else {
+      *state = 0;
+      if (!bit)
+        panic("Framing error on MIDI OUT pin %u", sm->pin_base + pin);
+      sim_midi_out_sent(sm->pin_base + pin, sm->rx_data[pin]);
+    }
+  }
+}
+
+static void sm_step(int pio, uint sm_index)
+{
+  sim_sm_t* sm = &sms[pio][sm_index];
+  uint64_t start_us = sim_now_us;
+  while (!sm->running || sm->bit_end_us <= sim_now_us) {
+    if (sm->running) {
+      sm_receive_bit_time(sm);
+      sm->running = false;
+      start_us = sm->bit_end_us;
+    }
+    if (sm->osr_bit_times == 0) {
+      if (sm->fifo_head == sm->fifo_tail)
+        break; // stall; the pins keep the last bit time
+      check_baud(pio, sm_index);
+      sm->osr = sm->fifo[sm->fifo_tail++ % FIFO_WORDS];
+      sm->osr_bit_times = 2;
+    }
+    sm->pins = (uint16_t)sm->osr;
+    sm->osr >>= 16;
+    sm->osr_bit_times--;
+    sm->running = true;
+    sm->bit_end_us = start_us + SIM_BIT_US;
+  }
+}
+
+void sim_midi_step(void)
+{
+  for (uint8_t idx = 0; idx < nuarts; idx++) {
+    uart_tx_step(&uarts[idx]);
+  }
+  for (int pio = 0; pio < NUM_PIOS; pio++) {
+    for (int sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+      if (sms[pio][sm].out_pins)
+        sm_step(pio, (uint)sm);
+    }
+  }
+  for (uint gpio = 0; gpio < NUM_GPIOS; gpio++) {
+    wire_step(gpio);
+  }
+}
@@ -0,0 +1,253 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of the parts of the pico-sdk and the board support package that the
+// firmware uses outside of the MIDI ports: the timer and alarms, the LED, panic(),
+// the flash, the clocks and the SysTick timer, and sleeping.
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+#include "bsp/board.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "hardware/clocks.h"
+#include "hardware/structs/systick.h"
+#include "sim.h"
+
+#define MAX_TIMERS 4
+#define MAX_ALARMS 4
+
+uint64_t sim_now_us;
+sim_pico_stats_t sim_pico_stats;
+uint8_t sim_flash_last_sector[FLASH_SECTOR_SIZE];
+
+static repeating_timer_t* timers[MAX_TIMERS];
+static uint8_t ntimers;
+
+typedef struct {
+  alarm_id_t id;
+  uint64_t time_us;
+  alarm_callback_t callback;
+  void* user_data;
+} sim_alarm_t;
+
+static sim_alarm_t alarms[MAX_ALARMS];
+static uint8_t nalarms;
+static alarm_id_t last_alarm_id;
+
+static uint32_t sys_clock_hz = 125000000;
+// clk_peri runs from clk_sys after board_init()
+static uint32_t peri_clock_hz = 125000000;
+static clocks_hw_t clocks;
+clocks_hw_t* const clocks_hw = &clocks;
+
+uint32_t time_us_32(void)
+{
+  return (uint32_t)sim_now_us;
+}
+
+uint64_t time_us_64(void)
+{
+  return sim_now_us;
+}
+
+bool add_repeating_timer_us(int64_t delay_us, repeating_timer_callback_t callback, void* user_data, repeating_timer_t* out)
+{
+  if (ntimers == MAX_TIMERS || delay_us == 0)
+    return false;
+  // A negative delay counts from the start of each callback rather than its
+  // end; callbacks take no simulated time, so both are the same here.
+  out->delay_us = delay_us < 0 ? -delay_us : delay_us;
+  out->next_us = sim_now_us + (uint64_t)out->delay_us;
+  out->callback = callback;
+  out->user_data = user_data;
+  timers[ntimers++] = out;
+  return true;
+}
+
+alarm_id_t add_alarm_at(absolute_time_t time, alarm_callback_t callback, void* user_data, bool fire_if_past)
+{
+  if (time <= sim_now_us) {
+    if (fire_if_past)
+      callback(0, user_data);
+    return 0;
+  }
+  if (nalarms == MAX_ALARMS)
+    return -1;
+  // Alarm IDs are positive
+  last_alarm_id = last_alarm_id == INT32_MAX ? 1 : last_alarm_id + 1;
+  alarms[nalarms++] = (sim_alarm_t){last_alarm_id, time, callback, user_data};
+  return last_alarm_id;
+}
+
+bool cancel_alarm(alarm_id_t alarm_id)
+{
+  for (int idx = 0; idx < nalarms; idx++) {
+    if (alarms[idx].id == alarm_id) {
+      alarms[idx] = alarms[--nalarms];
+      return true;
+    }
+  }
+  return false;
+}
+
+void sim_pico_step(void)
+{
+  for (int idx = 0; idx < nalarms; idx++) {
+    if (alarms[idx].time_us <= sim_now_us) {
+      sim_alarm_t alarm = alarms[idx];
+      alarms[idx--] = alarms[--nalarms];
+      alarm.callback(alarm.id, alarm.user_data);
+    }
+  }
+  for (int idx = 0; idx < ntimers; idx++) {
+    repeating_timer_t* timer = timers[idx];
+    while (timer->next_us <= sim_now_us) {
+      timer->next_us += (uint64_t)timer->delay_us;
+      if (!timer->callback(timer)) {
+        timers[idx--] = timers[--ntimers];
+        break;
+      }
+    }
+  }
+}
+
+uint32_t clock_get_hz(enum clock_index clk_index)
+{
+  if (clk_index == clk_sys)
+    return sys_clock_hz;
+  return clk_index == clk_peri ? peri_clock_hz : 12000000;
+}
+
+bool clock_configure(enum clock_index clk_index, uint32_t src, uint32_t auxsrc, uint32_t src_freq, uint32_t freq)
+{
+  (void)src;
+  if (clk_index != clk_peri)
+    panic("Only clk_peri can be configured");
+  // clk_peri has no divider
+  if (freq != src_freq ||
+      (auxsrc == CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLK_SYS && freq != sys_clock_hz) ||
+      (auxsrc == CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB && freq != 48 * MHZ))
+    panic("clk_peri cannot run at %u Hz from source %u", freq, auxsrc);
+  clocks_hw->clk[clk_peri].ctrl = auxsrc << CLOCKS_CLK_PERI_CTRL_AUXSRC_LSB;
+  peri_clock_hz = freq;
+  return true;
+}
+
+// Like the pico-sdk, which also moves clk_peri to 48 MHz from the USB PLL
+static void set_sys_clock(uint32_t hz)
+{
+  if (hz != sys_clock_hz)
+    sim_pico_stats.clock_changes++;
+  sys_clock_hz = hz;
+  if (sim_pico_stats.min_sys_clock_hz == 0 || hz < sim_pico_stats.min_sys_clock_hz)
+    sim_pico_stats.min_sys_clock_hz = hz;
+  clock_configure(clk_peri, 0, CLOCKS_CLK_PERI_CTRL_AUXSRC_VALUE_CLKSRC_PLL_USB, 48 * MHZ, 48 * MHZ);
+}
+
+void set_sys_clock_48mhz(void)
+{
+  set_sys_clock(48 * MHZ);
+}
+
+bool set_sys_clock_khz(uint32_t freq_khz, bool required)
+{
+  // The system PLL reaches 125 MHz and the usual overclocks
+  if (freq_khz < 48000 || freq_khz > 200000) {
+    if (required)
+      panic("clk_sys cannot run at %u kHz", freq_khz);
+    return false;
+  }
+  set_sys_clock(freq_khz * KHZ);
+  return true;
+}
+
+void __wfi(void)
+{
+  sim_pico_stats.sleeps++;
+}
+
+systick_hw_t* sim_systick(void)
+{
+  static systick_hw_t systick;
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t ns = (uint64_t)now.tv_sec * 1000000000u + (uint64_t)now.tv_nsec;
+  uint64_t cycles = ns * (clock_get_hz(clk_sys) / 1000000) / 1000;
+  systick.cvr = (uint32_t)(systick.rvr - cycles % ((uint64_t)systick.rvr + 1));
+  return &systick;
+}
+
+void panic(const char* fmt, ...)
+{
+  va_list args;
+  va_start(args, fmt);
+  fprintf(stderr, "panic at %llu us: ", (unsigned long long)sim_now_us);
+  vfprintf(stderr, fmt, args);
+  fprintf(stderr, "\n");
+  va_end(args);
+  exit(1);
+}
+
+void board_init(void)
+{
+  // Erased flash reads as 0xFF
+  memset(sim_flash_last_sector, 0xFF, sizeof(sim_flash_last_sector));
+}
+
+uint32_t board_millis(void)
+{
+  return (uint32_t)(sim_now_us / 1000);
+}
+
+void board_led_write(bool state)
+{
+  (void)state;
+}
+
+// The flash offsets the firmware uses must fall in the last sector
+static uint8_t* flash_at(uint32_t flash_offs, size_t count)
+{
+  uint32_t sector_offs = PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE;
+  if (flash_offs < sector_offs || flash_offs - sector_offs + count > FLASH_SECTOR_SIZE)
+    panic("flash access at offset 0x%lx is outside the simulated sector", (unsigned long)flash_offs);
+  return &sim_flash_last_sector[flash_offs - sector_offs];
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count)
+{
+  memset(flash_at(flash_offs, count), 0xFF, count);
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count)
+{
+  // Programming can only clear bits
+  uint8_t* flash = flash_at(flash_offs, count);
+  for (size_t idx = 0; idx < count; idx++) {
+    flash[idx] &= data[idx];
+  }
+}
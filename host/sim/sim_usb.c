@@ -0,0 +1,601 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Mock of the tinyusb device stack and MIDI class driver, and the USB host
+// on the other end of the cable. In each 1 ms full speed frame the host
+// sends at most one Bulk OUT transfer and reads at most one Bulk IN
+// transfer, of up to 64 bytes each. As in tinyusb, the device only takes an
+// OUT transfer while its receive FIFO has room for a whole one; otherwise it
+// NAKs and the host tries again next frame. tud_midi_n_stream_write()
+// packs the bytes into USB MIDI event packets the way tinyusb's does. The
+// host enables remote wakeup when the configuration descriptor offers it.
+//
+// The MIDI interface opens the way tinyusb's usbd opens it: the
+// application's class driver gets the first try, and only if it declines
+// does the MIDI class driver mocked here. With sim_usb_ump set, the host
+// then reads the Group Terminal Block descriptors and selects the UMP
+// alternate setting.
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "midi_device_multistream.h"
+#include "usb_descriptors.h"
+#include "sim.h"
+
+#define EP_SIZE             64
+#define HOST_QUEUE_PACKETS  65536  // must be a power of 2
+#define RX_FIFO_SIZE        CFG_TUD_MIDI_RX_BUFSIZE
+#define TX_FIFO_SIZE        CFG_TUD_MIDI_TX_BUFSIZE
+#define SUSPEND_IDLE_US     3000   // how long the bus is idle before the device sees a suspend
+#define RESUME_US           20000  // how long the host signals resume after a remote wakeup
+
+sim_usb_stats_t sim_usb_stats;
+bool sim_usb_ump;
+
+// The packets the host has not sent yet
+static uint8_t host_queue[HOST_QUEUE_PACKETS][4];
+static uint32_t host_head, host_tail;
+
+static uint64_t next_frame_us;
+static bool mount_pending, mounted;
+
+// Bus suspend and resume. While bus_idle the host sends no frames.
+static bool remote_wakeup_en;   // the host enabled remote wakeup
+static bool bus_idle, suspended;
+static bool suspend_pending, resume_pending;  // for tud_task()
+static uint64_t suspend_us;     // when the device sees the suspend, or 0
+static uint64_t resume_us;      // when the host resumes the bus, or 0
+static uint64_t suspended_since_us;
+
+// The class driver that opened the MIDI interface and the MIDI Streaming
+// interface number
+static const usbd_class_driver_t* midi_driver;
+static uint8_t itf_ms;
+
+// The data stage of the last control transfer, and whether it had a status stage
+static const uint8_t* control_data;
+static uint16_t control_len;
+static bool control_acked;
+
+// The device's receive FIFO and Bulk OUT endpoint
+static uint8_t rx_fifo[RX_FIFO_SIZE];
+static uint32_t rx_head, rx_tail;
+static bool out_armed;          // the endpoint takes the next transfer
+static bool out_xfer_done;      // out_xfer arrived; tud_task() has not seen it yet
+static uint8_t out_xfer[EP_SIZE];
+static uint32_t out_xfer_len;
+
+// The device's transmit FIFO and Bulk IN endpoint
+static uint8_t tx_fifo[TX_FIFO_SIZE];
+static uint32_t tx_head, tx_tail;
+static bool in_busy;            // in_xfer waits for the host
+static bool in_claimed;
+static bool in_xfer_done;       // the host read in_xfer; tud_task() has not seen it yet
+static uint8_t in_xfer[EP_SIZE];
+static uint32_t in_xfer_len;
+
+// tinyusb's tud_midi_n_stream_write() state
+static struct {
+  uint8_t buffer[4];
+  uint8_t index;
+  uint8_t total;
+} stream_write;
+
+bool sim_usb_host_write(const uint8_t packet[4])
+{
+  if (host_head - host_tail == HOST_QUEUE_PACKETS)
+    return false;
+  memcpy(host_queue[host_head++ % HOST_QUEUE_PACKETS], packet, 4);
+  return true;
+}
+
+uint32_t sim_usb_host_backlog(void)
+{
+  return host_head - host_tail;
+}
+
+// Arm the OUT endpoint if the receive FIFO has room for a whole transfer
+static void prep_out_transaction(void)
+{
+  if (mounted && !out_armed && !out_xfer_done && RX_FIFO_SIZE - (rx_head - rx_tail) >= EP_SIZE)
+    out_armed = true;
+}
+
+// Start an IN transfer of the packets in the transmit FIFO if the endpoint is free
+static void write_flush(void)
+{
+  if (in_busy || in_claimed || tx_head == tx_tail)
+    return;
+  in_xfer_len = tu_min32(tx_head - tx_tail, EP_SIZE);
+  for (uint32_t idx = 0; idx < in_xfer_len; idx++) {
+    in_xfer[idx] = tx_fifo[tx_tail++ % TX_FIFO_SIZE];
+  }
+  in_busy = true;
+}
+
+// tinyusb's MIDI class driver, for when the application's drivers decline
+// the MIDI interface
+static const usbd_class_driver_t midid_driver = {
+#if CFG_TUSB_DEBUG >= 2
+  .name = "MIDI",
+#endif
+  .init = midid_init,
+  .reset = midid_reset,
+  .open = midid_open,
+  .control_xfer_cb = midid_control_xfer_cb,
+  .xfer_cb = midid_xfer_cb,
+  .sof = NULL,
+};
+
+// Open the MIDI interface in the total bytes of configuration descriptor
+// config like tinyusb's usbd does. Stop if no driver takes all of its
+// descriptors.
+static void open_midi(const uint8_t* config, uint16_t total)
+{
+  uint16_t offset = config[0];
+  const uint8_t* iad = NULL;
+  while (offset < total && !(config[offset + 1] == TUSB_DESC_INTERFACE && config[offset + 5] == TUSB_CLASS_AUDIO)) {
+    iad = config[offset + 1] == TUSB_DESC_INTERFACE_ASSOCIATION ? &config[offset] : NULL;
+    offset += config[offset];
+  }
+  if (offset == total)
+    panic("No MIDI interface");
+  const tusb_desc_interface_t* desc_ac = (const tusb_desc_interface_t*)&config[offset];
+  itf_ms = (uint8_t)(desc_ac->bInterfaceNumber + 1);
+  uint8_t napp = 0;
+  const usbd_class_driver_t* app = usbd_app_driver_get_cb ? usbd_app_driver_get_cb(&napp) : NULL;
+  uint16_t len = 0;
+  for (uint8_t idx = 0; idx < napp && len == 0; idx++) {
+    app[idx].init();
+    len = app[idx].open(0, desc_ac, (uint16_t)(total - offset));
+    midi_driver = &app[idx];
+  }
+  if (len == 0) {
+    midid_driver.init();
+    len = midid_driver.open(0, desc_ac, (uint16_t)(total - offset));
+    midi_driver = &midid_driver;
+  }
+  if (len == 0)
+    panic("No class driver opened the MIDI interface");
+  // usbd only binds the MIDI Streaming interface to a driver other than
+  // tinyusb's when an Interface Association Descriptor says to
+  if (midi_driver != &midid_driver && (iad == NULL || iad[2] != desc_ac->bInterfaceNumber || iad[3] != 2))
+    panic("No Interface Association Descriptor for the MIDI interface");
+  offset += len;
+  if (offset < total && config[offset + 1] == TUSB_DESC_INTERFACE && config[offset + 2] == itf_ms)
+    panic("No class driver took alternate setting %u of the MIDI Streaming interface", config[offset + 3]);
+}
+
+// After the device is mounted, the host reads the Group Terminal Block
+// descriptors and selects the UMP alternate setting. Stop if the device
+// does not answer.
+static void select_ump(void)
+{
+  tusb_control_request_t request = {
+    .bmRequestType_bit = {.recipient = TUSB_REQ_RCPT_INTERFACE, .type = TUSB_REQ_TYPE_STANDARD, .direction = TUSB_DIR_IN},
+    .bRequest = TUSB_REQ_GET_DESCRIPTOR,
+    .wValue = TUD_MIDI_UMP_CS_GR_TRM_BLOCK << 8,
+    .wIndex = itf_ms,
+    .wLength = 0xFFFF,
+  };
+  control_data = NULL;
+  if (!midi_driver->control_xfer_cb(0, CONTROL_STAGE_SETUP, &request) || control_data == NULL)
+    panic("The device has no Group Terminal Block descriptors");
+  uint16_t nblocks = CFG_TUD_MIDI_NUMCABLES_IN + CFG_TUD_MIDI_NUMCABLES_OUT;
+  if (control_len != 5 + 13 * nblocks || control_data[1] != TUD_MIDI_UMP_CS_GR_TRM_BLOCK ||
+      (control_data[3] | (control_data[4] << 8)) != control_len)
+    panic("The Group Terminal Block descriptors do not add up");
+  request.bmRequestType_bit.direction = TUSB_DIR_OUT;
+  request.bRequest = TUSB_REQ_SET_INTERFACE;
+  request.wValue = 1;
+  request.wLength = 0;
+  control_acked = false;
+  if (!midi_driver->control_xfer_cb(0, CONTROL_STAGE_SETUP, &request) || !control_acked)
+    panic("The device did not select the UMP alternate setting");
+}
+
+// The host reads the descriptors when the device is mounted. Stop if they
+// do not add up.
+static void enumerate(void)
+{
+  const tusb_desc_device_t* device = (const tusb_desc_device_t*)tud_descriptor_device_cb();
+  if (device->bLength != sizeof(*device) || device->bDescriptorType != TUSB_DESC_DEVICE)
+    panic("Bad device descriptor");
+  const uint8_t* config = tud_descriptor_configuration_cb(0);
+  uint16_t total = (uint16_t)(config[2] | (config[3] << 8));
+  uint16_t offset = 0;
+  uint8_t ninterfaces = 0;
+  while (offset < total) {
+    if (config[offset] == 0)
+      panic("Zero length descriptor at offset %u of the configuration descriptor", offset);
+    if (config[offset + 1] == TUSB_DESC_INTERFACE && config[offset + 3] == 0)
+      ninterfaces++;
+    offset += config[offset];
+  }
+  if (offset != total || ninterfaces != config[4])
+    panic("Configuration descriptor length %u or interface count %u is wrong", total, config[4]);
+  open_midi(config, total);
+  remote_wakeup_en = config[7] & TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP;
+  // Every MIDI jack and the telemetry interface have a name
+  for (uint8_t index = CFG_TUD_MIDI_FIRST_PORT_STRIDX;
+       index <= CFG_TUD_MIDI_FIRST_PORT_STRIDX + CFG_TUD_MIDI_NUMCABLES_IN + CFG_TUD_MIDI_NUMCABLES_OUT; index++) {
+    if (tud_descriptor_string_cb(index, 0x0409) == NULL)
+      panic("No string descriptor %u", index);
+  }
+}
+
+bool tud_init(uint8_t rhport)
+{
+  (void)rhport;
+  next_frame_us = sim_now_us + SIM_FRAME_US;
+  mount_pending = true;
+  return true;
+}
+
+bool tud_task_event_ready(void)
+{
+  sim_step();
+  return mount_pending || out_xfer_done || in_xfer_done || suspend_pending || resume_pending;
+}
+
+void tud_task(void)
+{
+  if (mount_pending) {
+    mount_pending = false;
+    enumerate();
+    mounted = true;
+    prep_out_transaction();
+    tud_mount_cb();
+    if (sim_usb_ump)
+      select_ump();
+  }
+  if (out_xfer_done) {
+    out_xfer_done = false;
+    for (uint32_t idx = 0; idx < out_xfer_len; idx++) {
+      rx_fifo[rx_head++ % RX_FIFO_SIZE] = out_xfer[idx];
+    }
+    prep_out_transaction();
+    tud_midi_rx_cb(0);
+  }
+  if (in_xfer_done) {
+    in_xfer_done = false;
+    in_busy = false;
+    write_flush();
+  }
+  if (suspend_pending) {
+    suspend_pending = false;
+    tud_suspend_cb(remote_wakeup_en);
+  }
+  if (resume_pending) {
+    resume_pending = false;
+    tud_resume_cb();
+  }
+}
+
+bool tud_mounted(void)
+{
+  return mounted;
+}
+
+bool tud_remote_wakeup(void)
+{
+  // Like tinyusb, only while suspended with remote wakeup enabled
+  if (!suspended || !remote_wakeup_en)
+    return false;
+  if (resume_us == 0) {
+    resume_us = sim_now_us + RESUME_US;
+    sim_usb_stats.remote_wakeups++;
+  }
+  return true;
+}
+
+void sim_usb_suspend(void)
+{
+  if (bus_idle)
+    return;
+  bus_idle = true;
+  suspend_us = sim_now_us + SUSPEND_IDLE_US;
+}
+
+void sim_usb_resume(void)
+{
+  if (bus_idle && resume_us == 0)
+    resume_us = sim_now_us;
+}
+
+bool tud_control_xfer(uint8_t rhport, tusb_control_request_t const* request, void* buffer, uint16_t len)
+{
+  (void)rhport;
+  (void)request;
+  control_data = buffer;
+  control_len = len;
+  return true;
+}
+
+bool tud_control_status(uint8_t rhport, tusb_control_request_t const* request)
+{
+  (void)rhport;
+  (void)request;
+  control_acked = true;
+  return true;
+}
+
+void usbd_edpt_close(uint8_t rhport, uint8_t ep_addr)
+{
+  (void)rhport;
+  // A transfer on the way is lost
+  if (ep_addr == (0x80 | EPNUM_MIDI_IN))
+    in_busy = in_claimed = in_xfer_done = false;
+  else if (ep_addr == EPNUM_MIDI_OUT)
+    out_armed = out_xfer_done = false;
+}
+
+bool usbd_edpt_claim(uint8_t rhport, uint8_t ep_addr)
+{
+  (void)rhport;
+  if (ep_addr != (0x80 | EPNUM_MIDI_IN) || in_busy || in_claimed)
+    return false;
+  in_claimed = true;
+  return true;
+}
+
+bool usbd_edpt_release(uint8_t rhport, uint8_t ep_addr)
+{
+  (void)rhport;
+  if (ep_addr != (0x80 | EPNUM_MIDI_IN) || !in_claimed)
+    return false;
+  in_claimed = false;
+  return true;
+}
+
+void midid_init(void)
+{
+}
+
+void midid_reset(uint8_t rhport)
+{
+  (void)rhport;
+  rx_head = rx_tail = tx_head = tx_tail = 0;
+  memset(&stream_write, 0, sizeof(stream_write));
+}
+
+// Take the Audio Control interface and alternate setting 0 of the MIDI
+// Streaming interface, like tinyusb's driver
+uint16_t midid_open(uint8_t rhport, tusb_desc_interface_t const* desc_itf, uint16_t max_len)
+{
+  (void)rhport;
+  if (desc_itf->bInterfaceClass != TUSB_CLASS_AUDIO || desc_itf->bInterfaceSubClass != AUDIO_SUBCLASS_CONTROL)
+    return 0;
+  const uint8_t* desc = (const uint8_t*)desc_itf;
+  uint16_t len = tu_desc_len(desc);
+  bool ms = false;
+  while (len < max_len) {
+    const uint8_t* next = desc + len;
+    if (tu_desc_type(next) == TUSB_DESC_INTERFACE_ASSOCIATION)
+      break;
+    if (tu_desc_type(next) == TUSB_DESC_INTERFACE) {
+      const tusb_desc_interface_t* itf = (const tusb_desc_interface_t*)next;
+      if (ms || itf->bInterfaceSubClass != AUDIO_SUBCLASS_MIDI_STREAMING || itf->bAlternateSetting != 0)
+        break;
+      ms = true;
+    }
+    len += tu_desc_len(next);
+  }
+  if (!ms)
+    return 0;
+  prep_out_transaction();
+  return len;
+}
+
+bool midid_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request)
+{
+  (void)rhport;
+  (void)stage;
+  (void)request;
+  return false;
+}
+
+bool midid_xfer_cb(uint8_t rhport, uint8_t edpt_addr, xfer_result_t result, uint32_t xferred_bytes)
+{
+  (void)rhport;
+  (void)edpt_addr;
+  (void)result;
+  (void)xferred_bytes;
+  return true;
+}
+
+bool tud_midi_n_mounted(uint8_t itf)
+{
+  (void)itf;
+  return mounted;
+}
+
+uint32_t tud_midi_n_available(uint8_t itf, uint8_t cable_num)
+{
+  (void)itf;
+  (void)cable_num;
+  return rx_head - rx_tail;
+}
+
+bool tud_midi_n_packet_read(uint8_t itf, uint8_t packet[4])
+{
+  (void)itf;
+  if (rx_head - rx_tail < 4)
+    return false;
+  for (int idx = 0; idx < 4; idx++) {
+    packet[idx] = rx_fifo[rx_tail++ % RX_FIFO_SIZE];
+  }
+  prep_out_transaction();
+  return true;
+}
+
+uint32_t tud_midi_n_stream_write(uint8_t itf, uint8_t cable_num, uint8_t const* buffer, uint32_t bufsize)
+{
+  (void)itf;
+  if (!mounted)
+    return 0;
+  uint32_t idx = 0;
+  while (idx < bufsize && TX_FIFO_SIZE - (tx_head - tx_tail) >= 4) {
+    uint8_t data = buffer[idx++];
+    if (stream_write.index == 0) {
+      // New event packet
+      uint8_t msg = data >> 4;
+      stream_write.index = 2;
+      stream_write.buffer[1] = data;
+      if ((stream_write.buffer[0] & 0xF) == MIDI_CIN_SYSEX_START) {
+        // Still in a SysEx message
+        if (data == 0xF7) {
+          stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_SYSEX_END_1BYTE);
+          stream_write.total = 2;
+        }
+        else {
+          stream_write.total = 4;
+        }
+      }
+      else if ((msg >= 0x8 && msg <= 0xB) || msg == 0xE) {
+        stream_write.buffer[0] = (uint8_t)((cable_num << 4) | msg);
+        stream_write.total = 4;
+      }
+      else if (msg == 0xC || msg == 0xD) {
+        stream_write.buffer[0] = (uint8_t)((cable_num << 4) | msg);
+        stream_write.total = 3;
+      }
+      else if (msg == 0xF) {
+        switch (data) {
+          case 0xF0:
+            stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_SYSEX_START);
+            stream_write.total = 4;
+            break;
+          case 0xF1:
+          case 0xF3:
+            stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_SYSCOM_2BYTE);
+            stream_write.total = 3;
+            break;
+          case 0xF2:
+            stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_SYSCOM_3BYTE);
+            stream_write.total = 4;
+            break;
+          default:
+            stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_SYSEX_END_1BYTE);
+            stream_write.total = 2;
+            break;
+        }
+      }
+      else {
+        // A data byte without a status byte goes in a packet by itself
+        stream_write.buffer[0] = (uint8_t)((cable_num << 4) | MIDI_CIN_1BYTE_DATA);
+        stream_write.total = 2;
+      }
+    }
+    else {
+      stream_write.buffer[stream_write.index++] = data;
+      if ((stream_write.buffer[0] & 0xF) == MIDI_CIN_SYSEX_START && data == 0xF7) {
+        stream_write.buffer[0] = (uint8_t)((cable_num << 4) | (MIDI_CIN_SYSEX_START + (stream_write.index - 1)));
+        stream_write.total = stream_write.index;
+      }
+    }
+    if (stream_write.index == stream_write.total) {
+      for (uint8_t pad = stream_write.total; pad < 4; pad++) {
+        stream_write.buffer[pad] = 0;
+      }
+      for (int byte = 0; byte < 4; byte++) {
+        tx_fifo[tx_head++ % TX_FIFO_SIZE] = stream_write.buffer[byte];
+      }
+      stream_write.index = stream_write.total = 0;
+    }
+  }
+  if (tx_head - tx_tail > sim_usb_stats.in_fifo_high_water)
+    sim_usb_stats.in_fifo_high_water = tx_head - tx_tail;
+  write_flush();
+  return idx;
+}
+
+bool tud_midi_n_packet_write(uint8_t itf, uint8_t const packet[4])
+{
+  (void)itf;
+  if (!mounted || TX_FIFO_SIZE - (tx_head - tx_tail) < 4)
+    return false;
+  for (int byte = 0; byte < 4; byte++) {
+    tx_fifo[tx_head++ % TX_FIFO_SIZE] = packet[byte];
+  }
+  if (tx_head - tx_tail > sim_usb_stats.in_fifo_high_water)
+    sim_usb_stats.in_fifo_high_water = tx_head - tx_tail;
+  write_flush();
+  return true;
+}
+
+// One USB frame: at most one transfer each way
+static void usb_frame(void)
+{
+  if (host_head != host_tail) {
+    if (out_armed) {
+      out_xfer_len = 0;
+      while (out_xfer_len < EP_SIZE && host_head != host_tail) {
+        memcpy(&out_xfer[out_xfer_len], host_queue[host_tail++ % HOST_QUEUE_PACKETS], 4);
+        out_xfer_len += 4;
+      }
+      out_armed = false;
+      out_xfer_done = true;
+      sim_usb_stats.out_transfers++;
+    }
+    else {
+      sim_usb_stats.out_naks++;
+    }
+  }
+  if (in_busy && !in_xfer_done) {
+    for (uint32_t idx = 0; idx < in_xfer_len; idx += 4) {
+      sim_usb_host_received(&in_xfer[idx]);
+    }
+    sim_usb_stats.in_transfers++;
+    sim_usb_stats.in_packets += in_xfer_len / 4;
+    in_xfer_done = true;
+  }
+}
+
+void sim_usb_step(void)
+{
+  if (suspend_us != 0 && suspend_us <= sim_now_us) {
+    suspend_us = 0;
+    suspended = suspend_pending = true;
+    suspended_since_us = sim_now_us;
+    sim_usb_stats.suspends++;
+  }
+  if (resume_us != 0 && resume_us <= sim_now_us) {
+    resume_us = 0;
+    bus_idle = false;
+    if (suspended) {
+      suspended = false;
+      resume_pending = true;
+      sim_usb_stats.suspended_us += sim_now_us - suspended_since_us;
+    }
+    suspend_us = 0;
+    next_frame_us = sim_now_us + SIM_FRAME_US;
+  }
+  if (bus_idle)
+    return;
+  while (next_frame_us <= sim_now_us) {
+    usb_frame();
+    next_frame_us += SIM_FRAME_US;
+  }
+}
@@ -0,0 +1,131 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program stress tests and benchmarks midi_spsc_queue.h with a
+// producer thread and a consumer thread on a Linux host, the same way
+// core 0 and core 1 share the queues in dual core mode. The producer
+// pushes a known byte sequence in chunks of varying size; the consumer
+// pops it with midi_spsc_queue_pop() and midi_spsc_queue_peek() in turn
+// and checks every byte.
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include "midi_spsc_queue.h"
+
+#define QUEUE_SIZE 256 // same as the default CFG_MIDI_IN_QUEUE_SIZE
+
+static midi_spsc_queue_t queue;
+static uint8_t queue_buf[QUEUE_SIZE];
+static uint64_t total_bytes;
+
+// The byte at position idx of the test sequence. 251 is prime, so the
+// sequence never lines up with the power of 2 queue size.
+static inline uint8_t sequence_byte(uint64_t idx)
+{
+  return (uint8_t)(idx % 251);
+}
+
+static void* producer(void* arg)
+{
+  (void)arg;
+  uint8_t chunk[64];
+  uint64_t sent = 0;
+  uint32_t rng = 12345;
+  while (sent < total_bytes) {
+    rng = rng * 1103515245u + 12345u;
+    uint32_t nbytes = 1 + (rng >> 16) % sizeof(chunk);
+    if (nbytes > total_bytes - sent)
+      nbytes = (uint32_t)(total_bytes - sent);
+    for (uint32_t idx = 0; idx < nbytes; idx++)
+      chunk[idx] = sequence_byte(sent + idx);
+    uint32_t npushed = 0;
+    while (npushed < nbytes) {
+      uint32_t n = midi_spsc_queue_push(&queue, chunk + npushed, nbytes - npushed);
+      if (n == 0)
+        sched_yield(); // the host may have fewer CPUs than threads
+      npushed += n;
+    }
+    sent += nbytes;
+  }
+  return NULL;
+}
+
+static void* consumer(void* arg)
+{
+  (void)arg;
+  uint8_t chunk[48];
+  uint64_t received = 0;
+  bool use_peek = false;
+  while (received < total_bytes) {
+    const uint8_t* bytes = chunk;
+    uint32_t nbytes;
+    if (use_peek)
+      nbytes = midi_spsc_queue_peek(&queue, &bytes);
+    else
+      nbytes = midi_spsc_queue_pop(&queue, chunk, sizeof(chunk));
+    for (uint32_t idx = 0; idx < nbytes; idx++) {
+      if (bytes[idx] != sequence_byte(received + idx)) {
+        fprintf(stderr, "FAILED: byte %llu is %u, expected %u\r\n", (unsigned long long)(received + idx),
+          bytes[idx], sequence_byte(received + idx));
+        exit(EXIT_FAILURE);
+      }
+    }
+    if (use_peek)
+      midi_spsc_queue_consume(&queue, nbytes);
+    if (nbytes == 0)
+      sched_yield();
+    received += nbytes;
+    use_peek = !use_peek;
+  }
+  return NULL;
+}
+
+int main(int argc, char* argv[])
+{
+  total_bytes = 64ull * 1024 * 1024;
+  if (argc > 1)
+    total_bytes = strtoull(argv[1], NULL, 0);
+  midi_spsc_queue_init(&queue, queue_buf, sizeof(queue_buf));
+
+  struct timespec start, end;
+  pthread_t producer_thread, consumer_thread;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  pthread_create(&consumer_thread, NULL, consumer, NULL);
+  pthread_create(&producer_thread, NULL, producer, NULL);
+  pthread_join(producer_thread, NULL);
+  pthread_join(consumer_thread, NULL);
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  double seconds = (double)(end.tv_sec - start.tv_sec) + (double)(end.tv_nsec - start.tv_nsec) / 1e9;
+  printf("%llu bytes through a %u byte queue in %.3f s: %.2f Mbyte/s, all bytes in order\r\n",
+    (unsigned long long)total_bytes, QUEUE_SIZE, seconds, (double)total_bytes / seconds / 1e6);
+  return midi_spsc_queue_count(&queue) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,159 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+//--------------------------------------------------------------------+
+// This program shows the trade-off that CFG_MIDI_USB_IN_LATENCY_BUDGET_US
+// makes between the number of USB transfers and the time MIDI IN messages
+// wait. It simulates two DIN MIDI inputs receiving 3 byte messages at random
+// times, the firmware polling them every CFG_MIDI_SCHED_TICK_US and deciding
+// when to send with midi_flush_policy.h, and a full speed USB bulk IN
+// endpoint that carries up to 16 USB MIDI event packets per transfer and
+// completes each transfer at the next 1 ms frame. A message counts as
+// waiting from when its last byte arrived until its transfer started.
+//--------------------------------------------------------------------+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <math.h>
+
+#include "tusb.h" // the stand-in in host/include, for tusb_config.h
+#include "midi_flush_policy.h"
+
+#define NINPUTS 2
+#define STEP_US 10
+#define BYTE_US 320
+#define FRAME_US 1000
+#define PACKETS_PER_TRANSFER (CFG_TUD_MIDI_TX_BUFSIZE / 4)
+#define MAX_MESSAGES 65536
+
+// When each message's last byte arrives, in arrival order per input
+static uint32_t arrivals[NINPUTS][MAX_MESSAGES];
+static uint32_t narrivals[NINPUTS];
+
+static uint32_t rng_state;
+static double random_unit(void)
+{
+  rng_state = rng_state * 1103515245u + 12345u;
+  return ((rng_state >> 8) + 0.5) / 16777216.0;
+}
+
+// Make messages that start at random times averaging rate per second, but
+// no faster than the serial line can carry them
+static void make_arrivals(double rate, uint32_t end_us)
+{
+  rng_state = 1;
+  for (uint8_t input = 0; input < NINPUTS; input++) {
+    double start = 0;
+    uint32_t line_free = 0;
+    narrivals[input] = 0;
+    while (narrivals[input] < MAX_MESSAGES) {
+      start += -log(random_unit()) * 1e6 / rate;
+      uint32_t begin = (uint32_t)start > line_free ? (uint32_t)start : line_free;
+      line_free = begin + 3 * BYTE_US;
+      if (line_free >= end_us)
+        break;
+      arrivals[input][narrivals[input]++] = line_free;
+    }
+  }
+}
+
+static void run(const char* load, double rate, uint32_t budget_us, uint32_t seconds)
+{
+  uint32_t end_us = seconds * 1000000u;
+  make_arrivals(rate, end_us);
+  midi_flush_policy_t policy;
+  midi_flush_policy_init(&policy, budget_us, CFG_TUD_MIDI_TX_BUFSIZE / 4 * 3);
+  uint32_t next_arrival[NINPUTS] = {0};   // next message not yet polled
+  uint32_t next_queued[NINPUTS] = {0};    // next message not yet written to the USB FIFO
+  // The USB transmit FIFO holds messages by index; store the arrival times
+  static uint32_t fifo[PACKETS_PER_TRANSFER];
+  uint32_t fifo_count = 0;
+  bool endpoint_busy = false;
+  uint32_t ntransfers = 0, npackets = 0;
+  double wait_sum = 0;
+  uint32_t wait_max = 0;
+
+  for (uint32_t now = 0; now < end_us + 100000; now += STEP_US) {
+    if (now % FRAME_US == 0 && endpoint_busy)
+      endpoint_busy = false; // the host took the transfer
+    bool flushed = false;
+    if (now % CFG_MIDI_SCHED_TICK_US == 0) {
+      // Poll the inputs; a message becomes a USB MIDI event packet once all its bytes arrived
+      uint32_t nwaiting = 0;
+      for (uint8_t input = 0; input < NINPUTS; input++) {
+        while (next_arrival[input] < narrivals[input] && arrivals[input][next_arrival[input]] <= now)
+          next_arrival[input]++;
+        nwaiting += 3 * (next_arrival[input] - next_queued[input]);
+      }
+      if (midi_flush_policy_check(&policy, nwaiting, now)) {
+        for (uint8_t input = 0; input < NINPUTS; input++) {
+          while (next_queued[input] < next_arrival[input] && fifo_count < PACKETS_PER_TRANSFER) {
+            fifo[fifo_count++] = arrivals[input][next_queued[input]++];
+            nwaiting -= 3;
+          }
+        }
+        midi_flush_policy_sent(&policy, nwaiting);
+        flushed = true;
+      }
+    }
+    // tinyusb starts a transfer when the endpoint is idle, after a flush or
+    // when the last transfer completed
+    if (!endpoint_busy && fifo_count > 0 && (flushed || now % FRAME_US == 0)) {
+      for (uint32_t idx = 0; idx < fifo_count; idx++) {
+        uint32_t wait = now - fifo[idx];
+        wait_sum += wait;
+        if (wait > wait_max)
+          wait_max = wait;
+      }
+      npackets += fifo_count;
+      ntransfers++;
+      fifo_count = 0;
+      endpoint_busy = true;
+    }
+  }
+  printf("%-8s %9u %12.1f %12.2f %10.0f %10u\n", load, budget_us, ntransfers / (double)seconds,
+         ntransfers ? npackets / (double)ntransfers : 0.0, npackets ? wait_sum / npackets : 0.0, wait_max);
+}
+
+int main(int argc, char* argv[])
+{
+  uint32_t seconds = argc > 1 ? (uint32_t)strtoul(argv[1], NULL, 0) : 20;
+  if (seconds == 0 || seconds > 60) {
+    fprintf(stderr, "usage: %s [seconds (1-60)]\n", argv[0]);
+    return 1;
+  }
+  static const struct { const char* name; double rate; } loads[] = {
+    {"light", 20}, {"medium", 300}, {"heavy", 5000},
+  };
+  static const uint32_t budgets[] = {0, 500, 1000, 2000, 4000};
+  printf("2 MIDI IN ports, 3 byte messages, %u s simulated; wait in microseconds\n", seconds);
+  printf("%-8s %9s %12s %12s %10s %10s\n", "load", "budget", "transfers/s", "packets/xfer", "mean wait", "max wait");
+  for (size_t load = 0; load < TU_ARRAY_SIZE(loads); load++) {
+    for (size_t budget = 0; budget < TU_ARRAY_SIZE(budgets); budget++)
+      run(loads[load].name, loads[load].rate, budgets[budget], seconds);
+  }
+  return 0;
+}
@@ -29,13 +29,51 @@
 
 #include "bsp/board.h"
 #include "tusb.h"
-#include "pio_midi_uart_lib.h"
 #include "midi_device_multistream.h"
+#include "midi_ports.h"
+#include "midi_sched.h"
+#include "midi_running_status.h"
+#include "midi_out_port.h"
+#include "midi_telemetry.h"
+#include "midi_flush_policy.h"
+#include "usb_descriptors.h"
+#include "device/usbd_pvt.h" // for usb_in_hold() and usb_in_release() only
+#include "midi_msg_parser.h"
+#include "midi_packetizer.h"
+#include "midi_route_table.h"
+#include "midi_route_flash.h"
+#include "midi_filter.h"
+#include "midi_trace.h"
+#include "midi_profile.h"
+#include "hardware/sync.h"
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+#include "pico/stdlib.h"
+#include "hardware/clocks.h"
+#endif
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+#include "midi_clock_regen.h"
+#endif
+#if CFG_MIDI_TIMED_OUT
+#include "midi_timed_out.h"
+#endif
+#if CFG_MIDI_DUAL_CORE
+#include <stdatomic.h>
+#include "pico/multicore.h"
+#include "midi_spsc_queue.h"
+#endif
+#if CFG_MIDI_UMP
+#include "midi_ump.h"
+#include "midi_ump_driver.h"
+#endif
 //--------------------------------------------------------------------+
-// This program routes 5-pin DIN MIDI IN signals A & B to USB MIDI
-// virtual cables 0 & 1 on the USB MIDI Bulk IN endpoint. It also
-// routes MIDI data from USB MIDI virtual cables 0-5 on the USB MIDI
-// Bulk OUT endpoint to the 5-pin DIN MIDI OUT signals A-F.
+// This program routes 5-pin DIN MIDI IN signals A, B, ... to USB MIDI
+// virtual cables 0, 1, ... on the USB MIDI Bulk IN endpoint. It also
+// routes MIDI data from USB MIDI virtual cables 0, 1, ... on the USB MIDI
+// Bulk OUT endpoint to the 5-pin DIN MIDI OUT signals A, B, ... (See
+// midi_ports.h). Optional thru routes also copy MIDI IN ports to MIDI OUT
+// ports. System Exclusive
+// commands on the MIDI CONFIG virtual cable change the routes (See
+// midi_route_table.h).
 // The Pico board's LED blinks in a pattern depending on the Pico's
 // USB connection state (See below).
 //--------------------------------------------------------------------+
@@ -58,46 +96,327 @@ enum  {
 
 static uint32_t blink_interval_ms = BLINK_NOT_MOUNTED;
 
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+static uint32_t full_clock_hz;    // clk_sys while the bus is not suspended
+// clk_peri's source and frequency while the bus is not suspended
+static uint32_t full_peri_auxsrc, full_peri_hz;
+#endif
+#if CFG_MIDI_REMOTE_WAKEUP
+// True from when the bus is suspended with remote wakeup enabled until the
+// adapter wakes the host or the host resumes the bus
+static volatile bool usb_can_wake_host;
+// Set when a MIDI IN port received bytes for the host while usb_can_wake_host
+// was true; port_rx_task() wakes the host
+static volatile bool usb_wakeup_pending;
+#endif
+
 static void led_blinking_task(void);
-static void midi_task(void);
-
-static void* midi_uarts[2]; // MIDI IN A, B and MIDI OUT A, B
-static void* midi_outs[4];  // MIDI OUT C-F
-
-// MIDI UART pin usage (Move them if you want to)
-static const uint MIDI_OUT_A_GPIO = 4;
-static const uint MIDI_IN_A_GPIO = 5;
-static const uint MIDI_OUT_B_GPIO = 6;
-static const uint MIDI_IN_B_GPIO = 7;
-static const uint MIDI_OUT_C_GPIO = 10;
-static const uint MIDI_OUT_D_GPIO = 18;
-static const uint MIDI_OUT_E_GPIO = 3;
-static const uint MIDI_OUT_F_GPIO = 27;
+
+static midi_demux_ctx_t usb_rx_demux; // demultiplexes the USB MIDI OUT endpoint
+#if CFG_MIDI_UMP
+static midi_ump_ctx_t usb_rx_ump;     // reads it in the UMP alternate setting instead
+#endif
+// True when a MIDI OUT port queue was too full to take the USB MIDI OUT data.
+// With flow control the data waits and the timer tick retries.
+static volatile bool usb_rx_stalled;
+// True when the USB MIDI OUT task ran out of time with data left to dispatch
+static bool usb_rx_late;
+static bool usb_rx_dispatched; // at least one message went this pass
+#if !CFG_MIDI_USB_RX_ZERO_COPY
+// The last run of stream bytes for one cable and the part not yet written
+static uint8_t usb_rx_buf[48];
+static uint8_t usb_rx_cable;
+static uint8_t* usb_rx_next;
+static uint32_t usb_rx_nbytes;
+#endif
+
+// The main loop only runs the tasks that have work to do. The USB device stack,
+// tud_midi_rx_cb() and a repeating timer post the tasks. See start_sched().
+static midi_sched_t sched;
+static uint8_t usb_task_id;       // tud_task()
+static uint8_t usb_rx_task_id;    // USB MIDI OUT endpoint to the MIDI OUT ports
+static uint8_t port_rx_task_id;   // MIDI IN ports to the USB MIDI IN endpoint
+static uint8_t led_task_id;       // led_blinking_task()
+static repeating_timer_t sched_timer;
+#if !CFG_MIDI_DUAL_CORE
+static uint8_t port_tx_task_id;   // MIDI OUT port queues to the PIO
+// The MIDI OUT ports that have bytes queued or still sending. Only these are serviced.
+static volatile uint32_t port_tx_active;
+// The MIDI OUT ports the last pass of the task ran out of time for
+static uint32_t port_tx_skipped;
+#endif
+
+// Transmit queues for the MIDI OUT ports with a priority lane for System Real-Time
+// messages. In dual core mode core 0 writes them and core 1 services them.
+// The bulk lanes share the blocks of out_port_pool. Each also holds on to
+// the block it has finished with until it starts the next, which is one more
+// block per port.
+#define OUT_PORT_POOL_BLOCKS (MIDI_PORTS_NUM_OUT * (CFG_MIDI_OUT_RESERVED_BLOCKS + 1) + CFG_MIDI_OUT_SHARED_BLOCKS)
+_Static_assert(OUT_PORT_POOL_BLOCKS <= MIDI_BLOCK_POOL_MAX_BLOCKS, "the MIDI OUT port pool has too many blocks");
+static midi_out_port_t out_ports[MIDI_PORTS_NUM_OUT];
+static midi_block_pool_t out_port_pool;
+static uint8_t out_port_pool_blocks[OUT_PORT_POOL_BLOCKS][CFG_MIDI_OUT_BLOCK_SIZE];
+static uint8_t out_port_pool_lists[2 * OUT_PORT_POOL_BLOCKS];
+static uint8_t out_port_realtime_bufs[MIDI_PORTS_NUM_OUT][CFG_MIDI_OUT_REALTIME_QUEUE_SIZE];
+
+// MIDI IN bytes waiting to go to the USB host, one queue per MIDI IN port.
+// In dual core mode core 1 owns the MIDI ports and fills these queues.
+static midi_spsc_queue_t port_to_usb_queues[MIDI_PORTS_NUM_IN];
+static uint8_t port_to_usb_bufs[MIDI_PORTS_NUM_IN][CFG_MIDI_IN_QUEUE_SIZE];
+// Decides when to send the bytes in port_to_usb_queues to the USB host
+static midi_flush_policy_t usb_in_flush;
+// Turn the bytes from each MIDI IN port into USB MIDI event packets
+static midi_packetizer_t usb_in_packetizers[MIDI_PORTS_NUM_IN];
+// The packets from each MIDI IN port that the USB transmit FIFO had no room
+// for, or in the UMP alternate setting the UMP words they became: one byte
+// can complete 2 packets, and a packet can become 2 words.
+#define USB_IN_MAX_PENDING (CFG_MIDI_UMP ? 4 : 2)
+static uint8_t usb_in_pending[MIDI_PORTS_NUM_IN][USB_IN_MAX_PENDING][4];
+static uint8_t usb_in_npending[MIDI_PORTS_NUM_IN];
+// The MIDI IN port that writes to the USB transmit FIFO first. A port that
+// only got part of a UMP message in must finish it before any other writes.
+static uint8_t usb_in_first_cable;
+// Set when a MIDI IN port received a System Real-Time byte, which goes to the
+// USB host without waiting for usb_in_flush
+static volatile bool usb_in_realtime;
+
+// The last USB MIDI OUT virtual cable carries routing table commands
+#define MIDI_CONFIG_CABLE (CFG_TUD_MIDI_NUMCABLES_OUT - 1)
+static midi_route_config_t route_config;
+// True when the host asked to save the routing table to flash. The config
+// task saves it when the MIDI OUT ports are idle.
+static volatile bool route_save_pending;
+static uint8_t config_task_id;
+// The MIDI OUT ports that more than one source routes to
+static uint32_t merged_ports;
+// The routing table's filters, compiled, and where each stream they filter
+// is: the data on each USB MIDI OUT virtual cable, and the data from each
+// MIDI IN port to the USB host
+static midi_filter_t out_filters[MIDI_PORTS_NUM_OUT], in_filters[MIDI_PORTS_NUM_IN];
+static midi_filter_state_t usb_rx_filter_states[MIDI_ROUTE_MAX_CABLES];
+static midi_filter_state_t usb_in_filter_states[MIDI_PORTS_NUM_IN];
+#if CFG_MIDI_REMOTE_WAKEUP
+// The same streams as they come off the MIDI IN ports, for deciding whether to wake the host
+static midi_filter_state_t wakeup_filter_states[MIDI_PORTS_NUM_IN];
+#endif
+#if CFG_MIDI_DUAL_CORE
+// Core 1 filters the MIDI IN ports with its own copy of in_filters. Once
+// apply_routes() on core 0 has changed in_filters, it raises
+// in_filters_version; core 1 copies in_filters and sets in_filters_copied
+// to the version it copied. Core 0 does not change in_filters again until
+// core 1 has caught up, so core 1 never sees a half written filter.
+static midi_filter_t core1_in_filters[MIDI_PORTS_NUM_IN];
+static atomic_uint in_filters_version, in_filters_copied;
+#endif
+
+// Core 0 reads port_to_usb_queues for both the USB host and the thru routes,
+// starting these many bytes past each queue's tail. A byte leaves the queue
+// when both have read it.
+static uint32_t usb_in_offsets[MIDI_PORTS_NUM_IN], thru_offsets[MIDI_PORTS_NUM_IN];
+// Splits the bytes from each MIDI IN port into messages
+static midi_msg_parser_t thru_parsers[MIDI_PORTS_NUM_IN];
+// The message from each MIDI IN port that is on its way to the ports in
+// thru_msg_targets. It waits there while any of them cannot take it.
+static midi_msg_t thru_msgs[MIDI_PORTS_NUM_IN];
+static uint16_t thru_msg_targets[MIDI_PORTS_NUM_IN];
+// The sources of MIDI OUT port data: the USB MIDI OUT virtual cables and the
+// MIDI IN ports
+#define SOURCE_NONE 0
+#define SOURCE_CABLE(n) (1 + (n))
+#define SOURCE_MIDI_IN(n) (1 + MIDI_ROUTE_MAX_CABLES + (n))
+// The source in the middle of a System Exclusive message on each MIDI OUT
+// port. The other sources wait for it to finish.
+static uint8_t sysex_owners[MIDI_PORTS_NUM_OUT];
+
+#if CFG_MIDI_DUAL_CORE
+static void core1_main(void);
+#endif
+
+#if CFG_MIDI_RUNNING_STATUS_PORTS
+// Running status encoder state for each MIDI OUT port
+static midi_running_status_t port_running_status[MIDI_PORTS_NUM_OUT];
+#endif
+
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+// The MIDI Clock regenerator of each MIDI OUT port in CFG_MIDI_CLOCK_REGEN_PORTS
+static midi_clock_regen_t clock_regens[MIDI_PORTS_NUM_OUT];
+#endif
+
+#if CFG_MIDI_TIMED_OUT
+// Timed messages from the USB host (See midi_timed_out.h): where the stream
+// on each virtual cable is in the envelopes, the offset from the host's
+// clock, and the messages waiting for their time on each MIDI OUT port
+static midi_timed_rx_t timed_rx[MIDI_ROUTE_MAX_CABLES];
+static midi_timed_clock_t timed_clock;
+static midi_timed_queue_t timed_queues[MIDI_PORTS_NUM_OUT];
+static midi_timed_event_t timed_events[MIDI_PORTS_NUM_OUT][CFG_MIDI_TIMED_OUT_EVENTS];
+#endif
+
+// A hardware alarm posts out_timer_task when the next regenerated clock tick
+// or timed message is due on any MIDI OUT port
+#define OUT_TIMER (CFG_MIDI_CLOCK_REGEN_PORTS || CFG_MIDI_TIMED_OUT)
+#if OUT_TIMER
+static uint8_t out_timer_task_id;
+static volatile alarm_id_t out_alarm;  // 0 when the alarm is not set
+static uint32_t out_alarm_us;          // when out_alarm goes off
+#endif
+
+#if CFG_MIDI_PROFILE
+// The bytes from each MIDI IN port on their way to the USB host, and the
+// bytes on their way to each MIDI OUT port, of which only the ones from the
+// USB host get marks (See midi_profile.h)
+static midi_profile_stream_t in_profile_streams[MIDI_PORTS_NUM_IN];
+static midi_profile_stream_t out_profile_streams[MIDI_PORTS_NUM_OUT];
+static bool usb_rx_running;  // poll_usb_rx() is handing on bytes from the USB host
+#if CFG_MIDI_DUAL_CORE
+static uint8_t core1_profile_id;
+#endif
+#endif
+
+#if CFG_MIDI_TRACE || CFG_MIDI_PROFILE
+// Write to the MIDI OUT port that port, a midi_port_tx_t in midi_ports_tx,
+// describes and record the bytes it takes in the trace and the profile
+static uint32_t record_port_tx(void* port, const uint8_t* bytes, uint32_t nbytes)
+{
+  const midi_port_tx_t* tx = (const midi_port_tx_t*)port;
+  uint8_t out_port = (uint8_t)(tx - midi_ports_tx);
+  uint32_t nwritten = tx->write(tx->port, bytes, nbytes);
+  for (uint32_t idx = 0; idx < nwritten; idx++) {
+    midi_trace_record_byte(MIDI_TRACE_DIN_OUT, out_port, bytes[idx]);
+  }
+  midi_profile_stream_out(&out_profile_streams[out_port], nwritten, time_us_32(), &midi_profile.out_latency);
+  return nwritten;
+}
+#endif
+
+static void create_midi_ports(void)
+{
+  midi_ports_init();
+  // and the MIDI OUT ports' transmit queues
+  midi_block_pool_init(&out_port_pool, &out_port_pool_blocks[0][0], CFG_MIDI_OUT_BLOCK_SIZE, OUT_PORT_POOL_BLOCKS,
+                       out_port_pool_lists, CFG_MIDI_OUT_RESERVED_BLOCKS + 1);
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+#if CFG_MIDI_TRACE || CFG_MIDI_PROFILE
+    midi_out_port_init(&out_ports[port], record_port_tx, &midi_ports_tx[port],
+#else
+    midi_out_port_init(&out_ports[port], midi_ports_tx[port].write, midi_ports_tx[port].port,
+#endif
+                       &out_port_pool,
+                       out_port_realtime_bufs[port], CFG_MIDI_OUT_REALTIME_QUEUE_SIZE,
+                       CFG_MIDI_OUT_PACING_BYTES);
+  }
+}
+
+static void apply_routes(void);
+static void start_sched(void);
+
 /*------------- MAIN -------------*/
 int main(void)
 {
   board_init();
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+  full_clock_hz = clock_get_hz(clk_sys);
+  full_peri_auxsrc = (clocks_hw->clk[clk_peri].ctrl & CLOCKS_CLK_PERI_CTRL_AUXSRC_BITS) >> CLOCKS_CLK_PERI_CTRL_AUXSRC_LSB;
+  full_peri_hz = clock_get_hz(clk_peri);
+#endif
+  midi_trace_init();
+  midi_profile_init();
 
   // init device stack on configured roothub port
   tud_init(BOARD_TUD_RHPORT);
+  midi_demux_init(&usb_rx_demux, 0);
+#if CFG_MIDI_UMP
+  midi_ump_init(&usb_rx_ump, 0);
+#endif
 
-  // Create the MIDI UARTs and MIDI OUTs
-  midi_uarts[0] = pio_midi_uart_create(MIDI_OUT_A_GPIO, MIDI_IN_A_GPIO);
-  midi_uarts[1] = pio_midi_uart_create(MIDI_OUT_B_GPIO, MIDI_IN_B_GPIO);
-  midi_outs[0] = pio_midi_out_create(MIDI_OUT_C_GPIO);
-  midi_outs[1] = pio_midi_out_create(MIDI_OUT_D_GPIO);
-  midi_outs[2] = pio_midi_out_create(MIDI_OUT_E_GPIO);
-  midi_outs[3] = pio_midi_out_create(MIDI_OUT_F_GPIO);
-  printf("2-IN 6-OUT USB MIDI Device adapter\r\n");
-  // 
+  for (int port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    midi_spsc_queue_init(&port_to_usb_queues[port], port_to_usb_bufs[port], CFG_MIDI_IN_QUEUE_SIZE);
+    midi_packetizer_init(&usb_in_packetizers[port], (uint8_t)port);
+    midi_filter_state_init(&usb_in_filter_states[port]);
+#if CFG_MIDI_REMOTE_WAKEUP
+    midi_filter_state_init(&wakeup_filter_states[port]);
+#endif
+    midi_profile_stream_init(&in_profile_streams[port]);
+  }
+#if CFG_MIDI_PROFILE
+  for (int port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    midi_profile_stream_init(&out_profile_streams[port]);
+  }
+#endif
+  // Send when the bytes waiting fill a USB transfer: 3 bytes per USB MIDI
+  // event packet for most messages
+  midi_flush_policy_init(&usb_in_flush, CFG_MIDI_USB_IN_LATENCY_BUDGET_US, CFG_TUD_MIDI_TX_BUFSIZE / 4 * 3);
+  midi_route_config_init(&route_config);
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+  for (int port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    midi_clock_regen_init(&clock_regens[port], CFG_MIDI_CLOCK_REGEN_DELAY_US);
+  }
+#endif
+#if CFG_MIDI_TIMED_OUT
+  for (int port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    midi_timed_queue_init(&timed_queues[port], timed_events[port], CFG_MIDI_TIMED_OUT_EVENTS);
+  }
+#endif
+  if (!midi_route_flash_load(&midi_route_table))
+    midi_route_table_defaults(&midi_route_table);
+  apply_routes();
+#if CFG_MIDI_DUAL_CORE
+  // Core 1 creates the ports so that their interrupts run on core 1.
+  // Wait for it to finish before using the queues.
+#if CFG_MIDI_PROFILE
+  core1_profile_id = midi_profile_add_task("core1");
+#endif
+  multicore_launch_core1(core1_main);
+  multicore_fifo_pop_blocking();
+#else
+  create_midi_ports();
+#endif
+  start_sched();
+  printf("%d-IN %d-OUT USB MIDI Device adapter\r\n", MIDI_PORTS_NUM_IN, MIDI_PORTS_NUM_OUT);
   while (1)
   {
-    tud_task(); // tinyusb device task
-    led_blinking_task();
-    midi_task();
+    // Sleep until an interrupt when there is nothing to do. The USB, timer
+    // and PIO interrupts wake the core even with interrupts disabled, and
+    // their handlers run once they are enabled again, before the tasks they
+    // posted.
+    uint32_t status = save_and_disable_interrupts();
+    if (tud_task_event_ready())
+      midi_sched_post(&sched, usb_task_id);
+    else if (!midi_sched_has_pending(&sched))
+      __wfi();
+    restore_interrupts(status);
+    midi_sched_run(&sched);
   }
 }
 
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+// Run clk_sys at hz, either 48 MHz from the USB PLL or full_clock_hz, and
+// keep the MIDI ports at 31250 baud. Both switches run clk_sys from the USB
+// PLL while the system PLL starts or stops, so the PIO state machines only
+// run at the wrong rate for the few microseconds before their dividers are
+// scaled, a small part of a 32 us bit time. Both also move clk_peri to 48 MHz
+// from the USB PLL, so going back up restores the clk_peri board_init() set,
+// and the stdio UART gets its baud rate back after each switch.
+static void set_sys_clock(uint32_t hz)
+{
+    uint32_t old_hz = clock_get_hz(clk_sys);
+    if (hz == old_hz)
+        return;
+    if (hz == 48 * MHZ) {
+        set_sys_clock_48mhz();
+    }
+    else {
+        set_sys_clock_khz(hz / KHZ, true);
+        // clk_peri has no divider, so it runs at its source's frequency
+        clock_configure(clk_peri, 0, full_peri_auxsrc, full_peri_hz, full_peri_hz);
+    }
+#if LIB_PICO_STDIO_UART
+    uart_set_baudrate(uart_default, PICO_DEFAULT_UART_BAUD_RATE);
+#endif
+    midi_ports_sys_clock_changed(old_hz, hz);
+}
+#endif
+
 //--------------------------------------------------------------------+
 // Device callbacks
 //--------------------------------------------------------------------+
@@ -108,11 +427,62 @@ void tud_mount_cb(void)
   blink_interval_ms = BLINK_MOUNTED;
 }
 
+// Forget the data from the USB host that is on its way to the MIDI OUT
+// ports, after the host unmounted the device or changed the alternate setting
+static void reset_usb_rx(void)
+{
+  // Do not send a stale partial packet to the ports
+  midi_demux_reset(&usb_rx_demux);
+#if CFG_MIDI_UMP
+  midi_ump_reset(&usb_rx_ump);
+#endif
+  usb_rx_stalled = false;
+  for (uint8_t cable = 0; cable < MIDI_ROUTE_MAX_CABLES; cable++) {
+    midi_filter_state_init(&usb_rx_filter_states[cable]);
+#if CFG_MIDI_TIMED_OUT
+    midi_timed_rx_init(&timed_rx[cable]);
+#endif
+  }
+#if CFG_MIDI_TIMED_OUT
+  // The host's clock may start over too
+  midi_timed_clock_init(&timed_clock);
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    midi_timed_queue_clear(&timed_queues[port]);
+  }
+#endif
+#if !CFG_MIDI_USB_RX_ZERO_COPY
+  usb_rx_nbytes = 0;
+#endif
+  midi_route_config_init(&route_config);
+  // The rest of a System Exclusive message from the host will not come
+  for (int port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    if (sysex_owners[port] < SOURCE_MIDI_IN(0))
+      sysex_owners[port] = SOURCE_NONE;
+  }
+}
+
 // Invoked when device is unmounted
 void tud_umount_cb(void)
 {
   blink_interval_ms = BLINK_NOT_MOUNTED;
+  reset_usb_rx();
+}
+
+#if CFG_MIDI_UMP
+// Invoked when the host selects the MIDI 1.0 or the UMP alternate setting
+void midi_ump_driver_set_cb(bool ump)
+{
+  (void) ump;
+  reset_usb_rx();
+  // The packets waiting for the USB host are in the old format. Start each
+  // MIDI IN port's packets over at its next status byte.
+  for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_IN; cable++) {
+    midi_packetizer_init(&usb_in_packetizers[cable], cable);
+    usb_in_npending[cable] = 0;
+  }
+  usb_in_first_cable = 0;
 }
+#endif
 
 // Invoked when usb bus is suspended
 // remote_wakeup_en : if host allow us  to perform remote wakeup
@@ -121,84 +491,1029 @@ void tud_suspend_cb(bool remote_wakeup_en)
 {
   (void) remote_wakeup_en;
   blink_interval_ms = BLINK_SUSPENDED;
+#if CFG_MIDI_REMOTE_WAKEUP
+  usb_wakeup_pending = false;
+  usb_can_wake_host = remote_wakeup_en;
+#endif
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+  set_sys_clock(48 * MHZ);
+#endif
 }
 
 // Invoked when usb bus is resumed
 void tud_resume_cb(void)
 {
   blink_interval_ms = BLINK_MOUNTED;
+#if CFG_MIDI_REMOTE_WAKEUP
+  usb_can_wake_host = false;
+#endif
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+  set_sys_clock(full_clock_hz);
+#endif
+}
+
+// Invoked from tud_task() when the USB MIDI OUT endpoint received data
+void tud_midi_rx_cb(uint8_t itf)
+{
+  (void) itf;
+  midi_sched_post(&sched, usb_rx_task_id);
 }
 
 //--------------------------------------------------------------------+
 // MIDI Task
 //--------------------------------------------------------------------+
-static void poll_midi_uarts_rx(bool connected)
+// Move the bytes received on each MIDI IN port to its queue to the USB host,
+// but only as many as the queue has room for
+static void poll_midi_ports_rx(void)
 {
+#if CFG_MIDI_DUAL_CORE
+    const midi_filter_t* filters = core1_in_filters;
+#else
+    const midi_filter_t* filters = in_filters;
+#endif
     uint8_t rx[48];
-    // Pull any bytes received on the MIDI UART out of the receive buffer and
-    // send them out via USB MIDI on virtual cable 0
-    for (uint8_t cable = 0; cable < 2; cable++) {
-        uint8_t nread = pio_midi_uart_poll_rx_buffer(midi_uarts[cable], rx, sizeof(rx));
-        if (nread > 0 && connected)
-        {
-            uint32_t nwritten = tud_midi_stream_write(cable, rx, nread);
-            if (nwritten != nread) {
-                TU_LOG1("Warning: Dropped %lu bytes receiving from UART MIDI In %c\r\n", nread - nwritten, 'A'+cable);
+    for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_IN; cable++) {
+        uint32_t space = midi_spsc_queue_space(&port_to_usb_queues[cable]);
+        if (space > 0) {
+            uint8_t nread = midi_ports_poll_rx(cable, rx, (uint8_t)tu_min32(space, sizeof(rx)));
+            for (uint8_t idx = 0; idx < nread; idx++) {
+                if (rx[idx] >= 0xF8 && midi_filter_passes(&filters[cable], rx[idx]))
+                    usb_in_realtime = true;
+#if CFG_MIDI_REMOTE_WAKEUP
+                // Neither MIDI Clock and Active Sensing nor what the port's
+                // filter keeps from the host wakes the host
+                else if (midi_filter_byte(&filters[cable], &wakeup_filter_states[cable], rx[idx]) &&
+                         rx[idx] < 0xF8 && usb_can_wake_host)
+                    usb_wakeup_pending = true;
+#endif
+                midi_trace_record_byte(MIDI_TRACE_DIN_IN, cable, rx[idx]);
+            }
+            midi_spsc_queue_push(&port_to_usb_queues[cable], rx, nread);
+            midi_profile_stream_in(&in_profile_streams[cable], nread, true, time_us_32());
+        }
+    }
+}
+
+// Remove the bytes that both the USB host and the thru routes have read from
+// the queue for MIDI IN port cable
+static void release_port_rx(uint8_t cable)
+{
+    if (midi_route_table.thru_ports[cable] == 0)
+        thru_offsets[cable] = usb_in_offsets[cable]; // nothing to route
+    uint32_t nread = tu_min32(usb_in_offsets[cable], thru_offsets[cable]);
+    midi_spsc_queue_consume(&port_to_usb_queues[cable], nread);
+    usb_in_offsets[cable] -= nread;
+    thru_offsets[cable] -= nread;
+}
+
+// Return the number of bytes from MIDI IN port cable waiting for the USB host
+static uint32_t usb_in_count(uint8_t cable)
+{
+    return midi_spsc_queue_count(&port_to_usb_queues[cable]) - usb_in_offsets[cable];
+}
+
+// Like midi_spsc_queue_peek() for the bytes from MIDI IN port cable waiting for the USB host
+static uint32_t usb_in_peek(uint8_t cable, const uint8_t** bytes)
+{
+    return midi_spsc_queue_peek_at(&port_to_usb_queues[cable], usb_in_offsets[cable], bytes);
+}
+
+// Mark nbytes bytes from MIDI IN port cable as sent to the USB host
+static void usb_in_consume(uint8_t cable, uint32_t nbytes)
+{
+    usb_in_offsets[cable] += nbytes;
+    release_port_rx(cable);
+}
+
+// Write the USB MIDI event packets or UMP words from MIDI IN port cable that
+// the USB transmit FIFO had no room for. Return false if it still has no room.
+static bool write_usb_in_pending(uint8_t cable)
+{
+    uint8_t npending = usb_in_npending[cable];
+    uint8_t nwritten = 0;
+    while (nwritten < npending && tud_midi_packet_write(usb_in_pending[cable][nwritten])) {
+#if CFG_MIDI_UMP
+        if (!midi_ump_driver_active())
+#endif
+        midi_trace_record(MIDI_TRACE_USB_IN, usb_in_pending[cable][nwritten]);
+        nwritten++;
+    }
+    if (nwritten > 0 && nwritten < npending)
+        memmove(usb_in_pending[cable][0], usb_in_pending[cable][nwritten], (npending - nwritten) * 4u);
+    usb_in_npending[cable] = npending - nwritten;
+    return nwritten == npending;
+}
+
+// Write a USB MIDI event packet from MIDI IN port cable to the USB transmit
+// FIFO, or the UMP message it becomes in the UMP alternate setting. What the
+// FIFO has no room for waits in usb_in_pending.
+static void write_usb_in_packet(uint8_t cable, const uint8_t packet[4])
+{
+#if CFG_MIDI_UMP
+    if (midi_ump_driver_active()) {
+        // The trace keeps the packet, which tells more than the UMP words
+        midi_trace_record(MIDI_TRACE_USB_IN, packet);
+        uint32_t words[2];
+        uint8_t nwords = midi_ump_from_packet(packet, words);
+        for (uint8_t word = 0; word < nwords; word++) {
+            midi_ump_word_bytes(words[word], usb_in_pending[cable][usb_in_npending[cable]++]);
+        }
+    }
+    else
+#endif
+    memcpy(usb_in_pending[cable][usb_in_npending[cable]++], packet, 4);
+    write_usb_in_pending(cable);
+}
+
+// tud_midi_packet_write() starts a transfer right away if the IN endpoint is
+// idle. usb_in_hold() claims the endpoint so that the packets written until
+// usb_in_release() all go in the same transfer, and returns false if a
+// transfer is already running. The MIDI class driver has no public call for
+// this, so these rely on its write_flush() claiming the endpoint before it
+// starts a transfer and doing nothing when the claim fails. Checked against
+// tinyusb 0.15.0 and 0.16.0, as shipped with pico-sdk 1.5.1 and 2.0.0; check
+// again when updating tinyusb.
+static bool usb_in_hold(void)
+{
+    return usbd_edpt_claim(BOARD_TUD_RHPORT, 0x80 | EPNUM_MIDI_IN);
+}
+
+static void usb_in_release(void)
+{
+    usbd_edpt_release(BOARD_TUD_RHPORT, 0x80 | EPNUM_MIDI_IN);
+    tud_midi_stream_write(0, NULL, 0); // writes nothing, but starts the transfer
+}
+
+// Send the MIDI IN bytes waiting in the queues to the USB host when
+// usb_in_flush says so, or at once if a System Real-Time byte came in. Bytes
+// the USB transmit FIFO cannot take stay queued.
+static void flush_usb_in(bool connected)
+{
+    uint32_t nwaiting = 0;
+    for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_IN; cable++) {
+        midi_telemetry_high_water(&midi_telemetry.in[cable].high_water, midi_spsc_queue_count(&port_to_usb_queues[cable]));
+        uint32_t count = usb_in_count(cable);
+        if (!connected) {
+            // nowhere to send them
+            usb_in_consume(cable, count);
+            midi_profile_stream_out(&in_profile_streams[cable], count, 0, NULL);
+            midi_packetizer_init(&usb_in_packetizers[cable], cable);
+            midi_filter_state_init(&usb_in_filter_states[cable]);
+            usb_in_npending[cable] = 0;
+            midi_telemetry.in[cable].dropped += count;
+            count = 0;
+        }
+        // Bytes of unfinished packets count too, so that a message is
+        // overdue when its last byte arrives if its first byte waited long enough
+        nwaiting += count + usb_in_npending[cable] + midi_packetizer_count(&usb_in_packetizers[cable]);
+    }
+    bool realtime = usb_in_realtime;
+    usb_in_realtime = false;
+    if (!midi_flush_policy_check(&usb_in_flush, nwaiting, time_us_32()) && !(realtime && nwaiting > 0))
+        return;
+    // Hold the endpoint while writing every cable's packets so they all go in
+    // the same transfer
+    bool held = usb_in_hold();
+    nwaiting = 0;
+    uint8_t first_cable = usb_in_first_cable;
+    bool left_waiting = false;
+    for (uint8_t nth = 0; nth < MIDI_PORTS_NUM_IN; nth++) {
+        uint8_t cable = (uint8_t)((first_cable + nth) % MIDI_PORTS_NUM_IN);
+        const uint8_t* rx;
+        uint32_t nread;
+        while (write_usb_in_pending(cable) && (nread = usb_in_peek(cable, &rx)) > 0) {
+            // Stop at a byte that completes a packet the FIFO has no room for
+            uint32_t idx;
+            uint32_t nfiltered = 0;
+            for (idx = 0; idx < nread && usb_in_npending[cable] == 0; idx++) {
+                if (!midi_filter_byte(&in_filters[cable], &usb_in_filter_states[cable], rx[idx])) {
+                    nfiltered++;
+                    continue;
+                }
+                uint8_t packets[2][4];
+                uint8_t npackets = midi_packetizer_feed(&usb_in_packetizers[cable], rx[idx], packets);
+                for (uint8_t packet = 0; packet < npackets; packet++) {
+                    write_usb_in_packet(cable, packets[packet]);
+                }
+            }
+            usb_in_consume(cable, idx);
+            midi_profile_stream_out(&in_profile_streams[cable], idx, time_us_32(), &midi_profile.in_latency);
+            midi_telemetry.in[cable].bytes += idx - nfiltered;
+            midi_telemetry.in[cable].filtered += nfiltered;
+        }
+        // Once the FIFO is full, no other port gets anything in, so the first
+        // port left waiting is the only one that can be in the middle of a message
+        if (usb_in_npending[cable] != 0 && !left_waiting) {
+            usb_in_first_cable = cable;
+            left_waiting = true;
+        }
+        nwaiting += usb_in_count(cable) + usb_in_npending[cable] + midi_packetizer_count(&usb_in_packetizers[cable]);
+    }
+    if (held)
+        usb_in_release();
+    midi_flush_policy_sent(&usb_in_flush, nwaiting);
+}
+
+// Queue nbytes MIDI stream bytes for MIDI OUT port port, which must be
+// less than MIDI_PORTS_NUM_OUT. Return the number of bytes queued.
+static uint32_t queue_port_tx(uint8_t port, uint8_t const* bytes, uint32_t nbytes)
+{
+    uint32_t npushed = midi_out_port_write(&out_ports[port], bytes, nbytes);
+    // A System Real-Time byte that overtakes others in the port's queue
+    // moves the marks by a byte at most
+    midi_profile_stream_in(&out_profile_streams[port], npushed, usb_rx_running, time_us_32());
+#if !CFG_MIDI_DUAL_CORE
+    if (npushed > 0) {
+        port_tx_active |= 1u << port;
+        midi_sched_post(&sched, port_tx_task_id);
+    }
+#endif
+    return npushed;
+}
+
+#if OUT_TIMER
+static int64_t out_alarm_cb(alarm_id_t id, void* user_data)
+{
+    (void)id;
+    (void)user_data;
+    out_alarm = 0;
+    midi_sched_post(&sched, out_timer_task_id);
+    return 0;
+}
+
+// Set the alarm for the next clock tick that a MIDI OUT port holds back or
+// the next timed message
+static void arm_out_alarm(void)
+{
+    bool waiting = false;
+    uint32_t next_us = 0;
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+        uint32_t due_us;
+        if ((CFG_MIDI_CLOCK_REGEN_PORTS & (1u << port)) && midi_clock_regen_next(&clock_regens[port], &due_us) &&
+            (!waiting || (int32_t)(due_us - next_us) < 0)) {
+            next_us = due_us;
+            waiting = true;
+        }
+#endif
+#if CFG_MIDI_TIMED_OUT
+        const midi_timed_event_t* event = midi_timed_queue_peek(&timed_queues[port]);
+        if (event != NULL && (!waiting || (int32_t)(event->due_us - next_us) < 0)) {
+            next_us = event->due_us;
+            waiting = true;
+        }
+#endif
+    }
+    if (!waiting || (out_alarm != 0 && out_alarm_us == next_us))
+        return;
+    if (out_alarm != 0)
+        cancel_alarm(out_alarm);
+    out_alarm_us = next_us;
+    int32_t delay_us = (int32_t)(next_us - time_us_32());
+    alarm_id_t alarm = add_alarm_at(from_us_since_boot(time_us_64() + (delay_us > 0 ? (uint64_t)delay_us : 0)),
+                                    out_alarm_cb, NULL, true);
+    if (alarm < 0)
+        midi_sched_post(&sched, out_timer_task_id); // no alarm free, so check on the next pass
+    out_alarm = alarm > 0 ? alarm : 0;
+}
+#endif
+
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+
+// Queue the oldest nticks clock ticks that MIDI OUT port cable_num holds
+// back. Return true if the port took them all.
+static bool send_clock_ticks(uint8_t cable_num, uint32_t nticks)
+{
+    static const uint8_t clock = 0xF8;
+    uint32_t nsent = 0;
+    while (nsent < nticks && queue_port_tx(cable_num, &clock, 1) == 1)
+        nsent++;
+    midi_clock_regen_sent(&clock_regens[cable_num], nsent);
+    return nsent == nticks;
+}
+
+// Queue MIDI stream bytes for MIDI OUT port cable_num, which regenerates the
+// MIDI Clock: hand the clock ticks to its regenerator, and send the ticks it
+// holds back before a Start, Stop or Continue. Return the number of bytes
+// queued or handed over.
+static uint32_t write_port_tx_clock_regen(uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    midi_clock_regen_t* regen = &clock_regens[cable_num];
+    uint32_t nwritten = 0;
+    while (nwritten < nbytes) {
+        uint32_t end = nwritten;
+        while (end < nbytes && bytes[end] != 0xF8 && (bytes[end] < 0xFA || bytes[end] > 0xFC))
+            end++;
+        if (end > nwritten) {
+            uint32_t npushed = queue_port_tx(cable_num, &bytes[nwritten], end - nwritten);
+            nwritten += npushed;
+            if (nwritten != end)
+                break;
+            continue;
+        }
+        if (bytes[nwritten] == 0xF8) {
+            if (!midi_clock_regen_tick(regen, time_us_32()) && queue_port_tx(cable_num, &bytes[nwritten], 1) != 1)
+                break;
+        }
+        else if (!send_clock_ticks(cable_num, midi_clock_regen_pending(regen)) ||
+                 queue_port_tx(cable_num, &bytes[nwritten], 1) != 1) {
+            break;
+        }
+        nwritten++;
+    }
+    arm_out_alarm();
+    return nwritten;
+}
+#endif
+
+// Queue nbytes MIDI stream bytes for MIDI OUT port cable_num, with its MIDI
+// Clock regenerated if the port does that. Return the number of bytes queued.
+static uint32_t write_port_tx(uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+    if (CFG_MIDI_CLOCK_REGEN_PORTS & (1u << cable_num))
+        return write_port_tx_clock_regen(cable_num, bytes, nbytes);
+#endif
+    return queue_port_tx(cable_num, bytes, nbytes);
+}
+
+#if CFG_MIDI_RUNNING_STATUS_PORTS
+// Write the MIDI stream bytes to the port with running status. Return the
+// number of bytes from bytes that the port took.
+static uint32_t write_port_tx_running_status(uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    uint8_t encoded[48];
+    uint32_t nconsumed = 0;
+    while (nconsumed < nbytes) {
+        uint32_t nin = tu_min32(nbytes - nconsumed, sizeof(encoded));
+        midi_running_status_t before = port_running_status[cable_num];
+        uint32_t nout = midi_running_status_encode(&port_running_status[cable_num], bytes + nconsumed, nin, encoded);
+        uint32_t nwritten = write_port_tx(cable_num, encoded, nout);
+        if (nwritten != nout) {
+            // The encoding is not one byte for one, so count the bytes that
+            // made up the ones the port took, and encode the rest again next
+            // time with the running status the port has sent
+            port_running_status[cable_num] = before;
+            return nconsumed + midi_running_status_skip(&port_running_status[cable_num], bytes + nconsumed, nin, nwritten);
+        }
+        nconsumed += nin;
+    }
+    return nbytes;
+}
+#endif
+
+// Queue MIDI stream bytes for the MIDI OUT port for virtual cable cable_num,
+// with running status if the port uses it. Return the number of bytes queued.
+static uint32_t write_port_stream(uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+#if CFG_MIDI_RUNNING_STATUS_PORTS
+    if (CFG_MIDI_RUNNING_STATUS_PORTS & (1u << cable_num))
+        return write_port_tx_running_status(cable_num, bytes, nbytes);
+#endif
+    return write_port_tx(cable_num, bytes, nbytes);
+}
+
+// Queue whole MIDI messages from source for MIDI OUT port cable_num, which
+// merges more than one source. A message goes out whole or not at all, so
+// the sources never interleave inside one, except that a System Exclusive
+// message may go out in pieces; the other sources wait until it ends. Return
+// the number of bytes queued.
+static uint32_t write_port_tx_merged(uint8_t cable_num, uint8_t source, uint8_t const* bytes, uint32_t nbytes)
+{
+    uint32_t nwritten = 0;
+    while (nwritten < nbytes) {
+        // The next message runs up to the next status byte that is not System Real-Time
+        uint8_t status = bytes[nwritten];
+        uint32_t end = nwritten + 1;
+        uint8_t owner = sysex_owners[cable_num];
+        if (status >= 0xF8) {
+            // System Real-Time may go out between any two bytes
+        }
+        else if (owner != SOURCE_NONE && owner != source) {
+            break;
+        }
+        else {
+            while (end < nbytes && (bytes[end] < 0x80 || bytes[end] >= 0xF8))
+                end++;
+        }
+        uint32_t nmsg = end - nwritten;
+        uint32_t npushed;
+        if (status == 0xF0 || (status < 0x80 && owner == source))
+            npushed = write_port_stream(cable_num, &bytes[nwritten], nmsg);
+        else if (midi_out_port_can_write(&out_ports[cable_num], &bytes[nwritten], nmsg))
+            npushed = write_port_stream(cable_num, &bytes[nwritten], nmsg);
+        else
+            npushed = 0;
+        if (npushed > 0 && status >= 0x80 && status < 0xF8)
+            sysex_owners[cable_num] = status == 0xF0 ? source : SOURCE_NONE;
+        nwritten += npushed;
+        if (npushed != nmsg)
+            break;
+    }
+    return nwritten;
+}
+
+// Work out which MIDI OUT ports merge more than one source and compile the
+// filters, after the routing table changed
+static void apply_routes(void)
+{
+    uint32_t routed = 0;
+    uint32_t merged = 0;
+    for (uint8_t cable = 0; cable < MIDI_ROUTE_MAX_CABLES; cable++) {
+        uint8_t port = midi_route_table.cable_ports[cable];
+        if (cable != MIDI_CONFIG_CABLE && port < MIDI_PORTS_NUM_OUT) {
+            merged |= routed & (1u << port);
+            routed |= 1u << port;
+        }
+    }
+    for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_IN; cable++) {
+        uint16_t ports = midi_route_table.thru_ports[cable];
+        merged |= routed & ports;
+        routed |= ports;
+        // Do not send a message to a port no longer on the route
+        thru_msg_targets[cable] &= ports;
+        if (ports == 0)
+            midi_msg_parser_init(&thru_parsers[cable]);
+    }
+    merged_ports = merged;
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+        midi_filter_init(&out_filters[port], midi_route_table.out_filters[port]);
+    }
+#if CFG_MIDI_DUAL_CORE
+    // Wait until core 1 has copied the last change
+    unsigned version = atomic_load_explicit(&in_filters_version, memory_order_relaxed);
+    while (atomic_load_explicit(&in_filters_copied, memory_order_acquire) != version)
+        tight_loop_contents();
+#endif
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+        midi_filter_init(&in_filters[port], midi_route_table.in_filters[port]);
+    }
+#if CFG_MIDI_DUAL_CORE
+    atomic_store_explicit(&in_filters_version, version + 1, memory_order_release);
+#endif
+    // A System Exclusive message the change cut off would hold up its port for good
+    memset(sysex_owners, SOURCE_NONE, sizeof(sysex_owners));
+}
+
+// Apply the routing table commands from the host
+static void write_config(uint8_t const* bytes, uint32_t nbytes)
+{
+    switch (midi_route_config_write(&route_config, &midi_route_table, bytes, nbytes)) {
+        case MIDI_ROUTE_CONFIG_SAVE:
+            // The same writes may also have changed the routes
+            route_save_pending = true;
+            // fall through
+        case MIDI_ROUTE_CONFIG_CHANGED:
+            apply_routes();
+            break;
+        default:
+            break;
+    }
+}
+
+// Queue MIDI stream bytes from virtual cable cable_num for MIDI OUT port
+// port. Return the number of bytes queued.
+static uint32_t write_cable_port(uint8_t port, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    uint32_t npushed;
+    if (merged_ports & (1u << port))
+        npushed = write_port_tx_merged(port, SOURCE_CABLE(cable_num), bytes, nbytes);
+    else
+        npushed = write_port_stream(port, bytes, nbytes);
+    midi_telemetry.out[cable_num].bytes += npushed;
+    // The telemetry counts by virtual cable, so the cable gets the mark of the
+    // queue of the port it goes to
+    midi_telemetry_high_water(&midi_telemetry.out[cable_num].high_water, midi_block_queue_count(&out_ports[port].bulk));
+    return npushed;
+}
+
+// Like write_cable_port(), but leave out the bytes that the port's filter
+// drops. Return the number of bytes of bytes that were queued or dropped.
+static uint32_t write_cable_port_filtered(uint8_t port, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    const midi_filter_t* filter = &out_filters[port];
+    midi_filter_state_t* state = &usb_rx_filter_states[cable_num];
+    uint8_t passed[48];
+    uint32_t nconsumed = 0;
+    while (nconsumed < nbytes) {
+        uint32_t nin = tu_min32(nbytes - nconsumed, sizeof(passed));
+        midi_filter_state_t before = *state;
+        uint32_t npassed = midi_filter_copy(filter, state, &bytes[nconsumed], nin, passed);
+        uint32_t nwritten = npassed > 0 ? write_cable_port(port, cable_num, passed, npassed) : 0;
+        if (nwritten != npassed) {
+            // Filter the bytes after the last one the port took again next time
+            *state = before;
+            nin = midi_filter_skip(filter, state, &bytes[nconsumed], nin, nwritten);
+            midi_telemetry.out[cable_num].filtered += nin - nwritten;
+            return nconsumed + nin;
+        }
+        midi_telemetry.out[cable_num].filtered += nin - npassed;
+        nconsumed += nin;
+    }
+    return nbytes;
+}
+
+// Queue MIDI stream bytes from virtual cable cable_num for MIDI OUT port
+// port, through the port's filter. Return the number of bytes queued or dropped.
+static uint32_t write_cable_out(uint8_t port, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    if (out_filters[port].pass_all)
+        return write_cable_port(port, cable_num, bytes, nbytes);
+    return write_cable_port_filtered(port, cable_num, bytes, nbytes);
+}
+
+#if CFG_MIDI_TIMED_OUT
+#if CFG_MIDI_UMP
+// Take the host time from a JR Clock message that the UMP reader found
+static void sync_ump_clock(void)
+{
+    if (usb_rx_ump.clock_received) {
+        usb_rx_ump.clock_received = false;
+        midi_timed_clock_sync(&timed_clock, usb_rx_ump.clock, time_us_32());
+    }
+}
+#endif
+
+// Queue the timed message in bytes from virtual cable cable_num to go out on
+// MIDI OUT port port at its time, unless the port's filter drops it. Return
+// false if the port has no room for another timed message.
+static bool queue_timed(uint8_t port, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    if (!midi_filter_byte(&out_filters[port], &usb_rx_filter_states[cable_num], bytes[0])) {
+        midi_telemetry.out[cable_num].filtered += nbytes;
+        return true;
+    }
+    uint32_t due_us = midi_timed_clock_deadline(&timed_clock, timed_rx[cable_num].timestamp, time_us_32());
+    if (!midi_timed_queue_push(&timed_queues[port], due_us, cable_num, bytes, (uint8_t)nbytes))
+        return false;
+    arm_out_alarm();
+    return true;
+}
+
+// Write MIDI stream bytes from virtual cable cable_num to MIDI OUT port port,
+// holding the timed messages back until their time and taking out the
+// envelopes. Return the number of bytes queued or dropped.
+static uint32_t write_cable_timed(uint8_t port, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    midi_timed_rx_t* rx = &timed_rx[cable_num];
+    uint32_t nwritten = 0;
+    while (nwritten < nbytes) {
+#if CFG_MIDI_UMP
+        // Every message a UMP message with a JR Timestamp became has the timestamp
+        if (midi_ump_driver_active() && usb_rx_ump.timestamped) {
+            rx->timestamped = true;
+            rx->timestamp = usb_rx_ump.timestamp;
+        }
+#endif
+        midi_timed_rx_kind_t kind;
+        uint32_t len = midi_timed_rx_next(rx, &bytes[nwritten], nbytes - nwritten, &kind);
+        uint32_t nsent = len;
+        switch (kind) {
+            case MIDI_TIMED_RX_NOW:
+                nsent = write_cable_out(port, cable_num, &bytes[nwritten], len);
+                midi_timed_rx_sent(rx, &bytes[nwritten], nsent, kind);
+                break;
+            case MIDI_TIMED_RX_TIMED:
+                if (queue_timed(port, cable_num, &bytes[nwritten], len))
+                    midi_timed_rx_sent(rx, &bytes[nwritten], len, kind);
+                else
+                    nsent = 0;
+                break;
+            case MIDI_TIMED_RX_CLOCK:
+                midi_timed_clock_sync(&timed_clock, rx->clock, time_us_32());
+                break;
+            default:
+                break; // the rest of an envelope
+        }
+        nwritten += nsent;
+        if (nsent != len)
+            break;
+    }
+    return nwritten;
+}
+
+// Write the timed messages that are due at now to their MIDI OUT ports.
+// Return true if a port could not take one yet.
+static bool send_timed(uint32_t now)
+{
+    bool waiting = false;
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+        const midi_timed_event_t* event;
+        while ((event = midi_timed_queue_peek(&timed_queues[port])) != NULL && (int32_t)(now - event->due_us) >= 0) {
+            // It waits for a System Exclusive message from its own virtual
+            // cable to end, and goes out whole or not at all
+            if (timed_rx[event->cable_num].in_sysex ||
+                !midi_out_port_can_write(&out_ports[port], event->bytes, event->nbytes) ||
+                write_cable_port(port, event->cable_num, event->bytes, event->nbytes) != event->nbytes) {
+                waiting = true;
+                break;
             }
+            midi_timed_queue_pop(&timed_queues[port]);
         }
     }
-    
+    return waiting;
 }
+#endif
 
-static void poll_usb_rx(bool connected)
+// Write MIDI stream bytes from the USB host to the MIDI OUT port for virtual
+// cable cable_num. If context points to a deadline that has passed, take
+// nothing and set usb_rx_late, so the dispatcher keeps the bytes for the next
+// pass. The first message of a pass always goes, so every pass makes progress.
+static uint32_t write_cable_tx(void* context, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes)
+{
+    const uint32_t* deadline_us = context;
+    if (deadline_us != NULL && usb_rx_dispatched && midi_sched_deadline_passed(&sched, *deadline_us)) {
+        usb_rx_late = true;
+        return 0;
+    }
+    usb_rx_dispatched = true;
+#if CFG_MIDI_TIMED_OUT && CFG_MIDI_UMP
+    sync_ump_clock();
+#endif
+    if (cable_num == MIDI_CONFIG_CABLE) {
+        write_config(bytes, nbytes);
+        midi_telemetry.out[cable_num].bytes += nbytes;
+        return nbytes;
+    }
+    uint8_t port = midi_route_table.cable_ports[cable_num];
+    if (port >= MIDI_PORTS_NUM_OUT) {
+        TU_LOG1("Received a MIDI packet on cable %u", cable_num);
+        midi_telemetry.out[cable_num].dropped += nbytes;
+        return nbytes; // nowhere to send it, so throw it away
+    }
+#if CFG_MIDI_TIMED_OUT
+    uint32_t npushed = write_cable_timed(port, cable_num, bytes, nbytes);
+#else
+    uint32_t npushed = write_cable_out(port, cable_num, bytes, nbytes);
+#endif
+#if CFG_MIDI_USB_RX_FLOW_CONTROL
+    if (npushed != nbytes) {
+        // The caller keeps the rest and stops reading the USB receive FIFO
+        usb_rx_stalled = true;
+    }
+    return npushed;
+#else
+    if (npushed != nbytes) {
+        midi_telemetry.out[cable_num].dropped += nbytes - npushed;
+        TU_LOG1("Warning: Dropped %lu bytes sending to MIDI Out Port %c\r\n", nbytes - npushed, 'A' + port);
+    }
+    return nbytes;
+#endif
+}
+
+static void poll_usb_rx(bool connected, uint32_t deadline_us)
 {
     // device must be attached and have the endpoint ready to receive a message
     if (!connected)
     {
         return;
     }
-    uint8_t rx[48];
-    uint8_t cable_num;
-    uint8_t npushed = 0;
-    uint32_t nread =  tud_midi_demux_stream_read(&cable_num, rx, sizeof(rx));
-    while (nread > 0) {
-        if (cable_num < 2) {
-            // then it is MIDI OUT A or B
-            npushed = pio_midi_uart_write_tx_buffer(midi_uarts[cable_num], rx, nread);
-        }
-        else if (cable_num < 6) {
-            // then it is MIDI OUT C, D, E or F
-            npushed = pio_midi_out_write_tx_buffer(midi_outs[cable_num-2], rx, nread);
+    usb_rx_stalled = false;
+    usb_rx_late = false;
+    usb_rx_dispatched = false;
+    midi_telemetry_high_water(&midi_telemetry.usb_out_fifo_high_water, tud_midi_n_available(0, 0));
+#if CFG_MIDI_UMP
+    if (midi_ump_driver_active()) {
+        // Each UMP message is translated on its own, so there is nothing to
+        // batch. The telemetry counts UMP words as packets.
+        midi_ump_dispatch(&usb_rx_ump, write_cable_tx, &deadline_us);
+#if CFG_MIDI_TIMED_OUT
+        sync_ump_clock();
+#endif
+        midi_telemetry.usb_out_packets += usb_rx_ump.words_read;
+        usb_rx_ump.words_read = 0;
+        if (usb_rx_stalled)
+            midi_telemetry.usb_out_stalls++;
+        else if (usb_rx_late)
+            midi_sched_post(&sched, usb_rx_task_id); // finish the rest next time
+        return;
+    }
+#endif
+#if CFG_MIDI_USB_RX_ZERO_COPY
+    midi_demux_dispatch(&usb_rx_demux, write_cable_tx, &deadline_us);
+#else
+    // Write each run of bytes for one cable to its port, in the order received.
+    // With flow control, bytes the port cannot take wait in usb_rx_buf for the
+    // next call.
+    while (!usb_rx_stalled) {
+        if (usb_rx_nbytes == 0) {
+            if (midi_sched_deadline_passed(&sched, deadline_us)) {
+                // Finish the rest next time
+                midi_sched_post(&sched, usb_rx_task_id);
+                break;
+            }
+            usb_rx_next = usb_rx_buf;
+            usb_rx_nbytes = midi_demux_stream_read(&usb_rx_demux, &usb_rx_cable, usb_rx_buf, sizeof(usb_rx_buf));
+            if (usb_rx_nbytes == 0)
+                break;
         }
-        else {
-            TU_LOG1("Received a MIDI packet on cable %u", cable_num);
-            npushed = 0;
+        uint32_t nwritten = write_cable_tx(NULL, usb_rx_cable, usb_rx_next, usb_rx_nbytes);
+        usb_rx_next += nwritten;
+        usb_rx_nbytes -= nwritten;
+    }
+#endif
+    midi_telemetry.usb_out_packets += usb_rx_demux.packets_read;
+    usb_rx_demux.packets_read = 0;
+    if (usb_rx_stalled)
+        midi_telemetry.usb_out_stalls++;
+    else if (usb_rx_late)
+        midi_sched_post(&sched, usb_rx_task_id); // finish the rest next time
+}
+
+// Send the messages from the MIDI IN ports to the MIDI OUT ports their thru
+// routes go to. This runs on core 0, which writes all the MIDI OUT queues.
+static void route_thru(void)
+{
+    for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_IN; cable++) {
+        if (midi_route_table.thru_ports[cable] == 0)
             continue;
+        midi_msg_t* msg = &thru_msgs[cable];
+        while (1) {
+            uint16_t targets = thru_msg_targets[cable];
+            // The parser passes System Exclusive data bytes on one at a time
+            uint8_t status = msg->bytes[0] < 0x80 ? 0xF0 : msg->bytes[0];
+            for (uint8_t out = 0; targets != 0 && out < MIDI_PORTS_NUM_OUT; out++) {
+                if ((targets & (1u << out)) &&
+                    (!midi_filter_passes(&out_filters[out], status) ||
+                     write_port_tx_merged(out, SOURCE_MIDI_IN(cable), msg->bytes, msg->nbytes) == msg->nbytes))
+                    targets &= ~(1u << out);
+            }
+            thru_msg_targets[cable] = targets;
+            if (targets != 0)
+                break; // try the ports that are busy again on the next tick
+            const uint8_t* rx;
+            uint32_t nread = midi_spsc_queue_peek_at(&port_to_usb_queues[cable], thru_offsets[cable], &rx);
+            if (nread == 0)
+                break;
+            uint32_t nparsed = 0;
+            while (nparsed < nread && thru_msg_targets[cable] == 0) {
+                if (midi_msg_parser_parse(&thru_parsers[cable], rx[nparsed], msg))
+                    nparsed++;
+                if (msg->nbytes > 0)
+                    thru_msg_targets[cable] = midi_route_table.thru_ports[cable];
+            }
+            thru_offsets[cable] += nparsed;
+            release_port_rx(cable);
         }
-        if (npushed != nread) {
-            TU_LOG1("Warning: Dropped %lu bytes sending to MIDI Out Port %c\r\n", nread - npushed, 'A' + cable_num);
-        }
-        nread =  tud_midi_demux_stream_read(&cable_num, rx, sizeof(rx));
     }
 }
 
-static void drain_serial_port_tx_buffers()
+//--------------------------------------------------------------------+
+// Scheduler tasks
+//--------------------------------------------------------------------+
+static bool usb_task(void* context, uint32_t deadline_us)
+{
+    (void)context;
+    (void)deadline_us;
+    tud_task(); // tinyusb device task
+    return false;
+}
+
+static bool usb_rx_task(void* context, uint32_t deadline_us)
 {
-    uint8_t cable;
-    for (cable = 0; cable < 2; cable++) {
-        pio_midi_uart_drain_tx_buffer(midi_uarts[cable]);
+    (void)context;
+#if CFG_MIDI_PROFILE
+    usb_rx_running = true;
+#endif
+    poll_usb_rx(tud_midi_mounted(), deadline_us);
+#if CFG_MIDI_PROFILE
+    usb_rx_running = false;
+#endif
+    return false;
+}
+
+#if CFG_MIDI_REMOTE_WAKEUP
+// Wake the host for the MIDI IN bytes that arrived while the bus was
+// suspended. They go to the host once it resumes the bus.
+static void wake_usb_host(void)
+{
+    usb_wakeup_pending = false;
+    if (!usb_can_wake_host)
+        return; // the host resumed the bus meanwhile
+    usb_can_wake_host = false;
+#if CFG_MIDI_SUSPEND_CLOCK_DOWN
+    // Now rather than in tud_resume_cb(), so the PLL has started before the bus resumes
+    set_sys_clock(full_clock_hz);
+#endif
+    tud_remote_wakeup();
+}
+#endif
+
+static bool port_rx_task(void* context, uint32_t deadline_us)
+{
+    (void)context;
+    (void)deadline_us;
+#if !CFG_MIDI_DUAL_CORE
+    poll_midi_ports_rx();
+#endif
+#if CFG_MIDI_REMOTE_WAKEUP
+    if (usb_wakeup_pending)
+        wake_usb_host();
+#endif
+    route_thru();
+    flush_usb_in(tud_midi_mounted());
+    return false;
+}
+
+// Move bytes from the queues of the MIDI OUT ports with bits set in active to
+// the ports and drain the ports' transmit buffers. Return the bits of the
+// ports that still have bytes queued or sending, including bytes left in a
+// transmit buffer only these calls drain (see midi_ports_drain_tx()). If
+// deadline_us is not NULL, stop at the next port once it passes and set
+// *skipped to the bits of the ports not serviced; they count as still active.
+static uint32_t service_port_tx(uint32_t active, const uint32_t* deadline_us, uint32_t* skipped)
+{
+    uint32_t still_active = 0;
+    uint32_t now = time_us_32();
+    uint32_t ports;
+    for (ports = active; ports != 0; ports &= ports - 1) {
+        if (deadline_us != NULL && ports != active && midi_sched_deadline_passed(&sched, *deadline_us))
+            break;
+        uint8_t port = (uint8_t)__builtin_ctz(ports);
+        if (midi_out_port_service(&out_ports[port], now))
+            still_active |= 1u << port;
     }
-    for (cable = 2; cable < 6; cable++) {
-        pio_midi_out_drain_tx_buffer(midi_outs[cable-2]);
+    still_active |= midi_ports_drain_tx(active & ~ports);
+    if (skipped != NULL)
+        *skipped = ports;
+    return still_active | ports;
+}
+
+#if OUT_TIMER
+// Queue the regenerated clock ticks and the timed messages that are due on
+// the MIDI OUT ports
+static bool out_timer_task(void* context, uint32_t deadline_us)
+{
+    (void)context;
+    (void)deadline_us;
+    uint32_t now = time_us_32();
+    bool more = false;
+#if CFG_MIDI_CLOCK_REGEN_PORTS
+    for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+        if (CFG_MIDI_CLOCK_REGEN_PORTS & (1u << port))
+            more |= !send_clock_ticks(port, midi_clock_regen_due(&clock_regens[port], now));
     }
+#endif
+#if CFG_MIDI_TIMED_OUT
+    more |= send_timed(now);
+#endif
+    arm_out_alarm();
+    // Try the ports that could not take everything again on the next pass
+    return more;
 }
-static void midi_task(void)
+#endif
+
+#if !CFG_MIDI_DUAL_CORE
+static bool port_tx_task(void* context, uint32_t deadline_us)
 {
-    bool connected = tud_midi_mounted();
-    poll_midi_uarts_rx(connected);
-    poll_usb_rx(connected);
-    drain_serial_port_tx_buffers();
+    (void)context;
+    // The timer tick keeps posting this task while any port is active. The
+    // ports the last pass ran out of time for go first.
+    uint32_t active = port_tx_skipped != 0 ? port_tx_skipped : port_tx_active;
+    uint32_t still_active = service_port_tx(active, &deadline_us, &port_tx_skipped);
+    port_tx_active = (port_tx_active & ~active) | still_active;
+    return port_tx_skipped != 0;
+}
+#endif
+
+// Save the routing table to flash once every MIDI OUT queue is empty. Saving
+// stops all MIDI traffic for a while, so this is the least harmful time.
+static bool config_task(void* context, uint32_t deadline_us)
+{
+    (void)context;
+    (void)deadline_us;
+    for (uint8_t cable = 0; cable < MIDI_PORTS_NUM_OUT; cable++) {
+        if (midi_block_queue_count(&out_ports[cable].bulk) != 0 ||
+            midi_spsc_queue_count(&out_ports[cable].realtime) != 0)
+            return false; // the timer tick tries again
+    }
+    midi_route_flash_save(&midi_route_table);
+    route_save_pending = false;
+    return false;
+}
+
+static bool led_task(void* context, uint32_t deadline_us)
+{
+    (void)context;
+    (void)deadline_us;
+    led_blinking_task();
+    return false;
+}
+
+// Runs in the timer interrupt once per CFG_MIDI_SCHED_TICK_US. The MIDI port
+// library owns the PIO interrupts, so the ports are serviced on this tick. A
+// byte received on any MIDI IN port waits at most one tick, however many ports
+// there are.
+static bool sched_tick_cb(repeating_timer_t* timer)
+{
+    (void)timer;
+    midi_sched_post(&sched, port_rx_task_id);
+    if (usb_rx_stalled)
+        midi_sched_post(&sched, usb_rx_task_id);
+#if !CFG_MIDI_DUAL_CORE
+    if (port_tx_active)
+        midi_sched_post(&sched, port_tx_task_id);
+#endif
+    if (route_save_pending)
+        midi_sched_post(&sched, config_task_id);
+    midi_sched_post(&sched, led_task_id);
+    return true;
+}
+
+#if CFG_MIDI_PROFILE
+// With CFG_MIDI_PROFILE each task runs through run_profiled_task(), which
+// counts the CPU cycles it takes
+typedef struct {
+    midi_sched_task_fn fn;
+    uint8_t profile_id;
+} profiled_task_t;
+static profiled_task_t profiled_tasks[MIDI_SCHED_MAX_TASKS];
+
+static bool run_profiled_task(void* context, uint32_t deadline_us)
+{
+    const profiled_task_t* task = (const profiled_task_t*)context;
+    uint32_t start = midi_profile_cycles();
+    bool more = task->fn(NULL, deadline_us);
+    midi_profile_task_cycles(task->profile_id, start);
+    return more;
+}
+#endif
+
+// Add the task fn, called name in the profile, to sched. Return its task ID.
+static uint8_t add_task(midi_sched_task_fn fn, const char* name)
+{
+#if CFG_MIDI_PROFILE
+    profiled_task_t* task = &profiled_tasks[sched.ntasks];
+    task->fn = fn;
+    task->profile_id = midi_profile_add_task(name);
+    return midi_sched_add_task(&sched, run_profiled_task, task, CFG_MIDI_SCHED_BUDGET_US);
+#else
+    (void)name;
+    return midi_sched_add_task(&sched, fn, NULL, CFG_MIDI_SCHED_BUDGET_US);
+#endif
+}
+
+static void start_sched(void)
+{
+    midi_sched_init(&sched, time_us_32);
+    // Tasks added first run first
+    usb_task_id = add_task(usb_task, "usb");
+    usb_rx_task_id = add_task(usb_rx_task, "usb_rx");
+    port_rx_task_id = add_task(port_rx_task, "port_rx");
+#if OUT_TIMER
+    // Before port_tx_task, so what is due goes out on the same pass
+    out_timer_task_id = add_task(out_timer_task, "timer");
+#endif
+#if !CFG_MIDI_DUAL_CORE
+    // In dual core mode core 1 drains the ports
+    port_tx_task_id = add_task(port_tx_task, "port_tx");
+#endif
+    config_task_id = add_task(config_task, "config");
+    led_task_id = add_task(led_task, "led");
+    // Run everything once in case anything happened before the timer started
+    for (uint8_t task_id = 0; task_id < sched.ntasks; task_id++) {
+        midi_sched_post(&sched, task_id);
+    }
+    add_repeating_timer_us(-(int64_t)CFG_MIDI_SCHED_TICK_US, sched_tick_cb, NULL, &sched_timer);
+}
+
+#if CFG_MIDI_DUAL_CORE
+//--------------------------------------------------------------------+
+// Core 1 MIDI port task
+//--------------------------------------------------------------------+
+// Take a copy of in_filters once apply_routes() has changed them
+static void copy_in_filters(void)
+{
+    unsigned version = atomic_load_explicit(&in_filters_version, memory_order_acquire);
+    if (version == atomic_load_explicit(&in_filters_copied, memory_order_relaxed))
+        return;
+    memcpy(core1_in_filters, in_filters, sizeof(core1_in_filters));
+    atomic_store_explicit(&in_filters_copied, version, memory_order_release);
+}
+
+static void core1_main(void)
+{
+    // Let core 0 pause this core while it writes the flash
+    multicore_lockout_victim_init();
+    create_midi_ports();
+    midi_profile_start_cycles();
+    multicore_fifo_push_blocking(1); // tell core 0 the ports exist
+    while (1) {
+#if CFG_MIDI_PROFILE
+        uint32_t start = midi_profile_cycles();
+#endif
+        // Move MIDI IN bytes to core 0
+        copy_in_filters();
+        poll_midi_ports_rx();
+        // Send the bytes core 0 queued for the MIDI OUT ports. Core 1 does
+        // nothing else, so it checks every port.
+        service_port_tx((1u << MIDI_PORTS_NUM_OUT) - 1, NULL, NULL);
+#if CFG_MIDI_PROFILE
+        midi_profile_task_cycles(core1_profile_id, start);
+#endif
+    }
 }
+#endif
 
 //--------------------------------------------------------------------+
 // BLINKING TASK
@@ -0,0 +1,175 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "midi_block_pool.h"
+
+void midi_block_pool_init(midi_block_pool_t* pool, uint8_t* buf, uint32_t block_size, uint32_t nblocks,
+                          uint8_t* lists, uint32_t reserve)
+{
+  pool->buf = buf;
+  pool->block_size = block_size;
+  for (pool->block_shift = 0; (1u << pool->block_shift) < block_size; pool->block_shift++) {
+  }
+  pool->nblocks = nblocks;
+  pool->reserve = reserve;
+  pool->next = lists;
+  pool->free = lists + nblocks;
+  for (uint32_t block = 0; block < nblocks; block++) {
+    pool->free[block] = (uint8_t)block;
+  }
+  atomic_init(&pool->free_head, nblocks);
+  atomic_init(&pool->free_tail, 0);
+  pool->nqueues = 0;
+}
+
+// The number of blocks a queue from head to tail holds
+static uint32_t queue_blocks(const midi_block_pool_t* pool, uint32_t head, uint32_t tail)
+{
+  // One more than the blocks started at byte tail or later
+  return 1 + ((((head - 1) >> pool->block_shift) - ((tail - 1) >> pool->block_shift)) &
+              (UINT32_MAX >> pool->block_shift));
+}
+
+// Producer only: return the number of blocks queue may take from pool
+static uint32_t spare_blocks(const midi_block_pool_t* pool, const midi_block_queue_t* queue)
+{
+  // Read the free blocks before the tails. A consumer publishes its new tail
+  // before it gives the finished block back, so a block the ring shows as
+  // free no longer looks held. One that has just been given back may look
+  // neither held nor free, which makes the count low, and that is safe.
+  uint32_t head = atomic_load_explicit(&pool->free_head, memory_order_acquire);
+  uint32_t tail = atomic_load_explicit(&pool->free_tail, memory_order_relaxed);
+  uint32_t nfree = head >= tail ? head - tail : head + 2 * pool->nblocks - tail;
+  uint32_t shortfall = 0;
+  for (uint32_t idx = 0; idx < pool->nqueues; idx++) {
+    midi_block_queue_t* other = pool->queues[idx];
+    if (other == queue)
+      continue;
+    uint32_t held = queue_blocks(pool, atomic_load_explicit(&other->head, memory_order_relaxed),
+                                 atomic_load_explicit(&other->tail, memory_order_acquire));
+    if (held < pool->reserve)
+      shortfall += pool->reserve - held;
+  }
+  return nfree > shortfall ? nfree - shortfall : 0;
+}
+
+// Producer only: take the oldest free block from pool
+static uint8_t take_block(midi_block_pool_t* pool)
+{
+  uint32_t tail = atomic_load_explicit(&pool->free_tail, memory_order_relaxed);
+  uint8_t block = pool->free[tail < pool->nblocks ? tail : tail - pool->nblocks];
+  atomic_store_explicit(&pool->free_tail, tail + 1 == 2 * pool->nblocks ? 0 : tail + 1, memory_order_release);
+  return block;
+}
+
+// Consumer only: give block back to pool
+static void give_block(midi_block_pool_t* pool, uint8_t block)
+{
+  uint32_t head = atomic_load_explicit(&pool->free_head, memory_order_relaxed);
+  pool->free[head < pool->nblocks ? head : head - pool->nblocks] = block;
+  atomic_store_explicit(&pool->free_head, head + 1 == 2 * pool->nblocks ? 0 : head + 1, memory_order_release);
+}
+
+void midi_block_queue_init(midi_block_queue_t* queue, midi_block_pool_t* pool)
+{
+  queue->pool = pool;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+  // The queue starts with a block it has finished with
+  queue->head_block = queue->tail_block = take_block(pool);
+  pool->queues[pool->nqueues++] = queue;
+}
+
+uint32_t midi_block_queue_space(midi_block_queue_t* queue)
+{
+  midi_block_pool_t* pool = queue->pool;
+  uint32_t offset = atomic_load_explicit(&queue->head, memory_order_relaxed) & (pool->block_size - 1);
+  return (offset ? pool->block_size - offset : 0) + spare_blocks(pool, queue) * pool->block_size;
+}
+
+uint32_t midi_block_queue_push(midi_block_queue_t* queue, const uint8_t* bytes, uint32_t nbytes)
+{
+  midi_block_pool_t* pool = queue->pool;
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t idx = 0;
+  while (idx < nbytes) {
+    uint32_t offset = head & (pool->block_size - 1);
+    if (offset == 0) {
+      // The last block is full
+      if (spare_blocks(pool, queue) == 0)
+        break;
+      uint8_t block = take_block(pool);
+      pool->next[queue->head_block] = block;
+      queue->head_block = block;
+    }
+    uint32_t n = pool->block_size - offset;
+    if (n > nbytes - idx)
+      n = nbytes - idx;
+    memcpy(pool->buf + (queue->head_block << pool->block_shift) + offset, bytes + idx, n);
+    head += n;
+    idx += n;
+  }
+  atomic_store_explicit(&queue->head, head, memory_order_release);
+  return idx;
+}
+
+uint32_t midi_block_queue_peek(midi_block_queue_t* queue, const uint8_t** bytes)
+{
+  midi_block_pool_t* pool = queue->pool;
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  if (head == tail)
+    return 0;
+  uint32_t offset = tail & (pool->block_size - 1);
+  uint8_t block = offset ? queue->tail_block : pool->next[queue->tail_block];
+  uint32_t count = head - tail;
+  uint32_t contiguous = pool->block_size - offset;
+  *bytes = pool->buf + (block << pool->block_shift) + offset;
+  return count < contiguous ? count : contiguous;
+}
+
+void midi_block_queue_consume(midi_block_queue_t* queue, uint32_t nbytes)
+{
+  midi_block_pool_t* pool = queue->pool;
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  while (nbytes > 0) {
+    uint32_t offset = tail & (pool->block_size - 1);
+    uint32_t n = pool->block_size - offset;
+    if (n > nbytes)
+      n = nbytes;
+    tail += n;
+    nbytes -= n;
+    if (offset == 0) {
+      // Starting the next block, so the last one goes back to the pool. Show
+      // that the queue no longer holds it first (see spare_blocks()).
+      uint8_t finished = queue->tail_block;
+      queue->tail_block = pool->next[finished];
+      atomic_store_explicit(&queue->tail, tail, memory_order_release);
+      give_block(pool, finished);
+    }
+  }
+  atomic_store_explicit(&queue->tail, tail, memory_order_release);
+}
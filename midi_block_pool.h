@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Byte queues that borrow fixed size blocks from a shared pool, so that RAM
+// an idle queue does not need goes to a busy one. Each queue is a
+// single-producer/single-consumer queue like midi_spsc_queue.h, and every
+// queue of a pool has the same producer and the same consumer: for example,
+// core 0 writes all of the MIDI OUT port queues and core 1 drains them. The
+// producer takes a block from the pool when the last one it wrote is full,
+// and the consumer gives a block back as soon as it starts reading the next
+// one. The free blocks wait in a ring that the consumer writes and the
+// producer reads, so the pool needs no locks either.
+//
+// Each queue is sure to get reserve blocks. That count includes the block a
+// queue has finished with but keeps until its next block starts, so a queue
+// is sure of reserve - 1 blocks of room. The other blocks go to whichever
+// queue asks first: the producer only gives a queue a block if enough free
+// blocks remain to bring every other queue up to its reserve.
+//
+// The blocks are numbered with a uint8_t, so a pool has at most 255 blocks.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define MIDI_BLOCK_POOL_MAX_BLOCKS 255
+#define MIDI_BLOCK_POOL_MAX_QUEUES 16
+
+typedef struct midi_block_pool midi_block_pool_t;
+
+typedef struct {
+  midi_block_pool_t* pool;
+  _Atomic uint32_t head;    // only the producer writes this
+  _Atomic uint32_t tail;    // only the consumer writes this
+  uint8_t head_block;       // producer only: the block with byte head - 1
+  uint8_t tail_block;       // consumer only: the block with byte tail - 1
+} midi_block_queue_t;
+
+struct midi_block_pool {
+  uint8_t* buf;             // the blocks
+  uint32_t block_size;      // a power of 2
+  uint32_t block_shift;     // log2(block_size)
+  uint32_t nblocks;
+  uint32_t reserve;         // the blocks each queue is sure to get
+  uint8_t* next;            // the block after each block in its queue
+  uint8_t* free;            // the ring of free blocks
+  _Atomic uint32_t free_head; // only the consumer writes this; 0 to 2 * nblocks - 1
+  _Atomic uint32_t free_tail; // only the producer writes this; 0 to 2 * nblocks - 1
+  midi_block_queue_t* queues[MIDI_BLOCK_POOL_MAX_QUEUES];
+  uint32_t nqueues;
+};
+
+// Initialize pool to share the nblocks blocks of block_size bytes in buf.
+// block_size must be a power of 2. lists must hold 2 * nblocks bytes.
+void midi_block_pool_init(midi_block_pool_t* pool, uint8_t* buf, uint32_t block_size, uint32_t nblocks,
+                          uint8_t* lists, uint32_t reserve);
+
+// Initialize queue to borrow blocks from pool. Initialize every queue of
+// the pool before the producer or consumer use any of them. The pool must
+// have a block for each queue and room for reserve blocks per queue.
+void midi_block_queue_init(midi_block_queue_t* queue, midi_block_pool_t* pool);
+
+// Return the number of bytes in the queue. The producer sees at least
+// this many bytes and the consumer sees at most this many.
+static inline uint32_t midi_block_queue_count(midi_block_queue_t* queue)
+{
+  return atomic_load_explicit(&queue->head, memory_order_acquire) -
+    atomic_load_explicit(&queue->tail, memory_order_acquire);
+}
+
+// Producer only: return the number of bytes that can be pushed
+uint32_t midi_block_queue_space(midi_block_queue_t* queue);
+
+// Producer only: copy up to nbytes bytes to the queue. Return the number of bytes copied.
+uint32_t midi_block_queue_push(midi_block_queue_t* queue, const uint8_t* bytes, uint32_t nbytes);
+
+// Consumer only: set *bytes to point to the oldest bytes in the queue and
+// return how many bytes are stored contiguously there, at most a block.
+// Call midi_block_queue_consume() after using them.
+uint32_t midi_block_queue_peek(midi_block_queue_t* queue, const uint8_t** bytes);
+
+// Consumer only: remove nbytes bytes returned by midi_block_queue_peek() from the queue
+void midi_block_queue_consume(midi_block_queue_t* queue, uint32_t nbytes);
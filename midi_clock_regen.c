@@ -0,0 +1,105 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "midi_clock_regen.h"
+
+void midi_clock_regen_init(midi_clock_regen_t* regen, uint32_t delay_us)
+{
+  memset(regen, 0, sizeof(*regen));
+  regen->delay_us = delay_us;
+}
+
+bool midi_clock_regen_tick(midi_clock_regen_t* regen, uint32_t now_us)
+{
+  if (regen->npending == MIDI_CLOCK_REGEN_MAX_PENDING)
+    return false;
+  // Times in 1/256 us wrap every 16.7 s, which is fine for the differences
+  // between ticks less than MIDI_CLOCK_REGEN_TIMEOUT_US apart
+  uint32_t now = now_us << 8;
+  uint32_t interval = now_us - regen->last_us;
+  if (regen->nticks == 0 || interval > MIDI_CLOCK_REGEN_TIMEOUT_US) {
+    // Start over from this tick
+    regen->phase = now;
+    regen->period = 0;
+    regen->nticks = 1;
+  }
+  else if (regen->nticks == 1) {
+    // The first interval is the first guess at the period
+    regen->phase = now;
+    regen->period = interval << 8;
+    regen->nticks = 2;
+  }
+  else {
+    uint32_t predicted = regen->phase + regen->period;
+    int32_t error = (int32_t)(now - predicted);
+    if ((uint32_t)(error < 0 ? -error : error) > regen->period / 4) {
+      // The tempo jumped: lock on to the new one
+      regen->phase = now;
+      regen->period = interval << 8;
+    }
+    else {
+      regen->phase = predicted + (uint32_t)(error / MIDI_CLOCK_REGEN_PHASE_GAIN);
+      regen->period += (uint32_t)(error / MIDI_CLOCK_REGEN_PERIOD_GAIN);
+    }
+  }
+  regen->last_us = now_us;
+  // Send the tick the delay after its smoothed time, but never before it
+  // arrived or before the tick ahead of it
+  uint32_t due_us = now_us + (uint32_t)((int32_t)(regen->phase - now) / 256) + regen->delay_us;
+  if ((int32_t)(due_us - now_us) < 0)
+    due_us = now_us;
+  if (regen->npending > 0) {
+    uint32_t prev_us = regen->due_us[(regen->first + regen->npending - 1) % MIDI_CLOCK_REGEN_MAX_PENDING];
+    if ((int32_t)(due_us - prev_us) < 0)
+      due_us = prev_us;
+  }
+  regen->due_us[(regen->first + regen->npending) % MIDI_CLOCK_REGEN_MAX_PENDING] = due_us;
+  regen->npending++;
+  return true;
+}
+
+uint32_t midi_clock_regen_due(const midi_clock_regen_t* regen, uint32_t now_us)
+{
+  uint32_t ndue = 0;
+  while (ndue < regen->npending &&
+         (int32_t)(now_us - regen->due_us[(regen->first + ndue) % MIDI_CLOCK_REGEN_MAX_PENDING]) >= 0)
+    ndue++;
+  return ndue;
+}
+
+bool midi_clock_regen_next(const midi_clock_regen_t* regen, uint32_t* due_us)
+{
+  if (regen->npending == 0)
+    return false;
+  *due_us = regen->due_us[regen->first];
+  return true;
+}
+
+void midi_clock_regen_sent(midi_clock_regen_t* regen, uint32_t nticks)
+{
+  regen->first = (uint8_t)((regen->first + nticks) % MIDI_CLOCK_REGEN_MAX_PENDING);
+  regen->npending = (uint8_t)(regen->npending - nticks);
+}
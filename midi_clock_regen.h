@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Regenerates the MIDI Clock on a MIDI OUT port. The USB host's clock ticks
+// (0xF8) reach the adapter in 1 ms USB frames, so sending each one as it
+// arrives moves it by up to 1 ms. The regenerator is a software phase-locked
+// loop instead: it predicts when each tick should arrive from the smoothed
+// time and period of the ticks before it, moves its estimate only a fraction
+// of the way toward the time the tick did arrive, and holds the tick back to
+// send it a fixed delay after the smoothed time. The ticks it sends are
+// evenly spaced to within a fraction of the USB frame jitter, and it never
+// adds or drops one, so a device counting them stays in step.
+//
+// The ticks the regenerator holds back must go out before a Start, Stop or
+// Continue message that arrives after them. A pause longer than
+// MIDI_CLOCK_REGEN_TIMEOUT_US, or a tempo jump larger than a quarter of the
+// period, starts the loop over from the next tick.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// The most ticks one regenerator holds back at once
+#define MIDI_CLOCK_REGEN_MAX_PENDING 4
+// Ticks further apart than this, under 20 BPM, start the loop over
+#define MIDI_CLOCK_REGEN_TIMEOUT_US 125000
+// The loop moves its phase by 1/MIDI_CLOCK_REGEN_PHASE_GAIN and its period by
+// 1/MIDI_CLOCK_REGEN_PERIOD_GAIN of each tick's arrival time error
+#define MIDI_CLOCK_REGEN_PHASE_GAIN 8
+#define MIDI_CLOCK_REGEN_PERIOD_GAIN 64
+
+typedef struct {
+  uint32_t due_us[MIDI_CLOCK_REGEN_MAX_PENDING]; // when to send each tick held back, oldest first
+  uint8_t first;      // the index in due_us of the oldest tick held back
+  uint8_t npending;   // the ticks held back
+  uint8_t nticks;     // ticks since the loop started over, up to 2
+  uint32_t delay_us;  // how long after the smoothed time to send a tick
+  uint32_t last_us;   // when the last tick arrived
+  uint32_t phase;     // the smoothed time of the last tick in 1/256 us
+  uint32_t period;    // the smoothed time between ticks in 1/256 us
+} midi_clock_regen_t;
+
+// Initialize regen to send each tick delay_us microseconds after its
+// smoothed arrival time. The delay must cover the jitter of the ticks.
+void midi_clock_regen_init(midi_clock_regen_t* regen, uint32_t delay_us);
+
+// A clock tick arrived at now_us. Return false if regen already holds back
+// MIDI_CLOCK_REGEN_MAX_PENDING ticks; the caller must send this one itself.
+bool midi_clock_regen_tick(midi_clock_regen_t* regen, uint32_t now_us);
+
+// Return the number of ticks held back
+static inline uint32_t midi_clock_regen_pending(const midi_clock_regen_t* regen)
+{
+  return regen->npending;
+}
+
+// Return the number of ticks due to be sent at now_us
+uint32_t midi_clock_regen_due(const midi_clock_regen_t* regen, uint32_t now_us);
+
+// Set *due_us to when the next tick held back is due and return true, or
+// return false if none is
+bool midi_clock_regen_next(const midi_clock_regen_t* regen, uint32_t* due_us);
+
+// Forget the oldest nticks ticks held back after sending them
+void midi_clock_regen_sent(midi_clock_regen_t* regen, uint32_t nticks);
@@ -25,96 +25,203 @@
 
 #include "tusb.h"
 #include "midi_device_multistream.h"
+#include "midi_trace.h"
 
-static uint8_t packet[4];
-static bool packet_ok = false;
-static uint8_t packet_bytes_to_stream = 0;
-uint32_t tud_midi_demux_stream_read (uint8_t* cable_num, void* buffer, uint32_t bufsize)
+// Number of MIDI stream bytes in a packet for each of the 16 Code Index Numbers
+// (MIDI 1.0 Table 4-1: Code Index Number Classifications). The table packs
+// 2 bits per entry into one 32-bit constant so a lookup is a shift and a mask
+// instead of a branch or a memory load. The reserved and unused Code Index
+// Numbers MIDI_CIN_MISC and MIDI_CIN_CABLE_EVENT have 0 stream bytes.
+#define CIN_PAYLOAD_LEN_ENTRY(_cin, _len) ((uint32_t)(_len) << (2 * (_cin)))
+#define CIN_PAYLOAD_LEN_TABLE (\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_MISC, 0) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_CABLE_EVENT, 0) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSCOM_2BYTE, 2) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSCOM_3BYTE, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSEX_START, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSEX_END_1BYTE, 1) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSEX_END_2BYTE, 2) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_SYSEX_END_3BYTE, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_NOTE_OFF, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_NOTE_ON, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_POLY_KEYPRESS, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_CONTROL_CHANGE, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_PROGRAM_CHANGE, 2) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_CHANNEL_PRESSURE, 2) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_PITCH_BEND_CHANGE, 3) |\
+  CIN_PAYLOAD_LEN_ENTRY(MIDI_CIN_1BYTE_DATA, 1))
+
+// Return the number of MIDI stream bytes in a packet with Code Index Number
+// code_index or 0 if the Code Index Number is reserved
+static inline uint8_t cin_payload_len(uint8_t code_index)
+{
+  return (uint8_t)((CIN_PAYLOAD_LEN_TABLE >> (2 * code_index)) & 0x3);
+}
+
+// Read one packet from ctx's receive FIFO and count it. Return false if the FIFO is empty.
+static inline bool read_packet(midi_demux_ctx_t* ctx, uint8_t packet[4])
+{
+  if (!tud_midi_n_packet_read(ctx->itf, packet))
+  {
+    return false;
+  }
+  midi_trace_record(MIDI_TRACE_USB_OUT, packet);
+  ++ctx->packets_read;
+  return true;
+}
+
+uint32_t midi_demux_stream_read(midi_demux_ctx_t* ctx, uint8_t* cable_num, void* buffer, uint32_t bufsize)
 {
   uint8_t stream_total = 0;
   uint32_t nread = 0;
   uint8_t* buf8 = (uint8_t*)buffer;
-  uint8_t current_cable = (packet[0] >> 4) & 0xf; // assume the static packet buffer contains a valid packet
+  uint8_t current_cable = (ctx->packet[0] >> 4) & 0xf; // assume the context's packet buffer contains a valid packet
 
-  if (packet_ok && packet_bytes_to_stream > 0)
+  if (ctx->packet_ok && ctx->packet_bytes_to_stream > 0)
   {
     // already read some bytes but could not fit them in the last buffer. Try again
-    nread = (uint8_t) tu_min32(packet_bytes_to_stream, bufsize);
-    memcpy(buf8, packet+4-nread, nread);
+    nread = (uint8_t) tu_min32(ctx->packet_bytes_to_stream, bufsize);
+    memcpy(buf8, ctx->packet+ctx->packet_next_byte, nread);
     buf8 += nread;
-    nread += packet_bytes_to_stream;
-    packet_bytes_to_stream -= nread;
+    ctx->packet_next_byte += nread;
+    ctx->packet_bytes_to_stream -= nread;
     *cable_num = current_cable;
-    if (packet_bytes_to_stream > 0)
+    if (ctx->packet_bytes_to_stream > 0)
     {
       return nread; // still could not fit the whole packet in the buffer
     }
-    packet_ok = tud_midi_packet_read(packet);
-    current_cable = (packet[0] >> 4) & 0xf;
-    if (!packet_ok || current_cable != *cable_num)
+    ctx->packet_ok = read_packet(ctx, ctx->packet);
+    current_cable = (ctx->packet[0] >> 4) & 0xf;
+    if (!ctx->packet_ok || current_cable != *cable_num)
     {
       // new packet switches cable number; need to return
       return nread;
     }
   }
-  if (!packet_ok)
+  if (!ctx->packet_ok)
   {
     // nead to read a packet and figure out its cable number
-    packet_ok = tud_midi_packet_read(packet);
-    current_cable = (packet[0] >> 4) & 0xf;
+    ctx->packet_ok = read_packet(ctx, ctx->packet);
+    current_cable = (ctx->packet[0] >> 4) & 0xf;
   }
-  if (packet_ok)
+  if (ctx->packet_ok)
   {
     *cable_num = current_cable;
     // while the packet is good and the cable number did not change
-    while (packet_ok && current_cable == *cable_num)
+    while (ctx->packet_ok && current_cable == *cable_num)
     {
-      uint8_t const code_index = packet[0] & 0x0f;
-
-      // MIDI 1.0 Table 4-1: Code Index Number Classifications
-      switch(code_index)
+      stream_total = cin_payload_len(ctx->packet[0] & 0x0f);
+      if (stream_total == 0)
       {
-        case MIDI_CIN_MISC:
-        case MIDI_CIN_CABLE_EVENT:
-          // These are reserved and unused, possibly issue somewhere, skip this packet
-          packet_ok = false;
-          return 0;
-        break;
-
-        case MIDI_CIN_SYSEX_END_1BYTE:
-        case MIDI_CIN_1BYTE_DATA:
-          stream_total = 1;
-        break;
-
-        case MIDI_CIN_SYSCOM_2BYTE     :
-        case MIDI_CIN_SYSEX_END_2BYTE  :
-        case MIDI_CIN_PROGRAM_CHANGE   :
-        case MIDI_CIN_CHANNEL_PRESSURE :
-          stream_total = 2;
-        break;
-
-        default:
-          stream_total = 3;
-        break;
+        // Reserved and unused Code Index Number, possibly issue somewhere, skip this packet
+        ctx->packet_ok = false;
+        return 0;
       }
       // if the data in the new packet will fit in the read buffer,
       // copy it and keep going
       uint8_t byte_count = (uint8_t) tu_min32(stream_total, (bufsize-nread));
-      memcpy(buf8, packet+1, byte_count);
+      memcpy(buf8, ctx->packet+1, byte_count);
       nread += byte_count;
       buf8 += byte_count;
       if (stream_total > byte_count)
       {
         // ran out of space for this packet in the buffer
         // record how many bytes are left and return how many we copied.
-        packet_bytes_to_stream = stream_total - byte_count;
+        ctx->packet_bytes_to_stream = stream_total - byte_count;
+        ctx->packet_next_byte = 1 + byte_count;
         return nread;
       }
       // try to read the next packet; if none available, packet_ok will be false
-      packet_ok = tud_midi_packet_read(packet);
+      ctx->packet_ok = read_packet(ctx, ctx->packet);
       // assume it worked and extract the cable number for the packet
-      current_cable = (packet[0] >> 4) & 0xf;
+      current_cable = (ctx->packet[0] >> 4) & 0xf;
     }
   }
   return nread;
-}
\ No newline at end of file
+}
+
+// Pass nbytes stream bytes starting at packet[first] to write_cb. If write_cb
+// does not take them all, keep the packet and the position of the rest in ctx.
+// Return the number of bytes write_cb took.
+static uint32_t dispatch_packet(midi_demux_ctx_t* ctx, uint8_t const packet[4], uint8_t first, uint8_t nbytes,
+                                midi_demux_write_cb_t write_cb, void* context)
+{
+  uint32_t const nwritten = write_cb(context, (packet[0] >> 4) & 0xf, packet + first, nbytes);
+  if (nwritten < nbytes)
+  {
+    if (ctx->packet != packet)
+      memcpy(ctx->packet, packet, 4);
+    ctx->packet_ok = true;
+    ctx->packet_next_byte = first + nwritten;
+    ctx->packet_bytes_to_stream = nbytes - nwritten;
+  }
+  return nwritten;
+}
+
+uint32_t midi_demux_dispatch(midi_demux_ctx_t* ctx, midi_demux_write_cb_t write_cb, void* context)
+{
+  uint32_t ndispatched = 0;
+  if (ctx->packet_ok)
+  {
+    // A packet did not fit in the stream read functions' buffer or write_cb did
+    // not take all of it last time
+    uint8_t const first = ctx->packet_bytes_to_stream ? ctx->packet_next_byte : 1;
+    uint8_t const stream_total = ctx->packet_bytes_to_stream ? ctx->packet_bytes_to_stream : cin_payload_len(ctx->packet[0] & 0x0f);
+    ctx->packet_ok = false;
+    ctx->packet_bytes_to_stream = 0;
+    if (stream_total)
+    {
+      ndispatched += dispatch_packet(ctx, ctx->packet, first, stream_total, write_cb, context);
+      if (ctx->packet_ok)
+        return ndispatched; // still no room, so leave the rest in the FIFO
+    }
+  }
+  // Decode each packet where tud_midi_packet_read() put it and hand the
+  // stream bytes straight to the destination
+  uint8_t rx_packet[4];
+  while (read_packet(ctx, rx_packet))
+  {
+    uint8_t const stream_total = cin_payload_len(rx_packet[0] & 0x0f);
+    if (stream_total)
+    {
+      ndispatched += dispatch_packet(ctx, rx_packet, 1, stream_total, write_cb, context);
+      if (ctx->packet_ok)
+        break; // stop reading until write_cb has room for the rest
+    }
+    // else reserved and unused Code Index Number, possibly issue somewhere, skip this packet
+  }
+  return ndispatched;
+}
+
+void midi_demux_init(midi_demux_ctx_t* ctx, uint8_t itf)
+{
+  ctx->itf = itf;
+  ctx->packets_read = 0;
+  midi_demux_reset(ctx);
+}
+
+void midi_demux_reset(midi_demux_ctx_t* ctx)
+{
+  memset(ctx->packet, 0, sizeof(ctx->packet));
+  ctx->packet_ok = false;
+  ctx->packet_bytes_to_stream = 0;
+  ctx->packet_next_byte = 1;
+}
+
+// State for the tud_midi_demux_* functions, which always use MIDI interface 0
+static midi_demux_ctx_t default_ctx = {.packet_next_byte = 1};
+
+void tud_midi_demux_reset(void)
+{
+  midi_demux_init(&default_ctx, 0);
+}
+
+uint32_t tud_midi_demux_stream_read(uint8_t* cable_num, void* buffer, uint32_t bufsize)
+{
+  return midi_demux_stream_read(&default_ctx, cable_num, buffer, bufsize);
+}
+
+uint32_t tud_midi_demux_dispatch(midi_demux_write_cb_t write_cb, void* context)
+{
+  return midi_demux_dispatch(&default_ctx, write_cb, context);
+}
@@ -24,6 +24,7 @@
  */
 #pragma once
 #include <stdint.h>
+#include <stdbool.h>
 #include <boost/preprocessor/enum.hpp>
 // USB MIDI allows up to 16 virtual cable "streams" per USB endpoint
 // The following macros for for a multi-stream interface still assume one
@@ -118,7 +119,113 @@
   TUD_MIDI_DESC_EP(_epin, _epsize, _numcables_in),\
   TUD_MIDI_MULTI_DESC_JACKID_OUT_EMB(_numcables_in)
 
+// USB MIDI 2.0 codes (USB Device Class Definition for MIDI Devices 2.0)
+#define TUD_MIDI_UMP_CS_ENDPOINT_GENERAL    0x02  // MS General 2.0 endpoint descriptor subtype
+#define TUD_MIDI_UMP_CS_GR_TRM_BLOCK        0x26  // Group Terminal Block descriptor type
+#define TUD_MIDI_UMP_GR_TRM_BLOCK_HEADER    0x01
+#define TUD_MIDI_UMP_GR_TRM_BLOCK           0x02
+#define TUD_MIDI_UMP_GR_TRM_BLOCK_TYPE_IN   0x01  // the block only sends to the host
+#define TUD_MIDI_UMP_GR_TRM_BLOCK_TYPE_OUT  0x02  // the block only receives from the host
+#define TUD_MIDI_UMP_PROTOCOL_MIDI_1_0_64   0x01  // MIDI 1.0 messages in UMP of up to 64 bits
+
+// Bulk endpoint for alternate setting 1 and the IDs of the _nblocks Group
+// Terminal Blocks it carries, starting at _first_block
+#define TUD_MIDI_UMP_BLOCKID_ENUM(z, n, _first_block) (uint8_t)((_first_block) + (n))
+#define TUD_MIDI_UMP_DESC_EP_LEN(_nblocks) (7 + 4 + (_nblocks))
+#define TUD_MIDI_UMP_DESC_EP(_ep, _epsize, _first_block, _nblocks) \
+  7, TUSB_DESC_ENDPOINT, _ep, TUSB_XFER_BULK, U16_TO_U8S_LE(_epsize), 0,\
+  4 + (_nblocks), TUSB_DESC_CS_ENDPOINT, TUD_MIDI_UMP_CS_ENDPOINT_GENERAL, _nblocks,\
+  BOOST_PP_ENUM(_nblocks, TUD_MIDI_UMP_BLOCKID_ENUM, _first_block)
+
+// Alternate setting 1 of the MIDI Streaming interface, which carries
+// Universal MIDI Packets on the same endpoints as alternate setting 0. Each
+// virtual cable is a Group Terminal Block of one group with the same number:
+// blocks 1 to _numcables_out for the OUT cables, then the IN cables.
+#define TUD_MIDI_UMP_ALT_DESC_LEN(_numcables_in, _numcables_out) (9 + 7 + TUD_MIDI_UMP_DESC_EP_LEN(_numcables_out) +\
+                                                                  TUD_MIDI_UMP_DESC_EP_LEN(_numcables_in))
+#define TUD_MIDI_UMP_ALT_DESC(_itfnum, _epout, _epin, _epsize, _numcables_in, _numcables_out) \
+  /* MIDI Streaming (MS) Interface, alternate setting 1 */\
+  9, TUSB_DESC_INTERFACE, (uint8_t)((_itfnum) + 1), 1, 2, TUSB_CLASS_AUDIO, AUDIO_SUBCLASS_MIDI_STREAMING, AUDIO_FUNC_PROTOCOL_CODE_UNDEF, 0,\
+  /* MS Header for USB MIDI 2.0 */\
+  7, TUSB_DESC_CS_INTERFACE, MIDI_CS_INTERFACE_HEADER, U16_TO_U8S_LE(0x0200), U16_TO_U8S_LE(7),\
+  TUD_MIDI_UMP_DESC_EP(_epout, _epsize, 1, _numcables_out),\
+  TUD_MIDI_UMP_DESC_EP(_epin, _epsize, (_numcables_out) + 1, _numcables_in)
+
+// MIDI multi-stream descriptor with the UMP alternate setting. The
+// parameters are the same as for TUD_MIDI_MULTI_DESCRIPTOR(). The Interface
+// Association Descriptor in front lets the class driver in midi_ump_driver.c
+// own both interfaces, which needs the Misc device class in the device
+// descriptor (TUSB_CLASS_MISC, MISC_SUBCLASS_COMMON, MISC_PROTOCOL_IAD).
+#define TUD_MIDI_MULTI_UMP_DESC_LEN(_numcables_in, _numcables_out) (8 + TUD_MIDI_MULTI_DESC_LEN(_numcables_in, _numcables_out) +\
+                                                                    TUD_MIDI_UMP_ALT_DESC_LEN(_numcables_in, _numcables_out))
+#define TUD_MIDI_MULTI_UMP_DESCRIPTOR(_itfnum, _stridx, _epout, _epin, _epsize, _numcables_in, _numcables_out) \
+  /* Interface Association */\
+  8, TUSB_DESC_INTERFACE_ASSOCIATION, _itfnum, 2, TUSB_CLASS_AUDIO, AUDIO_FUNCTION_SUBCLASS_UNDEFINED, AUDIO_FUNC_PROTOCOL_CODE_UNDEF, 0,\
+  TUD_MIDI_MULTI_DESCRIPTOR(_itfnum, _stridx, _epout, _epin, _epsize, _numcables_in, _numcables_out),\
+  TUD_MIDI_UMP_ALT_DESC(_itfnum, _epout, _epin, _epsize, _numcables_in, _numcables_out)
+
+// The Group Terminal Block descriptors, which the host reads with a
+// GET_DESCRIPTOR request to the MIDI Streaming interface. Each block is
+// named after its jack.
+#define TUD_MIDI_UMP_GTB_DESC(_blockid, _type, _group, _stridx) \
+  13, TUD_MIDI_UMP_CS_GR_TRM_BLOCK, TUD_MIDI_UMP_GR_TRM_BLOCK, _blockid, _type, _group, 1, _stridx,\
+  TUD_MIDI_UMP_PROTOCOL_MIDI_1_0_64, U16_TO_U8S_LE(0), U16_TO_U8S_LE(0)
+#define TUD_MIDI_UMP_GTB_OUT_ENUM_DESC(z, n, _numcables_in) \
+  TUD_MIDI_UMP_GTB_DESC((uint8_t)((n) + 1), TUD_MIDI_UMP_GR_TRM_BLOCK_TYPE_OUT, n, EMB_OUT_JACK_STRIDX(_numcables_in, n))
+#define TUD_MIDI_UMP_GTB_IN_ENUM_DESC(z, n, _numcables_out) \
+  TUD_MIDI_UMP_GTB_DESC((uint8_t)((_numcables_out) + (n) + 1), TUD_MIDI_UMP_GR_TRM_BLOCK_TYPE_IN, n, EMB_IN_JACK_STRIDX(n))
+#define TUD_MIDI_UMP_GTB_DESC_LEN(_numcables_in, _numcables_out) (5 + 13 * ((_numcables_in) + (_numcables_out)))
+#define TUD_MIDI_UMP_GTB_DESCRIPTOR(_numcables_in, _numcables_out) \
+  5, TUD_MIDI_UMP_CS_GR_TRM_BLOCK, TUD_MIDI_UMP_GR_TRM_BLOCK_HEADER,\
+  U16_TO_U8S_LE(TUD_MIDI_UMP_GTB_DESC_LEN(_numcables_in, _numcables_out)),\
+  BOOST_PP_ENUM(_numcables_out, TUD_MIDI_UMP_GTB_OUT_ENUM_DESC, _numcables_in),\
+  BOOST_PP_ENUM(_numcables_in, TUD_MIDI_UMP_GTB_IN_ENUM_DESC, _numcables_out)
+
+// Demultiplexer state for one USB MIDI interface. Each caller that demultiplexes
+// an interface needs its own context. Initialize it with midi_demux_init() and
+// reset it with midi_demux_reset() when the USB device is unmounted.
+typedef struct {
+  uint8_t packet[4];              // the last packet read from the receive FIFO
+  bool packet_ok;                 // true if packet holds stream bytes not yet returned
+  uint8_t packet_bytes_to_stream; // number of packet's stream bytes that did not fit in the last buffer
+  uint8_t packet_next_byte;       // index in packet of the first byte that did not fit
+  uint8_t itf;                    // the MIDI interface number
+  uint32_t packets_read;          // packets read from the receive FIFO; the caller may clear it
+} midi_demux_ctx_t;
+
+// Initialize ctx to demultiplex MIDI interface itf
+void midi_demux_init(midi_demux_ctx_t* ctx, uint8_t itf);
+
+// Discard any partly read packet in ctx
+void midi_demux_reset(midi_demux_ctx_t* ctx);
+
 // Return the number of bytes read in the stream and set *cable_num to the cable number in the stream.
 // Return 0 when when there are no more streams or stream fragments in the receive FIFO
-// If cable_num is NULL, then this function behaves like to tud_midi_stream_read()
-uint32_t tud_midi_demux_stream_read  (uint8_t* cable_num, void* buffer, uint32_t bufsize);
\ No newline at end of file
+uint32_t midi_demux_stream_read(midi_demux_ctx_t* ctx, uint8_t* cable_num, void* buffer, uint32_t bufsize);
+
+// Write the nbytes MIDI stream bytes in bytes to the destination for virtual cable cable_num.
+// context is the context pointer passed to midi_demux_dispatch().
+// Return the number of bytes the destination accepted.
+typedef uint32_t (*midi_demux_write_cb_t)(void* context, uint8_t cable_num, uint8_t const* bytes, uint32_t nbytes);
+
+// Drain the USB MIDI receive FIFO without copying the MIDI stream bytes to an
+// intermediate buffer. Decode each USB-MIDI event packet in place and call write_cb
+// once per packet with the packet's cable number and stream bytes, in the order
+// the packets were received. If write_cb takes fewer bytes than it was passed,
+// keep the rest of the packet in ctx and stop reading the FIFO; the next call
+// passes the rest to write_cb before it reads another packet. Leaving the data
+// in the FIFO makes the USB device NAK the host's next transfer until there is
+// room for it. Return the number of stream bytes write_cb took.
+uint32_t midi_demux_dispatch(midi_demux_ctx_t* ctx, midi_demux_write_cb_t write_cb, void* context);
+
+// The following functions work like the midi_demux_* functions above on a
+// single shared context for MIDI interface 0. They are not reentrant.
+
+// Discard any partly read packet in the shared context
+void tud_midi_demux_reset(void);
+
+// Return the number of bytes read in the stream and set *cable_num to the cable number in the stream.
+// Return 0 when when there are no more streams or stream fragments in the receive FIFO
+uint32_t tud_midi_demux_stream_read  (uint8_t* cable_num, void* buffer, uint32_t bufsize);
+
+uint32_t tud_midi_demux_dispatch(midi_demux_write_cb_t write_cb, void* context);
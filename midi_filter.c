@@ -0,0 +1,71 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_filter.h"
+
+// The MIDI_FILTER_* bit for each System message status byte 0xF0 to 0xFF
+static const uint8_t system_types[16] = {
+  7, 8, 9, 10, 11, 11, 11, 7,     // 0xF7 ends System Exclusive
+  12, 14, 13, 13, 13, 14, 14, 15,
+};
+
+void midi_filter_init(midi_filter_t* filter, midi_filter_setting_t setting)
+{
+  for (uint8_t idx = 0; idx < 4; idx++) {
+    filter->pass[idx] = 0;
+  }
+  for (uint32_t status = 0x80; status <= 0xFF; status++) {
+    bool drop;
+    if (status < 0xF0)
+      drop = ((setting.types >> ((status >> 4) - 8)) | (setting.channels >> (status & 0xF))) & 1;
+    else
+      drop = (setting.types >> system_types[status & 0xF]) & 1;
+    if (!drop)
+      filter->pass[(status >> 5) & 3] |= 1u << (status & 31);
+  }
+  filter->pass_all = setting.types == 0 && setting.channels == 0;
+}
+
+uint32_t midi_filter_copy(const midi_filter_t* filter, midi_filter_state_t* state, const uint8_t* bytes, uint32_t nbytes,
+                          uint8_t* out)
+{
+  uint32_t ncopied = 0;
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    if (midi_filter_byte(filter, state, bytes[idx]))
+      out[ncopied++] = bytes[idx];
+  }
+  return ncopied;
+}
+
+uint32_t midi_filter_skip(const midi_filter_t* filter, midi_filter_state_t* state, const uint8_t* bytes, uint32_t nbytes,
+                          uint32_t npassed)
+{
+  uint32_t idx;
+  for (idx = 0; idx < nbytes && npassed > 0; idx++) {
+    if (midi_filter_byte(filter, state, bytes[idx]))
+      npassed--;
+  }
+  return idx;
+}
@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Drops the MIDI messages a MIDI OUT port or the USB host does not want,
+// by message type and MIDI channel. The setting compiles to a 128-bit mask
+// with one bit per status byte, so the decision for a message is one bit
+// lookup on its status byte, and its data bytes follow that decision. System
+// Real-Time bytes are looked up on their own and leave the decision for the
+// message around them alone, and running status keeps the decision of the
+// status byte it repeats.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Message types a filter can drop, as bits of midi_filter_setting_t.types
+#define MIDI_FILTER_NOTE_OFF          (1u << 0)   // 0x8n
+#define MIDI_FILTER_NOTE_ON           (1u << 1)   // 0x9n
+#define MIDI_FILTER_POLY_PRESSURE     (1u << 2)   // 0xAn
+#define MIDI_FILTER_CONTROL_CHANGE    (1u << 3)   // 0xBn
+#define MIDI_FILTER_PROGRAM_CHANGE    (1u << 4)   // 0xCn
+#define MIDI_FILTER_CHANNEL_PRESSURE  (1u << 5)   // 0xDn
+#define MIDI_FILTER_PITCH_BEND        (1u << 6)   // 0xEn
+#define MIDI_FILTER_SYSEX             (1u << 7)   // 0xF0 to 0xF7
+#define MIDI_FILTER_TIME_CODE         (1u << 8)   // 0xF1
+#define MIDI_FILTER_SONG_POSITION     (1u << 9)   // 0xF2
+#define MIDI_FILTER_SONG_SELECT       (1u << 10)  // 0xF3
+#define MIDI_FILTER_TUNE_REQUEST      (1u << 11)  // 0xF6, and the undefined 0xF4 and 0xF5
+#define MIDI_FILTER_CLOCK             (1u << 12)  // 0xF8
+#define MIDI_FILTER_START_STOP        (1u << 13)  // 0xFA Start, 0xFB Continue and 0xFC Stop
+#define MIDI_FILTER_ACTIVE_SENSING    (1u << 14)  // 0xFE, and the undefined 0xF9 and 0xFD
+#define MIDI_FILTER_RESET             (1u << 15)  // 0xFF
+#define MIDI_FILTER_CHANNEL_VOICE     0x007Fu     // all of the channel voice messages
+
+// Drop the channel voice messages on the MIDI channels in _mask, bit 0 for
+// channel 1. This goes in the upper half of the 32-bit filter settings in
+// tusb_config.h, next to the MIDI_FILTER_* type bits.
+#define MIDI_FILTER_CHANNELS(_mask)   ((uint32_t)(_mask) << 16)
+
+typedef struct {
+  uint16_t types;     // MIDI_FILTER_* bits of the message types to drop
+  uint16_t channels;  // bit n drops the channel voice messages on MIDI channel n + 1
+} midi_filter_setting_t;
+
+typedef struct {
+  uint32_t pass[4];   // bit n % 32 of pass[n / 32] passes status byte 0x80 + n
+  bool pass_all;      // the filter drops nothing
+} midi_filter_t;
+
+// The decision for the message in progress on one MIDI byte stream
+typedef struct {
+  bool passing;
+} midi_filter_state_t;
+
+// Compile setting to filter
+void midi_filter_init(midi_filter_t* filter, midi_filter_setting_t setting);
+
+// Start a stream over; data bytes before its first status byte pass
+static inline void midi_filter_state_init(midi_filter_state_t* state)
+{
+  state->passing = true;
+}
+
+// Return true if filter passes the messages with status byte status
+static inline bool midi_filter_passes(const midi_filter_t* filter, uint8_t status)
+{
+  return (filter->pass[(status >> 5) & 3] >> (status & 31)) & 1;
+}
+
+// Return true if filter passes byte, the next byte of the stream state follows
+static inline bool midi_filter_byte(const midi_filter_t* filter, midi_filter_state_t* state, uint8_t byte)
+{
+  if (byte < 0x80)
+    return state->passing;
+  bool passes = midi_filter_passes(filter, byte);
+  if (byte < 0xF8)
+    state->passing = passes;
+  return passes;
+}
+
+// Copy the bytes filter passes from bytes to out, which must have room for
+// nbytes bytes. Return the number of bytes copied.
+uint32_t midi_filter_copy(const midi_filter_t* filter, midi_filter_state_t* state, const uint8_t* bytes, uint32_t nbytes,
+                          uint8_t* out);
+
+// For when the consumer of the bytes midi_filter_copy() copied took only
+// the first npassed of them: with state as it was before that call, follow
+// bytes up to the npassed'th byte filter passes. Return how many bytes that
+// is. The rest of bytes must be filtered again.
+uint32_t midi_filter_skip(const midi_filter_t* filter, midi_filter_state_t* state, const uint8_t* bytes, uint32_t nbytes,
+                          uint32_t npassed);
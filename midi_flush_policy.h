@@ -0,0 +1,71 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Decides when to send MIDI data that is waiting to go to the USB host. Each
+// USB transfer costs the same bus time and host work whether it carries one
+// USB MIDI event packet or a full endpoint's worth, so sending each message
+// as soon as it arrives wastes transfers. The policy waits until enough bytes
+// are waiting to fill a transfer, or until the oldest waiting byte has waited
+// budget_us microseconds, whichever comes first.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  uint32_t budget_us;   // the longest a byte may wait to be sent
+  uint32_t full_bytes;  // send as soon as this many bytes are waiting
+  uint32_t oldest_us;   // when the policy first saw the oldest waiting byte
+  bool waiting;         // true if bytes are waiting
+} midi_flush_policy_t;
+
+static inline void midi_flush_policy_init(midi_flush_policy_t* policy, uint32_t budget_us, uint32_t full_bytes)
+{
+  policy->budget_us = budget_us;
+  policy->full_bytes = full_bytes;
+  policy->oldest_us = 0;
+  policy->waiting = false;
+}
+
+// Return true if the nwaiting bytes waiting at time now_us should be sent now
+static inline bool midi_flush_policy_check(midi_flush_policy_t* policy, uint32_t nwaiting, uint32_t now_us)
+{
+  if (nwaiting == 0) {
+    policy->waiting = false;
+    return false;
+  }
+  if (!policy->waiting) {
+    policy->waiting = true;
+    policy->oldest_us = now_us;
+  }
+  return nwaiting >= policy->full_bytes || now_us - policy->oldest_us >= policy->budget_us;
+}
+
+// Tell the policy how many bytes are still waiting after sending. Bytes
+// left over are already overdue, so the next check sends them.
+static inline void midi_flush_policy_sent(midi_flush_policy_t* policy, uint32_t nleft)
+{
+  if (nleft == 0)
+    policy->waiting = false;
+}
@@ -0,0 +1,112 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_msg_parser.h"
+
+// Return the length of the message with status byte status, which must be
+// 0x80-0xEF or 0xF1-0xF6
+static uint8_t message_len(uint8_t status)
+{
+  switch (status & 0xF0) {
+    case 0xC0: // Program Change
+    case 0xD0: // Channel Pressure
+      return 2;
+    case 0xF0:
+      switch (status) {
+        case 0xF1: // MIDI Time Code Quarter Frame
+        case 0xF3: // Song Select
+          return 2;
+        case 0xF2: // Song Position Pointer
+          return 3;
+        default:   // Tune Request and the undefined 0xF4 and 0xF5
+          return 1;
+      }
+    default:
+      return 3;
+  }
+}
+
+void midi_msg_parser_init(midi_msg_parser_t* parser)
+{
+  parser->status = 0;
+  parser->ndata = 0;
+  parser->in_sysex = false;
+}
+
+bool midi_msg_parser_parse(midi_msg_parser_t* parser, uint8_t byte, midi_msg_t* msg)
+{
+  msg->nbytes = 0;
+  if (byte >= 0xF8) {
+    // System Real-Time does not affect the message in progress
+    msg->bytes[0] = byte;
+    msg->nbytes = 1;
+    return true;
+  }
+  if (parser->in_sysex) {
+    if (byte < 0x80) {
+      msg->bytes[0] = byte;
+      msg->nbytes = 1;
+      return true;
+    }
+    parser->in_sysex = false;
+    msg->bytes[0] = 0xF7;
+    msg->nbytes = 1;
+    return byte == 0xF7;
+  }
+  if (byte < 0x80) {
+    if (parser->status == 0)
+      return true; // no status byte to go with it, so ignore it
+    parser->data[parser->ndata++] = byte;
+    if (parser->ndata + 1 == message_len(parser->status)) {
+      msg->bytes[0] = parser->status;
+      msg->bytes[1] = parser->data[0];
+      msg->bytes[2] = parser->data[1];
+      msg->nbytes = parser->ndata + 1;
+      parser->ndata = 0;
+      if (parser->status >= 0xF0)
+        parser->status = 0; // System Common messages have no running status
+    }
+    return true;
+  }
+  // A status byte
+  parser->ndata = 0;
+  parser->status = 0;
+  if (byte == 0xF0) {
+    parser->in_sysex = true;
+    msg->bytes[0] = byte;
+    msg->nbytes = 1;
+  }
+  else if (byte == 0xF7) {
+    // End of Exclusive without a System Exclusive message, so ignore it
+  }
+  else if (message_len(byte) == 1) {
+    msg->bytes[0] = byte;
+    msg->nbytes = 1;
+  }
+  else {
+    parser->status = byte;
+  }
+  return true;
+}
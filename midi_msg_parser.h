@@ -0,0 +1,55 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Splits a MIDI 1.0 byte stream, such as the bytes from a DIN MIDI IN port,
+// into whole messages. It fills in the status byte of messages sent with
+// running status, passes System Real-Time bytes on as soon as they arrive,
+// even in the middle of another message, and passes System Exclusive
+// messages on one byte at a time because they can be any length. A status
+// byte other than System Real-Time ends a System Exclusive message; the parser
+// then returns the missing 0xF7 End of Exclusive byte first.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  uint8_t bytes[3];
+  uint8_t nbytes;     // 0 if there is no message
+} midi_msg_t;
+
+typedef struct {
+  uint8_t status;     // status of the message being parsed or the running status; 0 if none
+  uint8_t data[2];    // data bytes of the message being parsed
+  uint8_t ndata;      // number of bytes in data
+  bool in_sysex;      // true between 0xF0 and the end of a System Exclusive message
+} midi_msg_parser_t;
+
+void midi_msg_parser_init(midi_msg_parser_t* parser);
+
+// Parse one MIDI stream byte. When it completes a message, or is a System
+// Real-Time or System Exclusive byte, copy that to msg; otherwise set
+// msg->nbytes to 0. Return false if the byte ended a System Exclusive message
+// without 0xF7: msg then holds 0xF7 and the caller must pass the same byte again.
+bool midi_msg_parser_parse(midi_msg_parser_t* parser, uint8_t byte, midi_msg_t* msg);
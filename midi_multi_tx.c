@@ -0,0 +1,119 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_multi_tx.h"
+#include "midi_multi_tx.pio.h"
+
+// 10 bit times per frame, 2 per FIFO word
+#define WORDS_PER_FRAME 5
+// The joined TX FIFO is 8 words deep
+#define FIFO_WORDS 8
+
+bool midi_multi_tx_init(midi_multi_tx_t* tx, const uint8_t* gpios, uint8_t nlines)
+{
+  if (nlines == 0 || nlines > MIDI_MULTI_TX_MAX_LINES)
+    return false;
+  uint8_t pin_base = gpios[0];
+  uint8_t pin_last = gpios[0];
+  for (uint8_t line = 1; line < nlines; line++) {
+    if (gpios[line] < pin_base)
+      pin_base = gpios[line];
+    if (gpios[line] > pin_last)
+      pin_last = gpios[line];
+  }
+  if (pin_last - pin_base >= 16)
+    return false;
+  PIO pios[2] = {pio0, pio1};
+  for (int idx = 0; idx < 2; idx++) {
+    PIO pio = pios[idx];
+    if (!pio_can_add_program(pio, &midi_multi_tx_program))
+      continue;
+    int sm = pio_claim_unused_sm(pio, false);
+    if (sm < 0)
+      continue;
+    tx->pio = pio;
+    tx->sm = (uint)sm;
+    tx->nlines = nlines;
+    tx->pin_bits = 0;
+    uint32_t pin_mask = 0;
+    for (uint8_t line = 0; line < nlines; line++) {
+      tx->lines[line].head = tx->lines[line].tail = 0;
+      tx->lines[line].pin_bit = 1u << (gpios[line] - pin_base);
+      tx->pin_bits |= tx->lines[line].pin_bit;
+      pin_mask |= 1u << gpios[line];
+    }
+    uint offset = pio_add_program(pio, &midi_multi_tx_program);
+    midi_multi_tx_program_init(pio, tx->sm, offset, pin_base, pin_last - pin_base + 1, pin_mask);
+    return true;
+  }
+  return false;
+}
+
+uint32_t midi_multi_tx_write(void* line_ptr, const uint8_t* bytes, uint32_t nbytes)
+{
+  midi_multi_tx_line_t* line = line_ptr;
+  uint32_t nwritten = 0;
+  while (nwritten < nbytes && (uint8_t)(line->head - line->tail) < MIDI_MULTI_TX_LINE_BUFSIZE) {
+    line->buf[line->head++ & (MIDI_MULTI_TX_LINE_BUFSIZE - 1)] = bytes[nwritten++];
+  }
+  return nwritten;
+}
+
+uint32_t midi_multi_tx_service(midi_multi_tx_t* tx)
+{
+  // A frame goes in whenever the FIFO has room for all of it, not only when
+  // the FIFO is empty, so the state machine never waits for the next call
+  while (pio_sm_get_tx_fifo_level(tx->pio, tx->sm) <= FIFO_WORDS - WORDS_PER_FRAME) {
+    // Start with every line idle (high) for all 10 bit times
+    uint16_t bit_times[10];
+    for (int bit = 0; bit < 10; bit++) {
+      bit_times[bit] = tx->pin_bits;
+    }
+    bool busy = false;
+    for (uint8_t idx = 0; idx < tx->nlines; idx++) {
+      midi_multi_tx_line_t* line = &tx->lines[idx];
+      if (line->head == line->tail)
+        continue;
+      busy = true;
+      // Start bit low, data bits LSB first, then the stop bit
+      uint16_t frame = (uint16_t)(line->buf[line->tail++ & (MIDI_MULTI_TX_LINE_BUFSIZE - 1)] << 1) | 0x200;
+      for (int bit = 0; bit < 10; bit++) {
+        if (!(frame & (1u << bit)))
+          bit_times[bit] &= ~line->pin_bit;
+      }
+    }
+    if (!busy)
+      break;
+    for (int word = 0; word < WORDS_PER_FRAME; word++) {
+      pio_sm_put(tx->pio, tx->sm, bit_times[2 * word] | ((uint32_t)bit_times[2 * word + 1] << 16));
+    }
+  }
+  uint32_t waiting = 0;
+  for (uint8_t idx = 0; idx < tx->nlines; idx++) {
+    if (tx->lines[idx].head != tx->lines[idx].tail)
+      waiting |= 1u << idx;
+  }
+  return waiting;
+}
@@ -0,0 +1,67 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Several MIDI OUT TX lines served by one PIO state machine, for when there
+// are more MIDI OUT ports than state machines. Each line has a small
+// transmit buffer. midi_multi_tx_service() takes the next byte for every
+// line that has one, turns them into the bit times of one serial frame for
+// all the lines at once and gives the frame to the state machine. Servicing
+// costs the same for one busy line as for all of them.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "hardware/pio.h"
+
+#define MIDI_MULTI_TX_MAX_LINES 16
+#define MIDI_MULTI_TX_LINE_BUFSIZE 8 // must be a power of 2
+
+typedef struct {
+  uint8_t buf[MIDI_MULTI_TX_LINE_BUFSIZE];
+  uint8_t head;       // bytes written, modulo 256
+  uint8_t tail;       // bytes sent, modulo 256
+  uint16_t pin_bit;   // the line's bit in each bit time
+} midi_multi_tx_line_t;
+
+typedef struct {
+  PIO pio;
+  uint sm;
+  uint16_t pin_bits;  // every line's bit
+  uint8_t nlines;
+  midi_multi_tx_line_t lines[MIDI_MULTI_TX_MAX_LINES];
+} midi_multi_tx_t;
+
+// Claim a state machine and set it up to drive the nlines GPIO pins in
+// gpios. The pins must be within 16 of each other. Return false if no state
+// machine or program space is left.
+bool midi_multi_tx_init(midi_multi_tx_t* tx, const uint8_t* gpios, uint8_t nlines);
+
+// Copy up to nbytes bytes to the transmit buffer of line, one of tx->lines.
+// Return the number copied. The signature matches midi_out_port_write_fn.
+uint32_t midi_multi_tx_write(void* line, const uint8_t* bytes, uint32_t nbytes);
+
+// Move as many frames to the state machine as its FIFO has room for. Return
+// a bit mask of the lines, bit n for tx->lines[n], with bytes left in their
+// transmit buffers.
+uint32_t midi_multi_tx_service(midi_multi_tx_t* tx);
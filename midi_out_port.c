@@ -0,0 +1,121 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_out_port.h"
+
+// One MIDI byte takes 320us at 31250 baud
+#define MIDI_BYTE_US 320
+
+void midi_out_port_init(midi_out_port_t* out_port, midi_out_port_write_fn write, void* port,
+                        midi_block_pool_t* bulk_pool, uint8_t* realtime_buf, uint32_t realtime_size,
+                        uint32_t pacing_bytes)
+{
+  midi_block_queue_init(&out_port->bulk, bulk_pool);
+  midi_spsc_queue_init(&out_port->realtime, realtime_buf, realtime_size);
+  out_port->write = write;
+  out_port->port = port;
+  out_port->pacing_bytes = pacing_bytes;
+  out_port->busy_until_us = 0;
+}
+
+uint32_t midi_out_port_write(midi_out_port_t* out_port, const uint8_t* bytes, uint32_t nbytes)
+{
+  uint32_t idx = 0;
+  while (idx < nbytes) {
+    if (bytes[idx] >= 0xF8) {
+      if (midi_spsc_queue_push(&out_port->realtime, &bytes[idx], 1) != 1)
+        break;
+      idx++;
+    }
+    else {
+      // Queue everything up to the next System Real-Time byte in one push
+      uint32_t end = idx + 1;
+      while (end < nbytes && bytes[end] < 0xF8)
+        end++;
+      uint32_t npushed = midi_block_queue_push(&out_port->bulk, &bytes[idx], end - idx);
+      idx += npushed;
+      if (idx != end)
+        break;
+    }
+  }
+  return idx;
+}
+
+bool midi_out_port_can_write(midi_out_port_t* out_port, const uint8_t* bytes, uint32_t nbytes)
+{
+  uint32_t nrealtime = 0;
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    if (bytes[idx] >= 0xF8)
+      nrealtime++;
+  }
+  return midi_spsc_queue_space(&out_port->realtime) >= nrealtime &&
+    midi_block_queue_space(&out_port->bulk) >= nbytes - nrealtime;
+}
+
+// Write up to maxbytes bytes from the priority lane (realtime true) or the
+// bulk lane to the port. Return the number written.
+static uint32_t write_from_lane(midi_out_port_t* out_port, bool realtime, uint32_t maxbytes)
+{
+  uint32_t nwritten = 0;
+  while (nwritten < maxbytes) {
+    const uint8_t* bytes;
+    uint32_t nbytes = realtime ? midi_spsc_queue_peek(&out_port->realtime, &bytes) :
+      midi_block_queue_peek(&out_port->bulk, &bytes);
+    if (nbytes == 0)
+      break;
+    if (nbytes > maxbytes - nwritten)
+      nbytes = maxbytes - nwritten;
+    uint32_t n = out_port->write(out_port->port, bytes, nbytes);
+    if (realtime)
+      midi_spsc_queue_consume(&out_port->realtime, n);
+    else
+      midi_block_queue_consume(&out_port->bulk, n);
+    nwritten += n;
+    if (n != nbytes)
+      break; // the port's transmit buffer is full
+  }
+  return nwritten;
+}
+
+bool midi_out_port_service(midi_out_port_t* out_port, uint32_t now_us)
+{
+  int32_t busy_us = (int32_t)(out_port->busy_until_us - now_us);
+  if (busy_us < 0) {
+    busy_us = 0;
+    out_port->busy_until_us = now_us;
+  }
+  // Bytes still in the port's transmit buffer, rounded up
+  uint32_t nbusy = ((uint32_t)busy_us + MIDI_BYTE_US - 1) / MIDI_BYTE_US;
+  if (nbusy < out_port->pacing_bytes) {
+    uint32_t room = out_port->pacing_bytes - nbusy;
+    uint32_t nwritten = write_from_lane(out_port, true, room);
+    if (nwritten < room && midi_spsc_queue_count(&out_port->realtime) == 0)
+      nwritten += write_from_lane(out_port, false, room - nwritten);
+    out_port->busy_until_us += nwritten * MIDI_BYTE_US;
+    busy_us += nwritten * MIDI_BYTE_US;
+  }
+  return busy_us > 0 || midi_spsc_queue_count(&out_port->realtime) > 0 ||
+      midi_block_queue_count(&out_port->bulk) > 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Transmit queues for a MIDI OUT port with a priority lane for MIDI System
+// Real-Time messages. The producer writes MIDI stream bytes with
+// midi_out_port_write(), which puts the single byte System Real-Time messages
+// (0xF8-0xFF) in the priority lane and everything else in the bulk lane. The
+// consumer calls midi_out_port_service() to move bytes into the port's
+// transmit buffer, priority lane first. MIDI 1.0 allows System Real-Time
+// messages between any two bytes, even inside System Exclusive messages, so a
+// MIDI Clock never waits behind a long SysEx dump that is already queued.
+//
+// Bytes in the port's own transmit buffer cannot be overtaken, so the consumer
+// keeps only about CFG_MIDI_OUT_PACING_BYTES bytes there. It paces itself with
+// the time the bytes it wrote take to send at 31250 baud.
+//
+// The priority lane is a midi_spsc_queue_t queue and the bulk lane borrows
+// blocks from a midi_block_pool_t pool that the ports share, so the
+// producer and the consumer may run on different CPU cores.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_spsc_queue.h"
+#include "midi_block_pool.h"
+
+// Write up to nbytes bytes to a port's transmit buffer; return the number written
+typedef uint32_t (*midi_out_port_write_fn)(void* port, const uint8_t* bytes, uint32_t nbytes);
+
+typedef struct {
+  midi_block_queue_t bulk;      // MIDI stream bytes in order
+  midi_spsc_queue_t realtime;   // System Real-Time bytes that skip the bulk lane
+  midi_out_port_write_fn write; // writes to the port's transmit buffer
+  void* port;                   // the port passed to write
+  uint32_t pacing_bytes;        // the most bytes to keep in the port's transmit buffer
+  uint32_t busy_until_us;       // consumer only: when the port will have sent every byte
+} midi_out_port_t;
+
+// Initialize out_port to write to port with write. The bulk lane borrows
+// blocks from bulk_pool. realtime_buf holds the priority lane; its size must
+// be a power of 2.
+void midi_out_port_init(midi_out_port_t* out_port, midi_out_port_write_fn write, void* port,
+                        midi_block_pool_t* bulk_pool, uint8_t* realtime_buf, uint32_t realtime_size,
+                        uint32_t pacing_bytes);
+
+// Producer only: queue nbytes MIDI stream bytes. Return the number of bytes
+// queued; it stops at the first byte that does not fit.
+uint32_t midi_out_port_write(midi_out_port_t* out_port, const uint8_t* bytes, uint32_t nbytes);
+
+// Producer only: return true if midi_out_port_write() would queue all nbytes bytes
+bool midi_out_port_can_write(midi_out_port_t* out_port, const uint8_t* bytes, uint32_t nbytes);
+
+// Consumer only: move queued bytes to the port's transmit buffer, keeping at
+// most about pacing_bytes bytes there. now_us is the time in microseconds.
+// Return true if the port has bytes queued or still sending.
+bool midi_out_port_service(midi_out_port_t* out_port, uint32_t now_us);
@@ -0,0 +1,92 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "tusb.h"
+#include "midi_packetizer.h"
+
+void midi_packetizer_init(midi_packetizer_t* packetizer, uint8_t cable)
+{
+  midi_msg_parser_init(&packetizer->parser);
+  packetizer->cable = cable;
+  packetizer->nsysex = 0;
+}
+
+// Copy msg, which is not part of a System Exclusive message, to packet
+static void msg_packet(const midi_packetizer_t* packetizer, const midi_msg_t* msg, uint8_t packet[4])
+{
+  uint8_t status = msg->bytes[0];
+  uint8_t cin;
+  if (status < 0xF0)
+    cin = status >> 4;
+  else if (status >= 0xF8)
+    cin = MIDI_CIN_1BYTE_DATA;
+  else if (msg->nbytes == 3)
+    cin = MIDI_CIN_SYSCOM_3BYTE;
+  else if (msg->nbytes == 2)
+    cin = MIDI_CIN_SYSCOM_2BYTE;
+  else
+    cin = MIDI_CIN_SYSEX_END_1BYTE; // also single byte System Common
+  packet[0] = (uint8_t)((packetizer->cable << 4) | cin);
+  packet[1] = status;
+  packet[2] = msg->nbytes > 1 ? msg->bytes[1] : 0;
+  packet[3] = msg->nbytes > 2 ? msg->bytes[2] : 0;
+}
+
+// Add System Exclusive byte to packetizer. Return true and fill packet if
+// it completes one.
+static bool sysex_byte(midi_packetizer_t* packetizer, uint8_t byte, uint8_t packet[4])
+{
+  packetizer->sysex[packetizer->nsysex++] = byte;
+  if (byte != 0xF7 && packetizer->nsysex < 3)
+    return false;
+  uint8_t cin = byte == 0xF7 ? (uint8_t)(MIDI_CIN_SYSEX_START + packetizer->nsysex) : MIDI_CIN_SYSEX_START;
+  packet[0] = (uint8_t)((packetizer->cable << 4) | cin);
+  for (uint8_t idx = 0; idx < 3; idx++) {
+    packet[1 + idx] = idx < packetizer->nsysex ? packetizer->sysex[idx] : 0;
+  }
+  packetizer->nsysex = 0;
+  return true;
+}
+
+uint8_t midi_packetizer_feed(midi_packetizer_t* packetizer, uint8_t byte, uint8_t packets[2][4])
+{
+  uint8_t npackets = 0;
+  midi_msg_t msg;
+  bool done;
+  do {
+    bool in_sysex = packetizer->parser.in_sysex;
+    done = midi_msg_parser_parse(&packetizer->parser, byte, &msg);
+    if (msg.nbytes == 0)
+      continue;
+    if (msg.bytes[0] < 0xF8 && (in_sysex || msg.bytes[0] == 0xF0)) {
+      if (sysex_byte(packetizer, msg.bytes[0], packets[npackets]))
+        npackets++;
+    }
+    else {
+      msg_packet(packetizer, &msg, packets[npackets++]);
+    }
+  } while (!done);
+  return npackets;
+}
@@ -0,0 +1,60 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Turns the MIDI 1.0 byte stream from a DIN MIDI IN port into USB MIDI event
+// packets (USB MIDI 1.0 section 4), one packetizer per port. It splits the
+// stream into messages with midi_msg_parser.h, so a message sent with running
+// status gets its status byte back and every channel message packet is
+// complete. A System Real-Time byte becomes a packet of its own as soon as it
+// arrives, even in the middle of a System Exclusive message, whose bytes
+// wait in the packetizer until there are 3 of them or the message ends.
+// The packetizer keeps its own state, so unlike tud_midi_stream_write(),
+// which packs every virtual cable with one packer, the ports do not have to
+// take turns at packet boundaries.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_msg_parser.h"
+
+typedef struct {
+  midi_msg_parser_t parser;
+  uint8_t cable;        // the virtual cable number for the packets
+  uint8_t sysex[3];     // System Exclusive bytes not in a packet yet
+  uint8_t nsysex;
+} midi_packetizer_t;
+
+// Initialize packetizer to make packets for virtual cable cable
+void midi_packetizer_init(midi_packetizer_t* packetizer, uint8_t cable);
+
+// Add byte to the stream. Copy the packets it completes to packets and
+// return how many; a status byte that ends a System Exclusive message
+// without 0xF7 can complete 2.
+uint8_t midi_packetizer_feed(midi_packetizer_t* packetizer, uint8_t byte, uint8_t packets[2][4]);
+
+// Return the number of bytes of unfinished packets in packetizer
+static inline uint32_t midi_packetizer_count(const midi_packetizer_t* packetizer)
+{
+  return packetizer->parser.ndata + packetizer->nsysex;
+}
@@ -0,0 +1,150 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "pico/stdlib.h"
+#include "hardware/pio.h"
+#include "pio_midi_uart_lib.h"
+#include "midi_multi_tx.h"
+#include "midi_ports.h"
+
+static const uint8_t in_gpios[] = {CFG_MIDI_IN_GPIOS};
+static const uint8_t out_gpios[] = {CFG_MIDI_OUT_GPIOS};
+_Static_assert(sizeof(in_gpios) == MIDI_PORTS_NUM_IN, "CFG_MIDI_IN_GPIOS must list one pin per MIDI IN port");
+_Static_assert(sizeof(out_gpios) == MIDI_PORTS_NUM_OUT, "CFG_MIDI_OUT_GPIOS must list one pin per MIDI OUT port");
+_Static_assert(MIDI_PORTS_NUM_IN <= MIDI_PORTS_NUM_OUT, "each MIDI IN port needs a MIDI OUT port to share its UART");
+// Each MIDI IN port takes two state machines, and the MIDI OUT ports need at least one
+_Static_assert(2 * MIDI_PORTS_NUM_IN + (MIDI_PORTS_NUM_OUT > MIDI_PORTS_NUM_IN) <= NUM_PIOS * NUM_PIO_STATE_MACHINES,
+               "too many MIDI IN ports for the PIO state machines");
+
+midi_port_tx_t midi_ports_tx[MIDI_PORTS_NUM_OUT];
+
+static void* midi_uarts[MIDI_PORTS_NUM_IN];
+// The MIDI OUT ports after the UARTs that have a state machine each
+static void* midi_outs[MIDI_PORTS_NUM_OUT];
+static uint8_t nsingle_outs;
+static midi_multi_tx_t multi_tx;
+// The MIDI OUT ports that share multi_tx, the last ports from multi_tx_first_port on
+static uint32_t multi_tx_ports;
+static uint8_t multi_tx_first_port;
+
+static uint32_t write_uart_tx(void* port, const uint8_t* bytes, uint32_t nbytes)
+{
+  return pio_midi_uart_write_tx_buffer(port, (uint8_t*)bytes, nbytes);
+}
+
+static uint32_t write_out_tx(void* port, const uint8_t* bytes, uint32_t nbytes)
+{
+  return pio_midi_out_write_tx_buffer(port, (uint8_t*)bytes, nbytes);
+}
+
+// Return true if no MIDI pin other than the ones in gpios lies between the
+// lowest and highest of the nlines pins in gpios
+static bool pins_between_free(const uint8_t* gpios, uint8_t nlines)
+{
+  uint8_t low = 0xFF, high = 0;
+  for (uint8_t line = 0; line < nlines; line++) {
+    low = gpios[line] < low ? gpios[line] : low;
+    high = gpios[line] > high ? gpios[line] : high;
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (in_gpios[port] > low && in_gpios[port] < high)
+      return false;
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT - nlines; port++) {
+    if (out_gpios[port] > low && out_gpios[port] < high)
+      return false;
+  }
+  return true;
+}
+
+void midi_ports_init(void)
+{
+  uint8_t out_port;
+  for (out_port = 0; out_port < MIDI_PORTS_NUM_IN; out_port++) {
+    midi_uarts[out_port] = pio_midi_uart_create(out_gpios[out_port], in_gpios[out_port]);
+    midi_ports_tx[out_port].write = write_uart_tx;
+    midi_ports_tx[out_port].port = midi_uarts[out_port];
+  }
+  // A state machine each while that leaves one for all the rest
+  uint8_t nfree = NUM_PIOS * NUM_PIO_STATE_MACHINES - 2 * MIDI_PORTS_NUM_IN;
+  uint8_t nrest = MIDI_PORTS_NUM_OUT - MIDI_PORTS_NUM_IN;
+  nsingle_outs = nrest <= nfree ? nrest : nfree - 1;
+  for (uint8_t idx = 0; idx < nsingle_outs; idx++, out_port++) {
+    midi_outs[idx] = pio_midi_out_create(out_gpios[out_port]);
+    midi_ports_tx[out_port].write = write_out_tx;
+    midi_ports_tx[out_port].port = midi_outs[idx];
+  }
+  if (out_port < MIDI_PORTS_NUM_OUT) {
+    uint8_t nlines = MIDI_PORTS_NUM_OUT - out_port;
+    if (!pins_between_free(&out_gpios[out_port], nlines) ||
+        !midi_multi_tx_init(&multi_tx, &out_gpios[out_port], nlines))
+      panic("Cannot share a PIO state machine between MIDI OUT pins %u-%u", out_gpios[out_port], out_gpios[MIDI_PORTS_NUM_OUT - 1]);
+    multi_tx_first_port = out_port;
+    for (uint8_t line = 0; line < nlines; line++, out_port++) {
+      midi_ports_tx[out_port].write = midi_multi_tx_write;
+      midi_ports_tx[out_port].port = &multi_tx.lines[line];
+      multi_tx_ports |= 1u << out_port;
+    }
+  }
+}
+
+uint8_t midi_ports_poll_rx(uint8_t in_port, uint8_t* bytes, uint8_t maxbytes)
+{
+  return pio_midi_uart_poll_rx_buffer(midi_uarts[in_port], bytes, maxbytes);
+}
+
+uint32_t midi_ports_drain_tx(uint32_t out_ports)
+{
+  uint32_t waiting = 0;
+  if (out_ports & multi_tx_ports) {
+    waiting = midi_multi_tx_service(&multi_tx) << multi_tx_first_port;
+    out_ports &= ~multi_tx_ports;
+  }
+  while (out_ports) {
+    uint8_t out_port = (uint8_t)__builtin_ctz(out_ports);
+    out_ports &= out_ports - 1;
+    if (out_port < MIDI_PORTS_NUM_IN)
+      pio_midi_uart_drain_tx_buffer(midi_uarts[out_port]);
+    else
+      pio_midi_out_drain_tx_buffer(midi_outs[out_port - MIDI_PORTS_NUM_IN]);
+  }
+  return waiting;
+}
+
+void midi_ports_sys_clock_changed(uint32_t old_hz, uint32_t new_hz)
+{
+  // The MIDI ports own every state machine in use. A divider has 16 integer
+  // and 8 fraction bits.
+  PIO pios[NUM_PIOS] = {pio0, pio1};
+  for (uint8_t idx = 0; idx < NUM_PIOS; idx++) {
+    for (uint sm = 0; sm < NUM_PIO_STATE_MACHINES; sm++) {
+      if (!pio_sm_is_claimed(pios[idx], sm))
+        continue;
+      uint64_t div = pios[idx]->sm[sm].clkdiv >> PIO_SM0_CLKDIV_FRAC_LSB;
+      div = (div * new_hz + old_hz / 2) / old_hz;
+      pio_sm_set_clkdiv_int_frac(pios[idx], sm, (uint16_t)(div >> 8), (uint8_t)div);
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// The table of 5-pin DIN MIDI ports. There is one MIDI IN port per USB MIDI
+// IN virtual cable and one MIDI OUT port per USB MIDI OUT virtual cable but
+// the last, which carries routing table commands. CFG_MIDI_IN_GPIOS and
+// CFG_MIDI_OUT_GPIOS in tusb_config.h list the pins. MIDI IN port n and MIDI
+// OUT port n share a PIO MIDI UART, which takes two of the RP2040's eight PIO
+// state machines. The other MIDI OUT ports get a state machine each while
+// enough are left; then one state machine serves all the rest (See
+// midi_multi_tx.h).
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "tusb.h"
+#include "midi_out_port.h"
+
+#define MIDI_PORTS_NUM_IN   CFG_TUD_MIDI_NUMCABLES_IN
+#define MIDI_PORTS_NUM_OUT  (CFG_TUD_MIDI_NUMCABLES_OUT - 1)
+
+typedef struct {
+  midi_out_port_write_fn write;   // writes to the port's transmit buffer
+  void* port;                     // the port passed to write
+} midi_port_tx_t;
+
+// How each MIDI OUT port writes to its transmit buffer, set by midi_ports_init()
+extern midi_port_tx_t midi_ports_tx[MIDI_PORTS_NUM_OUT];
+
+// Create the ports. Their PIO interrupts run on the calling core. Stops with
+// a panic if the pins or state machines do not work out.
+void midi_ports_init(void);
+
+// Copy up to maxbytes bytes received on MIDI IN port in_port to bytes. Return the number copied.
+uint8_t midi_ports_poll_rx(uint8_t in_port, uint8_t* bytes, uint8_t maxbytes);
+
+// Move bytes from the transmit buffers of the MIDI OUT ports with bits set
+// in out_ports to the PIO state machines. Return the bits of the ports that
+// share a state machine and still have bytes in their transmit buffers. The
+// other ports' state machines drain their buffers on their own.
+uint32_t midi_ports_drain_tx(uint32_t out_ports);
+
+// Scale the clock dividers of the PIO state machines to keep the ports'
+// baud rate after clk_sys changed from old_hz to new_hz
+void midi_ports_sys_clock_changed(uint32_t old_hz, uint32_t new_hz);
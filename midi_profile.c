@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "pico/stdlib.h"
+#include "tusb.h"
+#include "midi_profile.h"
+
+#if CFG_MIDI_PROFILE
+midi_profile_t midi_profile = {
+  .version = MIDI_PROFILE_VERSION,
+};
+
+void midi_profile_init(void)
+{
+  midi_profile_reset();
+  midi_profile_start_cycles();
+}
+
+void midi_profile_start_cycles(void)
+{
+  systick_hw->csr = 0;
+  systick_hw->rvr = MIDI_PROFILE_SYSTICK_MASK;
+  systick_hw->cvr = 0;
+  systick_hw->csr = 0x5; // the processor clock, no interrupt, enabled
+}
+
+uint8_t midi_profile_add_task(const char* name)
+{
+  if (midi_profile.ntasks == MIDI_PROFILE_MAX_TASKS)
+    panic("More than %u profiled tasks", MIDI_PROFILE_MAX_TASKS);
+  uint8_t task_id = (uint8_t)midi_profile.ntasks++;
+  // Leave at least one NUL; the array starts out zeroed
+  strncpy(midi_profile.tasks[task_id].name, name, sizeof(midi_profile.tasks[task_id].name) - 1);
+  return task_id;
+}
+
+void midi_profile_count(midi_profile_hist_t* hist, uint32_t value, uint8_t shift)
+{
+  uint32_t scaled = value >> shift;
+  uint8_t bucket = scaled == 0 ? 0 : (uint8_t)(32 - __builtin_clz(scaled));
+  if (bucket >= MIDI_PROFILE_BUCKETS)
+    bucket = MIDI_PROFILE_BUCKETS - 1;
+  hist->buckets[bucket]++;
+  hist->count++;
+  if (value > hist->max)
+    hist->max = value;
+}
+
+void midi_profile_reset(void)
+{
+  memset(&midi_profile.in_latency, 0, sizeof(midi_profile.in_latency));
+  memset(&midi_profile.out_latency, 0, sizeof(midi_profile.out_latency));
+  for (uint8_t task_id = 0; task_id < MIDI_PROFILE_MAX_TASKS; task_id++) {
+    memset(&midi_profile.tasks[task_id].cycles, 0, sizeof(midi_profile.tasks[task_id].cycles));
+  }
+}
+
+void midi_profile_stream_init(midi_profile_stream_t* stream)
+{
+  atomic_init(&stream->head, 0);
+  atomic_init(&stream->tail, 0);
+  stream->count_in = stream->count_out = 0;
+}
+
+void midi_profile_stream_in(midi_profile_stream_t* stream, uint32_t nbytes, bool mark, uint32_t now_us)
+{
+  stream->count_in += nbytes;
+  if (!mark || nbytes == 0)
+    return;
+  uint32_t head = atomic_load_explicit(&stream->head, memory_order_relaxed);
+  if (head - atomic_load_explicit(&stream->tail, memory_order_acquire) == MIDI_PROFILE_MARKS)
+    return;
+  midi_profile_mark_t* added = &stream->marks[head % MIDI_PROFILE_MARKS];
+  added->count = stream->count_in;
+  added->time_us = now_us;
+  atomic_store_explicit(&stream->head, head + 1, memory_order_release);
+}
+
+void midi_profile_stream_out(midi_profile_stream_t* stream, uint32_t nbytes, uint32_t now_us, midi_profile_hist_t* hist)
+{
+  stream->count_out += nbytes;
+  uint32_t tail = atomic_load_explicit(&stream->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&stream->head, memory_order_acquire);
+  for (; tail != head; tail++) {
+    const midi_profile_mark_t* mark = &stream->marks[tail % MIDI_PROFILE_MARKS];
+    if ((int32_t)(stream->count_out - mark->count) < 0)
+      break;
+    if (hist != NULL)
+      midi_profile_count(hist, now_us - mark->time_us, MIDI_PROFILE_LATENCY_SHIFT);
+  }
+  atomic_store_explicit(&stream->tail, tail, memory_order_release);
+}
+#endif
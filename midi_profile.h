@@ -0,0 +1,174 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Latency and CPU time histograms, kept while the adapter carries MIDI data
+// so a host program can check them against latency targets on real traffic.
+// With CFG_MIDI_PROFILE set, the firmware notes the time at four places:
+// when it reads bytes from a MIDI IN port's PIO receive FIFO, when it turns
+// them into USB MIDI event packets for the USB host, when it reads bytes from
+// the USB receive FIFO, and when it writes them to a MIDI OUT port's PIO
+// transmit buffer. Each pair of places fills a histogram of the microseconds
+// between them. It also counts the CPU cycles each scheduler task (See
+// midi_sched.h) takes each time it runs, tud_task() among them, with the
+// Cortex-M0+ SysTick timer. The host reads the histograms with vendor
+// specific control requests to the telemetry interface (See
+// midi_telemetry.h). Without CFG_MIDI_PROFILE none of this is compiled in.
+//
+// Histogram bucket 0 counts the values below 2^shift, and bucket b the
+// values from 2^(b + shift - 1) up to 2^(b + shift), but the last bucket
+// counts everything larger too.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIDI_PROFILE_VERSION 1
+#define MIDI_PROFILE_BUCKETS 16
+#define MIDI_PROFILE_MAX_TASKS 10
+#define MIDI_PROFILE_LATENCY_SHIFT 4  // bucket 1 starts at 16 us
+#define MIDI_PROFILE_CYCLES_SHIFT 6   // bucket 1 starts at 64 cycles
+
+// Vendor specific control requests (bmRequestType vendor, recipient device),
+// numbered after the trace requests
+#define MIDI_PROFILE_REQUEST_GET   6 // device to host: midi_profile_t
+#define MIDI_PROFILE_REQUEST_RESET 7 // no data: empty every histogram
+
+typedef struct {
+  uint32_t count;       // values counted
+  uint32_t max;         // the largest value counted
+  uint32_t buckets[MIDI_PROFILE_BUCKETS];
+} midi_profile_hist_t;
+
+typedef struct {
+  char name[8];         // NUL padded
+  midi_profile_hist_t cycles;
+} midi_profile_task_t;
+
+typedef struct {
+  uint32_t version;                 // MIDI_PROFILE_VERSION
+  uint32_t cpu_hz;                  // the CPU clock when the host asked
+  uint32_t ntasks;                  // number of valid tasks[] entries
+  midi_profile_hist_t in_latency;   // us from MIDI IN PIO receive FIFO to USB MIDI event packet
+  midi_profile_hist_t out_latency;  // us from USB receive FIFO to MIDI OUT PIO transmit buffer
+  midi_profile_task_t tasks[MIDI_PROFILE_MAX_TASKS];
+} midi_profile_t;
+
+// Return the limit of the values in bucket of a histogram with shift shift
+static inline uint32_t midi_profile_bucket_limit(uint8_t bucket, uint8_t shift)
+{
+  return bucket + 1u < MIDI_PROFILE_BUCKETS ? 1u << (bucket + shift) : UINT32_MAX;
+}
+
+// Return a value that at least percent percent of the values in hist are
+// below: the limit of the bucket that reaches percent, or the largest value
+static inline uint32_t midi_profile_percentile(const midi_profile_hist_t* hist, uint8_t shift, uint32_t percent)
+{
+  uint64_t needed = ((uint64_t)hist->count * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (uint8_t bucket = 0; bucket < MIDI_PROFILE_BUCKETS; bucket++) {
+    seen += hist->buckets[bucket];
+    if (seen >= needed && seen > 0) {
+      uint32_t limit = midi_profile_bucket_limit(bucket, shift);
+      return limit < hist->max ? limit : hist->max;
+    }
+  }
+  return 0;
+}
+
+#if defined(CFG_MIDI_PROFILE) && CFG_MIDI_PROFILE
+#include <stdatomic.h>
+#include "hardware/structs/systick.h"
+
+#define MIDI_PROFILE_SYSTICK_MASK 0xFFFFFFu  // SysTick counts down 24 bits
+#define MIDI_PROFILE_MARKS 16
+
+extern midi_profile_t midi_profile;
+
+// Where a byte stream was when bytes came in: the stream's byte count and the time
+typedef struct {
+  uint32_t count;
+  uint32_t time_us;
+} midi_profile_mark_t;
+
+// The bytes of one stream from where they come in to where they go out. The
+// side where they come in marks each batch of bytes with the time, and the
+// side where they go out finds the marks of the bytes it passes on. Each
+// side may run on its own CPU core. When the marks are full, a batch goes
+// unmarked.
+typedef struct {
+  midi_profile_mark_t marks[MIDI_PROFILE_MARKS];
+  _Atomic uint32_t head;  // marks added; only the side bytes come in on writes this
+  _Atomic uint32_t tail;  // marks passed; only the side bytes go out on writes this
+  uint32_t count_in;      // bytes come in
+  uint32_t count_out;     // bytes gone out
+} midi_profile_stream_t;
+
+// Empty every histogram and start the SysTick timer on the calling core
+void midi_profile_init(void);
+
+// Start the SysTick timer on the calling core, which each core has its own of
+void midi_profile_start_cycles(void);
+
+// Return the task ID for a task called name for midi_profile_task_cycles().
+// Only the first 7 characters of name are kept. Stops with a panic after
+// MIDI_PROFILE_MAX_TASKS tasks.
+uint8_t midi_profile_add_task(const char* name);
+
+// Count value in hist, which has shift shift
+void midi_profile_count(midi_profile_hist_t* hist, uint32_t value, uint8_t shift);
+
+// Empty every histogram
+void midi_profile_reset(void);
+
+// Return the SysTick count, which counts down once per CPU cycle
+static inline uint32_t midi_profile_cycles(void)
+{
+  return systick_hw->cvr;
+}
+
+// Count the CPU cycles since midi_profile_cycles() returned start for task
+// task_id. The count wraps around every 2^24 cycles.
+static inline void midi_profile_task_cycles(uint8_t task_id, uint32_t start)
+{
+  uint32_t cycles = (start - midi_profile_cycles()) & MIDI_PROFILE_SYSTICK_MASK;
+  midi_profile_count(&midi_profile.tasks[task_id].cycles, cycles, MIDI_PROFILE_CYCLES_SHIFT);
+}
+
+void midi_profile_stream_init(midi_profile_stream_t* stream);
+
+// The side bytes come in on: nbytes bytes came in at now_us. If mark is
+// false, they only count so that the marks after them line up.
+void midi_profile_stream_in(midi_profile_stream_t* stream, uint32_t nbytes, bool mark, uint32_t now_us);
+
+// The side bytes go out on: nbytes bytes went out at now_us. Count the
+// microseconds since each batch they finish came in, in hist, unless hist
+// is NULL.
+void midi_profile_stream_out(midi_profile_stream_t* stream, uint32_t nbytes, uint32_t now_us, midi_profile_hist_t* hist);
+#else
+#define midi_profile_init() do {} while (0)
+#define midi_profile_start_cycles() do {} while (0)
+#define midi_profile_stream_init(stream) do {} while (0)
+#define midi_profile_stream_in(stream, nbytes, mark, now_us) do {} while (0)
+#define midi_profile_stream_out(stream, nbytes, now_us, hist) do {} while (0)
+#endif
@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "tusb.h"
+#include "hardware/flash.h"
+#include "hardware/sync.h"
+#include "midi_route_flash.h"
+#if CFG_MIDI_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+
+#define ROUTE_FLASH_OFFSET (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#define ROUTE_FLASH_MAGIC 0x4D525442u
+
+typedef struct {
+  uint32_t magic;             // ROUTE_FLASH_MAGIC
+  midi_route_table_t table;
+  uint8_t checksum;           // makes the bytes of table add up to 0
+} route_flash_record_t;
+
+_Static_assert(sizeof(route_flash_record_t) <= FLASH_PAGE_SIZE, "the routing table must fit in one flash page");
+
+static uint8_t table_checksum(const midi_route_table_t* table)
+{
+  const uint8_t* bytes = (const uint8_t*)table;
+  uint8_t sum = 0;
+  for (uint32_t idx = 0; idx < sizeof(*table); idx++) {
+    sum += bytes[idx];
+  }
+  return (uint8_t)-sum;
+}
+
+bool midi_route_flash_load(midi_route_table_t* table)
+{
+  const route_flash_record_t* record = (const route_flash_record_t*)(XIP_BASE + ROUTE_FLASH_OFFSET);
+  if (record->magic != ROUTE_FLASH_MAGIC || record->checksum != table_checksum(&record->table) ||
+      !midi_route_table_valid(&record->table))
+    return false;
+  memcpy(table, &record->table, sizeof(*table));
+  return true;
+}
+
+void midi_route_flash_save(const midi_route_table_t* table)
+{
+  static uint8_t page[FLASH_PAGE_SIZE];
+  route_flash_record_t record;
+  memset(&record, 0, sizeof(record));
+  record.magic = ROUTE_FLASH_MAGIC;
+  // Sum the bytes that go to flash, padding included, not the caller's copy,
+  // whose padding a struct assignment need not carry over
+  memcpy(&record.table, table, sizeof(*table));
+  record.checksum = table_checksum(&record.table);
+  memset(page, 0xFF, sizeof(page));
+  memcpy(page, &record, sizeof(record));
+  if (memcmp(page, (const void*)(XIP_BASE + ROUTE_FLASH_OFFSET), sizeof(page)) == 0)
+    return; // already saved; do not wear out the flash
+#if CFG_MIDI_DUAL_CORE
+  // Core 1 runs from flash too
+  multicore_lockout_start_blocking();
+#endif
+  uint32_t ints = save_and_disable_interrupts();
+  flash_range_erase(ROUTE_FLASH_OFFSET, FLASH_SECTOR_SIZE);
+  flash_range_program(ROUTE_FLASH_OFFSET, page, FLASH_PAGE_SIZE);
+  restore_interrupts(ints);
+#if CFG_MIDI_DUAL_CORE
+  multicore_lockout_end_blocking();
+#endif
+}
@@ -0,0 +1,148 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "tusb.h"
+#include "midi_route_table.h"
+
+midi_route_table_t midi_route_table;
+
+void midi_route_table_defaults(midi_route_table_t* table)
+{
+  table->version = MIDI_ROUTE_TABLE_VERSION;
+  for (uint8_t cable = 0; cable < MIDI_ROUTE_MAX_CABLES; cable++) {
+    table->cable_ports[cable] = cable < MIDI_PORTS_NUM_OUT ? cable : MIDI_ROUTE_NONE;
+  }
+  static const uint16_t thru_ports[MIDI_PORTS_NUM_IN] = {CFG_MIDI_THRU_ROUTES};
+  memcpy(table->thru_ports, thru_ports, sizeof(thru_ports));
+  // The low half of each setting has the types, the high half the channels
+  static const uint32_t out_filters[MIDI_PORTS_NUM_OUT] = {CFG_MIDI_OUT_FILTERS};
+  static const uint32_t in_filters[MIDI_PORTS_NUM_IN] = {CFG_MIDI_IN_FILTERS};
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_OUT; port++) {
+    table->out_filters[port].types = (uint16_t)out_filters[port];
+    table->out_filters[port].channels = (uint16_t)(out_filters[port] >> 16);
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    table->in_filters[port].types = (uint16_t)in_filters[port];
+    table->in_filters[port].channels = (uint16_t)(in_filters[port] >> 16);
+  }
+}
+
+bool midi_route_table_valid(const midi_route_table_t* table)
+{
+  if (table->version != MIDI_ROUTE_TABLE_VERSION)
+    return false;
+  for (uint8_t cable = 0; cable < MIDI_ROUTE_MAX_CABLES; cable++) {
+    if (table->cable_ports[cable] >= MIDI_PORTS_NUM_OUT && table->cable_ports[cable] != MIDI_ROUTE_NONE)
+      return false;
+  }
+  for (uint8_t port = 0; port < MIDI_PORTS_NUM_IN; port++) {
+    if (table->thru_ports[port] >> MIDI_PORTS_NUM_OUT)
+      return false;
+  }
+  return true;
+}
+
+// Return the 16-bit mask in the 3 bytes at msg, or more than 16 bits if the
+// bytes do not hold one
+static uint32_t get_mask16(const uint8_t* msg)
+{
+  return msg[0] | ((uint32_t)msg[1] << 7) | ((uint32_t)msg[2] << 14);
+}
+
+// Apply the command in msg, which holds nbytes bytes from 0xF0 to 0xF7
+static midi_route_config_result_t apply_command(midi_route_table_t* table, const uint8_t* msg, uint8_t nbytes)
+{
+  if (nbytes < 4 || msg[1] != MIDI_ROUTE_SYSEX_ID)
+    return MIDI_ROUTE_CONFIG_NONE;
+  switch (msg[2]) {
+    case MIDI_ROUTE_CMD_SET_CABLE:
+      if (nbytes != 6 || msg[3] >= MIDI_ROUTE_MAX_CABLES ||
+          (msg[4] >= MIDI_PORTS_NUM_OUT && msg[4] != MIDI_ROUTE_NONE))
+        return MIDI_ROUTE_CONFIG_NONE;
+      table->cable_ports[msg[3]] = msg[4];
+      return MIDI_ROUTE_CONFIG_CHANGED;
+    case MIDI_ROUTE_CMD_SET_THRU: {
+      if (nbytes != 8 || msg[3] >= MIDI_PORTS_NUM_IN)
+        return MIDI_ROUTE_CONFIG_NONE;
+      uint32_t ports = get_mask16(&msg[4]);
+      if (ports >> MIDI_PORTS_NUM_OUT)
+        return MIDI_ROUTE_CONFIG_NONE;
+      table->thru_ports[msg[3]] = (uint16_t)ports;
+      return MIDI_ROUTE_CONFIG_CHANGED;
+    }
+    case MIDI_ROUTE_CMD_SAVE:
+      return nbytes == 4 ? MIDI_ROUTE_CONFIG_SAVE : MIDI_ROUTE_CONFIG_NONE;
+    case MIDI_ROUTE_CMD_DEFAULTS:
+      if (nbytes != 4)
+        return MIDI_ROUTE_CONFIG_NONE;
+      midi_route_table_defaults(table);
+      return MIDI_ROUTE_CONFIG_CHANGED;
+    case MIDI_ROUTE_CMD_SET_OUT_FILTER:
+    case MIDI_ROUTE_CMD_SET_IN_FILTER: {
+      bool out = msg[2] == MIDI_ROUTE_CMD_SET_OUT_FILTER;
+      if (nbytes != 11 || msg[3] >= (out ? MIDI_PORTS_NUM_OUT : MIDI_PORTS_NUM_IN))
+        return MIDI_ROUTE_CONFIG_NONE;
+      uint32_t types = get_mask16(&msg[4]);
+      uint32_t channels = get_mask16(&msg[7]);
+      if ((types | channels) >> 16)
+        return MIDI_ROUTE_CONFIG_NONE;
+      midi_filter_setting_t* setting = out ? &table->out_filters[msg[3]] : &table->in_filters[msg[3]];
+      setting->types = (uint16_t)types;
+      setting->channels = (uint16_t)channels;
+      return MIDI_ROUTE_CONFIG_CHANGED;
+    }
+    default:
+      return MIDI_ROUTE_CONFIG_NONE;
+  }
+}
+
+midi_route_config_result_t midi_route_config_write(midi_route_config_t* config, midi_route_table_t* table,
+                                                   const uint8_t* bytes, uint32_t nbytes)
+{
+  midi_route_config_result_t result = MIDI_ROUTE_CONFIG_NONE;
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    uint8_t byte = bytes[idx];
+    if (byte >= 0xF8)
+      continue; // System Real-Time
+    if (byte == 0xF0)
+      config->nbytes = 0;
+    else if (config->nbytes == 0)
+      continue; // not in a System Exclusive message
+    if (config->nbytes < sizeof(config->msg))
+      config->msg[config->nbytes] = byte;
+    if (config->nbytes < 0xFF)
+      config->nbytes++;
+    if (byte == 0xF7 || (byte >= 0x80 && byte != 0xF0)) {
+      if (byte == 0xF7 && config->nbytes <= sizeof(config->msg)) {
+        midi_route_config_result_t applied = apply_command(table, config->msg, config->nbytes);
+        if (applied > result)
+          result = applied;
+      }
+      config->nbytes = 0;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,117 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// The routing table says where the MIDI data from each source goes. The
+// firmware keeps it in RAM, so a route lookup is one indexed load, and the
+// host rewrites it with System Exclusive commands on the MIDI CONFIG virtual
+// cable. A command changes a few table bytes between two USB MIDI packets, so
+// it never holds up the MIDI data on the other cables. A save command writes
+// the table to flash, and the firmware loads it from there at boot.
+//
+// Every command is a System Exclusive message with the non-commercial
+// manufacturer ID 0x7D:
+//
+//   F0 7D 01 <cable> <port> F7  send USB MIDI OUT virtual cable <cable> to MIDI
+//                               OUT port <port> (0 is MIDI OUT A), or nowhere
+//                               if <port> is MIDI_ROUTE_NONE
+//   F0 7D 02 <in> <p0> <p1> <p2> F7
+//                               send a copy of MIDI IN port <in> (0 is MIDI IN
+//                               A) to the MIDI OUT ports in a bit mask: bits
+//                               0-6 in <p0>, 7-13 in <p1> and 14-15 in <p2>
+//   F0 7D 03 F7                 save the table to flash
+//   F0 7D 04 F7                 go back to the default table
+//   F0 7D 05 <out> <t0> <t1> <t2> <c0> <c1> <c2> F7
+//                               set the filter of MIDI OUT port <out>: drop
+//                               the message types in a bit mask of
+//                               MIDI_FILTER_* bits (see midi_filter.h), bits
+//                               0-6 in <t0>, 7-13 in <t1> and 14-15 in <t2>,
+//                               and the channel voice messages on the MIDI
+//                               channels in a bit mask, bit 0 for channel 1,
+//                               in <c0> <c1> <c2> the same way
+//   F0 7D 06 <in> <t0> <t1> <t2> <c0> <c1> <c2> F7
+//                               set the filter of the messages from MIDI IN
+//                               port <in> to the USB host the same way
+//
+// Commands with bad arguments and other messages are ignored.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_ports.h"
+#include "midi_filter.h"
+
+#define MIDI_ROUTE_TABLE_VERSION    3
+#define MIDI_ROUTE_MAX_CABLES       16
+#define MIDI_ROUTE_NONE             0x7F  // a cable that goes nowhere
+
+#define MIDI_ROUTE_SYSEX_ID         0x7D
+#define MIDI_ROUTE_CMD_SET_CABLE    1
+#define MIDI_ROUTE_CMD_SET_THRU     2
+#define MIDI_ROUTE_CMD_SAVE         3
+#define MIDI_ROUTE_CMD_DEFAULTS     4
+#define MIDI_ROUTE_CMD_SET_OUT_FILTER 5
+#define MIDI_ROUTE_CMD_SET_IN_FILTER  6
+
+typedef struct {
+  uint8_t version;                          // MIDI_ROUTE_TABLE_VERSION
+  uint8_t cable_ports[MIDI_ROUTE_MAX_CABLES]; // MIDI OUT port for each USB MIDI OUT virtual cable
+  uint16_t thru_ports[MIDI_PORTS_NUM_IN];     // bit mask of MIDI OUT ports for each MIDI IN port
+  midi_filter_setting_t out_filters[MIDI_PORTS_NUM_OUT]; // what each MIDI OUT port drops
+  midi_filter_setting_t in_filters[MIDI_PORTS_NUM_IN];   // what each MIDI IN port does not send the USB host
+} midi_route_table_t;
+
+// What a command did to the table
+typedef enum {
+  MIDI_ROUTE_CONFIG_NONE,     // nothing yet
+  MIDI_ROUTE_CONFIG_CHANGED,  // the routes changed
+  MIDI_ROUTE_CONFIG_SAVE,     // the caller should save the table
+} midi_route_config_result_t;
+
+// Collects the command bytes from the MIDI CONFIG virtual cable
+typedef struct {
+  uint8_t msg[11];
+  uint8_t nbytes;   // bytes in msg; more than sizeof(msg) if the message is too long
+} midi_route_config_t;
+
+// The routing table the firmware uses
+extern midi_route_table_t midi_route_table;
+
+// Set table to the default routes: virtual cable n to MIDI OUT port n for the
+// ports that exist, the thru routes from CFG_MIDI_THRU_ROUTES, and the
+// filters from CFG_MIDI_OUT_FILTERS and CFG_MIDI_IN_FILTERS
+void midi_route_table_defaults(midi_route_table_t* table);
+
+// Return true if table is a valid routing table for this firmware
+bool midi_route_table_valid(const midi_route_table_t* table);
+
+static inline void midi_route_config_init(midi_route_config_t* config)
+{
+  config->nbytes = 0;
+}
+
+// Parse nbytes MIDI stream bytes from the MIDI CONFIG virtual cable and apply
+// each complete command to table. Return what the commands did; a save
+// command wins over a change.
+midi_route_config_result_t midi_route_config_write(midi_route_config_t* config, midi_route_table_t* table,
+                                                   const uint8_t* bytes, uint32_t nbytes);
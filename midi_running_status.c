@@ -0,0 +1,64 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_running_status.h"
+
+// Follow byte. Return false if the receiver already has it.
+static bool encode_byte(midi_running_status_t* rs, uint8_t byte)
+{
+  if (byte < 0x80) {
+    // data byte
+  }
+  else if (byte < 0xF0) {
+    if (byte == rs->status)
+      return false; // the receiver already has this status byte
+    rs->status = byte; // channel message status
+  }
+  else if (byte < 0xF8) {
+    rs->status = 0; // System Exclusive and System Common cancel running status
+  }
+  // System Real-Time messages leave running status alone
+  return true;
+}
+
+uint32_t midi_running_status_encode(midi_running_status_t* rs, const uint8_t* bytes, uint32_t nbytes, uint8_t* encoded)
+{
+  uint32_t nencoded = 0;
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    if (encode_byte(rs, bytes[idx]))
+      encoded[nencoded++] = bytes[idx];
+  }
+  return nencoded;
+}
+
+uint32_t midi_running_status_skip(midi_running_status_t* rs, const uint8_t* bytes, uint32_t nbytes, uint32_t nencoded)
+{
+  uint32_t idx;
+  for (idx = 0; idx < nbytes && nencoded > 0; idx++) {
+    if (encode_byte(rs, bytes[idx]))
+      nencoded--;
+  }
+  return idx;
+}
@@ -0,0 +1,55 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// A MIDI 1.0 running status encoder for a MIDI OUT port. It removes each
+// channel message status byte that repeats the previous channel message
+// status byte sent on the port. Following the MIDI 1.0 specification,
+// System Exclusive and System Common messages cancel running status, so the
+// encoder sends the next channel message status byte, while System Real-Time
+// messages do not affect it.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+  uint8_t status;   // the running status byte, or 0 if there is none
+} midi_running_status_t;
+
+// Forget the running status so the next channel message goes out with its status byte
+static inline void midi_running_status_reset(midi_running_status_t* rs)
+{
+  rs->status = 0;
+}
+
+// Copy the MIDI stream bytes in bytes to encoded without the status bytes
+// running status makes redundant. encoded must have room for nbytes bytes.
+// Return the number of bytes stored in encoded.
+uint32_t midi_running_status_encode(midi_running_status_t* rs, const uint8_t* bytes, uint32_t nbytes, uint8_t* encoded);
+
+// For when the consumer of the bytes midi_running_status_encode() stored
+// took only the first nencoded of them: with rs as it was before that call,
+// follow bytes up to the nencoded'th byte the encoder keeps. Return how many
+// bytes that is. The rest of bytes must be encoded again.
+uint32_t midi_running_status_skip(midi_running_status_t* rs, const uint8_t* bytes, uint32_t nbytes, uint32_t nencoded);
@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "pico/stdlib.h"
+#include "midi_sched.h"
+
+void midi_sched_init(midi_sched_t* sched, uint32_t (*now_us)(void))
+{
+  memset(sched, 0, sizeof(*sched));
+  sched->now_us = now_us;
+}
+
+uint8_t midi_sched_add_task(midi_sched_t* sched, midi_sched_task_fn fn, void* context, uint32_t budget_us)
+{
+  if (sched->ntasks == MIDI_SCHED_MAX_TASKS)
+    panic("More than %u scheduler tasks", MIDI_SCHED_MAX_TASKS);
+  uint8_t task_id = sched->ntasks++;
+  sched->tasks[task_id].fn = fn;
+  sched->tasks[task_id].context = context;
+  sched->tasks[task_id].budget_us = budget_us;
+  return task_id;
+}
+
+bool midi_sched_has_pending(const midi_sched_t* sched)
+{
+  for (uint8_t task_id = 0; task_id < sched->ntasks; task_id++) {
+    if (sched->pending[task_id])
+      return true;
+  }
+  return false;
+}
+
+bool midi_sched_run(midi_sched_t* sched)
+{
+  bool ran = false;
+  for (uint8_t task_id = 0; task_id < sched->ntasks; task_id++) {
+    if (sched->pending[task_id]) {
+      // Clear the flag before the task runs so a post while it runs is not lost
+      sched->pending[task_id] = 0;
+      const midi_sched_task_t* task = &sched->tasks[task_id];
+      if (task->fn(task->context, sched->now_us() + task->budget_us))
+        sched->pending[task_id] = 1;
+      ran = true;
+    }
+  }
+  return ran;
+}
@@ -0,0 +1,86 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// A small run-to-completion task scheduler. Interrupt handlers, callbacks and
+// other tasks post tasks to mark work as pending; midi_sched_run() runs only
+// the pending tasks, in the order they were added, so the order they were
+// added is their priority. Each task gets a deadline from its time budget and
+// should stop working when the deadline passes. A task that stops with work
+// left returns true to run again on the next pass.
+//
+// Posting a task only writes one byte, so interrupt handlers and the other
+// CPU core may call midi_sched_post() without locks.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef MIDI_SCHED_MAX_TASKS
+#define MIDI_SCHED_MAX_TASKS 8
+#endif
+
+// Do some work before the time_us_32() style timestamp deadline_us.
+// context is the context pointer passed to midi_sched_add_task().
+// Return true if there is more work to do.
+typedef bool (*midi_sched_task_fn)(void* context, uint32_t deadline_us);
+
+typedef struct {
+  midi_sched_task_fn fn;
+  void* context;
+  uint32_t budget_us;
+} midi_sched_task_t;
+
+typedef struct {
+  midi_sched_task_t tasks[MIDI_SCHED_MAX_TASKS];
+  volatile uint8_t pending[MIDI_SCHED_MAX_TASKS];
+  uint8_t ntasks;
+  uint32_t (*now_us)(void); // microsecond time source
+} midi_sched_t;
+
+// Initialize sched with no tasks. now_us returns the current time in microseconds.
+void midi_sched_init(midi_sched_t* sched, uint32_t (*now_us)(void));
+
+// Add a task that runs fn(context, deadline) with a deadline budget_us
+// microseconds after the task starts. Tasks added first run first.
+// Return the task ID to pass to midi_sched_post(). Stops with a panic after
+// MIDI_SCHED_MAX_TASKS tasks.
+uint8_t midi_sched_add_task(midi_sched_t* sched, midi_sched_task_fn fn, void* context, uint32_t budget_us);
+
+// Mark task task_id as having work to do. Safe to call from interrupt handlers.
+static inline void midi_sched_post(midi_sched_t* sched, uint8_t task_id)
+{
+  sched->pending[task_id] = 1;
+}
+
+// Return true if any task has work to do
+bool midi_sched_has_pending(const midi_sched_t* sched);
+
+// Run every pending task once, in priority order. Return true if any task ran.
+bool midi_sched_run(midi_sched_t* sched);
+
+// Return true if the time is at or past deadline_us
+static inline bool midi_sched_deadline_passed(const midi_sched_t* sched, uint32_t deadline_us)
+{
+  return (int32_t)(sched->now_us() - deadline_us) >= 0;
+}
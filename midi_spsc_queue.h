@@ -0,0 +1,148 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// A lock-free single-producer/single-consumer byte queue. One thread of
+// execution (a CPU core, or a thread on a host computer) may push bytes while
+// one other thread pops them, with no locks and no critical sections. It only
+// needs C11 atomic loads and stores of 32-bit values, which the RP2040's
+// Cortex-M0+ cores support, so the same code runs on a Pico and on Linux.
+//
+// The head and tail indices count bytes pushed and popped since the queue was
+// initialized and wrap around at 2^32. The buffer size must be a power of 2 so
+// that the indices map to buffer locations with a mask.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+typedef struct {
+  uint8_t* buf;
+  uint32_t mask;           // buffer size - 1
+  _Atomic uint32_t head;   // only the producer writes this
+  _Atomic uint32_t tail;   // only the consumer writes this
+} midi_spsc_queue_t;
+
+// Initialize queue to use buf, which must hold bufsize bytes; bufsize must be a power of 2
+static inline void midi_spsc_queue_init(midi_spsc_queue_t* queue, uint8_t* buf, uint32_t bufsize)
+{
+  queue->buf = buf;
+  queue->mask = bufsize - 1;
+  atomic_init(&queue->head, 0);
+  atomic_init(&queue->tail, 0);
+}
+
+// Return the number of bytes the queue can hold
+static inline uint32_t midi_spsc_queue_size(const midi_spsc_queue_t* queue)
+{
+  return queue->mask + 1;
+}
+
+// Return the number of bytes in the queue. The producer sees at least
+// this many bytes and the consumer sees at most this many.
+static inline uint32_t midi_spsc_queue_count(midi_spsc_queue_t* queue)
+{
+  return atomic_load_explicit(&queue->head, memory_order_acquire) -
+    atomic_load_explicit(&queue->tail, memory_order_acquire);
+}
+
+// Producer only: return the number of bytes that can be pushed
+static inline uint32_t midi_spsc_queue_space(midi_spsc_queue_t* queue)
+{
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  return queue->mask + 1 - (head - tail);
+}
+
+// Producer only: copy up to nbytes bytes to the queue. Return the number of bytes copied.
+static inline uint32_t midi_spsc_queue_push(midi_spsc_queue_t* queue, const uint8_t* bytes, uint32_t nbytes)
+{
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_acquire);
+  uint32_t space = queue->mask + 1 - (head - tail);
+  if (nbytes > space)
+    nbytes = space;
+  uint32_t idx = head & queue->mask;
+  uint32_t first = queue->mask + 1 - idx;
+  if (first > nbytes)
+    first = nbytes;
+  memcpy(queue->buf + idx, bytes, first);
+  memcpy(queue->buf, bytes + first, nbytes - first);
+  atomic_store_explicit(&queue->head, head + nbytes, memory_order_release);
+  return nbytes;
+}
+
+// Consumer only: set *bytes to point to the oldest bytes in the queue and return
+// how many bytes are stored contiguously there. Call midi_spsc_queue_consume()
+// after using them. This lets the consumer pass the bytes on without a copy.
+static inline uint32_t midi_spsc_queue_peek(midi_spsc_queue_t* queue, const uint8_t** bytes)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  uint32_t idx = tail & queue->mask;
+  uint32_t count = head - tail;
+  uint32_t contiguous = queue->mask + 1 - idx;
+  *bytes = queue->buf + idx;
+  return count < contiguous ? count : contiguous;
+}
+
+// Consumer only: like midi_spsc_queue_peek(), but skip the first offset bytes
+// in the queue, which must hold at least that many. This lets the consumer
+// read the queue at two places and consume only what both have finished with.
+static inline uint32_t midi_spsc_queue_peek_at(midi_spsc_queue_t* queue, uint32_t offset, const uint8_t** bytes)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed) + offset;
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  uint32_t idx = tail & queue->mask;
+  uint32_t count = head - tail;
+  uint32_t contiguous = queue->mask + 1 - idx;
+  *bytes = queue->buf + idx;
+  return count < contiguous ? count : contiguous;
+}
+
+// Consumer only: remove nbytes bytes returned by midi_spsc_queue_peek() from the queue
+static inline void midi_spsc_queue_consume(midi_spsc_queue_t* queue, uint32_t nbytes)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  atomic_store_explicit(&queue->tail, tail + nbytes, memory_order_release);
+}
+
+// Consumer only: copy up to maxbytes bytes out of the queue. Return the number of bytes copied.
+static inline uint32_t midi_spsc_queue_pop(midi_spsc_queue_t* queue, uint8_t* bytes, uint32_t maxbytes)
+{
+  uint32_t tail = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+  uint32_t head = atomic_load_explicit(&queue->head, memory_order_acquire);
+  uint32_t count = head - tail;
+  if (maxbytes > count)
+    maxbytes = count;
+  uint32_t idx = tail & queue->mask;
+  uint32_t first = queue->mask + 1 - idx;
+  if (first > maxbytes)
+    first = maxbytes;
+  memcpy(bytes, queue->buf + idx, first);
+  memcpy(bytes + first, queue->buf, maxbytes - first);
+  atomic_store_explicit(&queue->tail, tail + maxbytes, memory_order_release);
+  return maxbytes;
+}
@@ -0,0 +1,91 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <stddef.h>
+#include <string.h>
+#include "tusb.h"
+#include "midi_telemetry.h"
+#include "midi_trace.h"
+#include "midi_profile.h"
+#if CFG_MIDI_PROFILE
+#include "hardware/clocks.h"
+#endif
+
+midi_telemetry_t midi_telemetry = {
+  .version = MIDI_TELEMETRY_VERSION,
+  .num_cables_out = CFG_TUD_MIDI_NUMCABLES_OUT,
+  .num_cables_in = CFG_TUD_MIDI_NUMCABLES_IN,
+};
+
+void midi_telemetry_reset(void)
+{
+  memset(&midi_telemetry.usb_out_packets, 0, sizeof(midi_telemetry) - offsetof(midi_telemetry_t, usb_out_packets));
+}
+
+// Invoked when the device receives a vendor specific control request
+bool tud_vendor_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request)
+{
+  // A copy of the counters so they do not change while the host reads them
+  static midi_telemetry_t snapshot;
+  if (stage != CONTROL_STAGE_SETUP)
+    return true;
+  switch (request->bRequest) {
+    case MIDI_TELEMETRY_REQUEST_GET:
+      memcpy(&snapshot, &midi_telemetry, sizeof(snapshot));
+      return tud_control_xfer(rhport, request, &snapshot, (uint16_t)tu_min32(request->wLength, sizeof(snapshot)));
+    case MIDI_TELEMETRY_REQUEST_RESET:
+      midi_telemetry_reset();
+      return tud_control_status(rhport, request);
+#if CFG_MIDI_TRACE
+    case MIDI_TRACE_REQUEST_FREEZE:
+      midi_trace_freeze();
+      return tud_control_status(rhport, request);
+    case MIDI_TRACE_REQUEST_READ: {
+      // The records stay put while recording is off, so send them from the ring
+      const midi_trace_record_t* records = NULL;
+      midi_trace_freeze();
+      uint32_t count = midi_trace_peek(request->wValue, &records);
+      uint32_t nbytes = tu_min32(count * sizeof(midi_trace_record_t), request->wLength / sizeof(midi_trace_record_t) * sizeof(midi_trace_record_t));
+      return tud_control_xfer(rhport, request, (void*)records, (uint16_t)nbytes);
+    }
+    case MIDI_TRACE_REQUEST_START:
+      midi_trace_start();
+      return tud_control_status(rhport, request);
+#endif
+#if CFG_MIDI_PROFILE
+    case MIDI_PROFILE_REQUEST_GET: {
+      static midi_profile_t profile;
+      memcpy(&profile, &midi_profile, sizeof(profile));
+      profile.cpu_hz = clock_get_hz(clk_sys);
+      return tud_control_xfer(rhport, request, &profile, (uint16_t)tu_min32(request->wLength, sizeof(profile)));
+    }
+    case MIDI_PROFILE_REQUEST_RESET:
+      midi_profile_reset();
+      return tud_control_status(rhport, request);
+#endif
+    default:
+      return false; // stall unknown requests
+  }
+}
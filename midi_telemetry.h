@@ -0,0 +1,70 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Traffic and drop counters for each virtual cable, kept all the time so a
+// host program can read them while the adapter carries MIDI data. The host
+// reads them with vendor specific control requests to the USB device (see
+// midi_telemetry.c). Every field is a little endian 32-bit word, and only
+// one CPU core writes each field, so updating a counter is one load, add and
+// store with no locks.
+#pragma once
+#include <stdint.h>
+
+#define MIDI_TELEMETRY_VERSION 2
+#define MIDI_TELEMETRY_MAX_CABLES 16
+
+// Vendor specific control requests (bmRequestType vendor, recipient device)
+#define MIDI_TELEMETRY_REQUEST_GET   1 // device to host: midi_telemetry_t
+#define MIDI_TELEMETRY_REQUEST_RESET 2 // no data: set all counters to 0
+
+typedef struct {
+  uint32_t bytes;       // MIDI stream bytes delivered
+  uint32_t dropped;     // MIDI stream bytes thrown away
+  uint32_t high_water;  // the most bytes waiting in the port's buffer or queue at once
+  uint32_t filtered;    // MIDI stream bytes the port's filter dropped (See midi_filter.h)
+} midi_telemetry_cable_t;
+
+typedef struct {
+  uint32_t version;                 // MIDI_TELEMETRY_VERSION
+  uint32_t num_cables_out;          // number of valid out[] entries
+  uint32_t num_cables_in;           // number of valid in[] entries
+  uint32_t usb_out_packets;         // USB MIDI event packets received from the host
+  uint32_t usb_out_fifo_high_water; // the most bytes in the USB MIDI receive FIFO at once
+  uint32_t usb_out_stalls;          // USB receive task runs a full MIDI OUT queue cut short
+  midi_telemetry_cable_t out[MIDI_TELEMETRY_MAX_CABLES]; // USB host to MIDI OUT ports
+  midi_telemetry_cable_t in[MIDI_TELEMETRY_MAX_CABLES];  // MIDI IN ports to USB host
+} midi_telemetry_t;
+
+extern midi_telemetry_t midi_telemetry;
+
+// Set every counter to 0
+void midi_telemetry_reset(void);
+
+// Raise high_water to value if value is higher
+static inline void midi_telemetry_high_water(uint32_t* high_water, uint32_t value)
+{
+  if (value > *high_water)
+    *high_water = value;
+}
@@ -0,0 +1,213 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "midi_timed_out.h"
+
+// The adapter's time in host time units, which wraps like the host's
+static inline uint16_t ticks(uint32_t now_us)
+{
+  return (uint16_t)(now_us / MIDI_TIMED_TICK_US);
+}
+
+void midi_timed_clock_sync(midi_timed_clock_t* clock, uint16_t host_time, uint32_t now_us)
+{
+  uint16_t offset = (uint16_t)(ticks(now_us) - host_time);
+  int16_t change = (int16_t)(offset - clock->offset);
+  if (!clock->synced || change < 0 || change > MIDI_TIMED_RESYNC_TICKS) {
+    // A clock message that took less time to arrive, or a new time base
+    clock->offset = offset;
+    clock->synced = true;
+  }
+  else if (change > 0) {
+    // Creep toward larger offsets, in case the host's clock runs slow
+    clock->offset++;
+  }
+}
+
+uint32_t midi_timed_clock_deadline(midi_timed_clock_t* clock, uint16_t host_time, uint32_t now_us)
+{
+  if (!clock->synced)
+    midi_timed_clock_sync(clock, host_time, now_us);
+  int16_t ahead = (int16_t)(host_time + clock->offset - ticks(now_us));
+  if (ahead <= 0)
+    return now_us; // late
+  return now_us - now_us % MIDI_TIMED_TICK_US + (uint32_t)ahead * MIDI_TIMED_TICK_US;
+}
+
+// Return true if event a goes out before event b
+static bool before(const midi_timed_event_t* a, const midi_timed_event_t* b)
+{
+  int32_t diff = (int32_t)(a->due_us - b->due_us);
+  return diff < 0 || (diff == 0 && (int16_t)(a->seq - b->seq) < 0);
+}
+
+void midi_timed_queue_init(midi_timed_queue_t* queue, midi_timed_event_t* events, uint16_t size)
+{
+  queue->events = events;
+  queue->size = size;
+  queue->count = 0;
+  queue->next_seq = 0;
+}
+
+bool midi_timed_queue_push(midi_timed_queue_t* queue, uint32_t due_us, uint8_t cable_num, const uint8_t* bytes,
+                           uint8_t nbytes)
+{
+  if (queue->count == queue->size || nbytes > sizeof(queue->events[0].bytes))
+    return false;
+  midi_timed_event_t event = {.due_us = due_us, .seq = queue->next_seq++, .cable_num = cable_num, .nbytes = nbytes};
+  for (uint8_t idx = 0; idx < nbytes; idx++) {
+    event.bytes[idx] = bytes[idx];
+  }
+  // Sift up from the new leaf
+  uint16_t idx = queue->count++;
+  while (idx > 0) {
+    uint16_t parent = (uint16_t)((idx - 1) / 2);
+    if (!before(&event, &queue->events[parent]))
+      break;
+    queue->events[idx] = queue->events[parent];
+    idx = parent;
+  }
+  queue->events[idx] = event;
+  return true;
+}
+
+void midi_timed_queue_pop(midi_timed_queue_t* queue)
+{
+  if (queue->count == 0)
+    return;
+  // Sift the last leaf down from the root
+  midi_timed_event_t last = queue->events[--queue->count];
+  uint16_t idx = 0;
+  while (1) {
+    uint32_t child = 2u * idx + 1;
+    if (child >= queue->count)
+      break;
+    if (child + 1 < queue->count && before(&queue->events[child + 1], &queue->events[child]))
+      child++;
+    if (!before(&queue->events[child], &last))
+      break;
+    queue->events[idx] = queue->events[child];
+    idx = (uint16_t)child;
+  }
+  queue->events[idx] = last;
+}
+
+uint8_t midi_timed_msg_len(uint8_t status)
+{
+  if (status < 0xF0)
+    return (status & 0xE0) == 0xC0 ? 2 : 3;
+  switch (status) {
+    case 0xF0:
+    case 0xF7:
+      return 0;
+    case 0xF1:
+    case 0xF3:
+      return 2;
+    case 0xF2:
+      return 3;
+    default:
+      return 1;
+  }
+}
+
+uint32_t midi_timed_rx_next(midi_timed_rx_t* rx, const uint8_t* bytes, uint32_t nbytes, midi_timed_rx_kind_t* kind)
+{
+  uint8_t byte = bytes[0];
+  if (rx->nenvelope > 0) {
+    if (byte >= 0xF8) {
+      // System Real-Time may come in the middle of the envelope
+      *kind = MIDI_TIMED_RX_NOW;
+      return 1;
+    }
+    if (byte < 0x80) {
+      // Drop any extra data bytes
+      if (rx->nenvelope < 6)
+        rx->data[rx->nenvelope++ - 3] = byte;
+      *kind = MIDI_TIMED_RX_ENVELOPE;
+      return 1;
+    }
+    bool complete = byte == 0xF7 && rx->nenvelope == 6;
+    rx->nenvelope = 0;
+    if (complete) {
+      uint16_t time = (uint16_t)(rx->data[0] | (rx->data[1] << 7) | ((rx->data[2] & 0x3) << 14));
+      if (rx->cmd == MIDI_TIMED_CMD_TIMESTAMP) {
+        rx->timestamped = true;
+        rx->timestamp = time;
+        *kind = MIDI_TIMED_RX_ENVELOPE;
+      }
+      else {
+        rx->clock = time;
+        *kind = MIDI_TIMED_RX_CLOCK;
+      }
+      return 1;
+    }
+    if (byte == 0xF7) {
+      *kind = MIDI_TIMED_RX_ENVELOPE;
+      return 1;
+    }
+    // Another status byte cut the envelope short; it starts the next part
+  }
+  if (byte == 0xF0 && nbytes >= 3 && bytes[1] == MIDI_TIMED_SYSEX_ID &&
+      (bytes[2] == MIDI_TIMED_CMD_TIMESTAMP || bytes[2] == MIDI_TIMED_CMD_CLOCK)) {
+    rx->nenvelope = 3;
+    rx->cmd = bytes[2];
+    *kind = MIDI_TIMED_RX_ENVELOPE;
+    return 3;
+  }
+  if (rx->timestamped && byte >= 0x80) {
+    uint8_t len = midi_timed_msg_len(byte);
+    uint8_t ndata = 1;
+    while (ndata < len && ndata < nbytes && bytes[ndata] < 0x80)
+      ndata++;
+    if (len > 0 && ndata == len) {
+      *kind = MIDI_TIMED_RX_TIMED;
+      return len;
+    }
+    // Not a whole message, so it goes out at once
+  }
+  // Everything up to the next byte that may start an envelope or a timed message
+  uint32_t end = 1;
+  while (end < nbytes && bytes[end] != 0xF0 && !(rx->timestamped && bytes[end] >= 0x80))
+    end++;
+  *kind = MIDI_TIMED_RX_NOW;
+  return end;
+}
+
+void midi_timed_rx_sent(midi_timed_rx_t* rx, const uint8_t* bytes, uint32_t nbytes, midi_timed_rx_kind_t kind)
+{
+  if (kind == MIDI_TIMED_RX_TIMED) {
+    rx->timestamped = false;
+    rx->in_sysex = false;
+    return;
+  }
+  for (uint32_t idx = 0; idx < nbytes; idx++) {
+    uint8_t byte = bytes[idx];
+    if (byte >= 0x80 && byte < 0xF8) {
+      // The timestamp was for this message, which could not wait
+      rx->timestamped = false;
+      rx->in_sysex = byte == 0xF0;
+    }
+  }
+}
@@ -0,0 +1,159 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Timed MIDI OUT messages. The host can send a message ahead of time with the
+// time it should go out on its MIDI OUT port, so that neither the 1 ms USB
+// frames nor the host's own scheduling move it. A timestamp applies to the
+// next message on the same virtual cable. In the MIDI 1.0 alternate setting
+// it comes in a System Exclusive envelope with the non-commercial
+// manufacturer ID 0x7D, and the host keeps the adapter's idea of its clock
+// up to date with a clock envelope:
+//
+//   F0 7D 07 <t0> <t1> <t2> F7  the next message goes out at host time t
+//   F0 7D 08 <t0> <t1> <t2> F7  the host's clock reads t now
+//
+// t is 16 bits, bits 0-6 in <t0>, 7-13 in <t1> and 14-15 in <t2>, in units
+// of 32 us (1/31250 s) like the UMP Jitter Reduction (JR) timestamps. In the
+// UMP alternate setting the host sends JR Timestamp and JR Clock messages
+// instead (See midi_ump.h). The times wrap every 2.1 s, so a message may be
+// sent at most about 1 s ahead; a message that arrives after its time goes
+// out at once.
+//
+// The adapter maps host times to its own clock with the offset between them
+// that the clock messages show, tracking the smallest offset seen so that
+// the USB frame jitter of the clock messages does not move the messages.
+// Each MIDI OUT port keeps its timed messages in a min-heap ordered by when
+// they go out, with messages due at the same time in the order they came.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MIDI_TIMED_SYSEX_ID       0x7D
+#define MIDI_TIMED_CMD_TIMESTAMP  0x07
+#define MIDI_TIMED_CMD_CLOCK      0x08
+#define MIDI_TIMED_TICK_US        32     // one unit of host time
+// A clock offset more than this many ticks larger than the one in use is a new time base
+#define MIDI_TIMED_RESYNC_TICKS   1024
+
+// The offset from host time to the adapter's time
+typedef struct {
+  uint16_t offset;  // adapter ticks minus host ticks
+  bool synced;      // false until the first clock message or timestamp
+} midi_timed_clock_t;
+
+static inline void midi_timed_clock_init(midi_timed_clock_t* clock)
+{
+  clock->offset = 0;
+  clock->synced = false;
+}
+
+// The host's clock read host_time when it sent a clock message that arrived at now_us
+void midi_timed_clock_sync(midi_timed_clock_t* clock, uint16_t host_time, uint32_t now_us);
+
+// Return when in the adapter's time, in microseconds, the message with
+// timestamp host_time that arrived at now_us should go out. Without a clock
+// message, the first timestamp sets the offset.
+uint32_t midi_timed_clock_deadline(midi_timed_clock_t* clock, uint16_t host_time, uint32_t now_us);
+
+// A MIDI message waiting to go out at due_us
+typedef struct {
+  uint32_t due_us;
+  uint16_t seq;       // orders the messages due at the same time
+  uint8_t cable_num;  // the virtual cable it came from
+  uint8_t nbytes;
+  uint8_t bytes[3];
+} midi_timed_event_t;
+
+typedef struct {
+  midi_timed_event_t* events; // a min-heap by due_us and seq
+  uint16_t size;              // the most events it holds
+  uint16_t count;
+  uint16_t next_seq;
+} midi_timed_queue_t;
+
+// Initialize queue to hold up to size events in events
+void midi_timed_queue_init(midi_timed_queue_t* queue, midi_timed_event_t* events, uint16_t size);
+
+// Add the nbytes byte message in bytes from virtual cable cable_num, to go
+// out at due_us. Return false if the queue is full.
+bool midi_timed_queue_push(midi_timed_queue_t* queue, uint32_t due_us, uint8_t cable_num, const uint8_t* bytes,
+                           uint8_t nbytes);
+
+// Return the message that goes out next, or NULL if the queue is empty
+static inline const midi_timed_event_t* midi_timed_queue_peek(const midi_timed_queue_t* queue)
+{
+  return queue->count ? &queue->events[0] : NULL;
+}
+
+// Remove the message midi_timed_queue_peek() returned
+void midi_timed_queue_pop(midi_timed_queue_t* queue);
+
+// Forget every message in queue
+static inline void midi_timed_queue_clear(midi_timed_queue_t* queue)
+{
+  queue->count = 0;
+}
+
+// What the next bytes of a virtual cable's stream are
+typedef enum {
+  MIDI_TIMED_RX_NOW,      // bytes to send at once
+  MIDI_TIMED_RX_TIMED,    // one whole message with the timestamp in rx->timestamp
+  MIDI_TIMED_RX_ENVELOPE, // envelope bytes to drop
+  MIDI_TIMED_RX_CLOCK,    // the end of a clock envelope; rx->clock holds the host time
+} midi_timed_rx_kind_t;
+
+// Finds the envelopes and the timed messages in a virtual cable's stream
+typedef struct {
+  uint8_t nenvelope;  // envelope bytes read, 0 outside of one
+  uint8_t cmd;        // the envelope's command
+  uint8_t data[3];    // its time
+  bool timestamped;   // the next message has a timestamp
+  bool in_sysex;      // a System Exclusive message that is not an envelope is on its way
+  uint16_t timestamp; // its timestamp
+  uint16_t clock;     // the host time of the last clock envelope
+} midi_timed_rx_t;
+
+static inline void midi_timed_rx_init(midi_timed_rx_t* rx)
+{
+  rx->nenvelope = 0;
+  rx->timestamped = false;
+  rx->in_sysex = false;
+}
+
+// Return the length of the first part of the nbytes stream bytes in bytes
+// and set *kind to what it is. Bytes up to the end of a MIDI_TIMED_RX_NOW
+// or MIDI_TIMED_RX_TIMED part may be offered again if the caller could not
+// send them all; call midi_timed_rx_sent() for the ones it sent. The bytes of
+// the other parts must be dropped. An envelope starts a USB MIDI event
+// packet, so the first 3 bytes of one are always passed together.
+uint32_t midi_timed_rx_next(midi_timed_rx_t* rx, const uint8_t* bytes, uint32_t nbytes, midi_timed_rx_kind_t* kind);
+
+// The caller sent nbytes bytes of a part midi_timed_rx_next() returned, or
+// queued its timed message
+void midi_timed_rx_sent(midi_timed_rx_t* rx, const uint8_t* bytes, uint32_t nbytes, midi_timed_rx_kind_t kind);
+
+// Return the length of the MIDI message with status, 0 for System Exclusive
+uint8_t midi_timed_msg_len(uint8_t status);
@@ -0,0 +1,101 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include <string.h>
+#include "tusb.h"
+#include "pico/stdlib.h"
+#include "midi_trace.h"
+#if CFG_MIDI_DUAL_CORE
+#include "hardware/sync.h"
+#endif
+
+#if CFG_MIDI_TRACE
+#if (CFG_MIDI_TRACE_RECORDS & (CFG_MIDI_TRACE_RECORDS - 1)) != 0
+#error "CFG_MIDI_TRACE_RECORDS must be a power of 2"
+#endif
+#if CFG_MIDI_TRACE_RECORDS > 65536
+#error "MIDI_TRACE_REQUEST_READ cannot reach past record 65535"
+#endif
+
+static midi_trace_record_t ring[CFG_MIDI_TRACE_RECORDS];
+static uint32_t head;     // records written since the ring was emptied
+static bool recording;
+#if CFG_MIDI_DUAL_CORE
+// Both cores record, so they take turns at the ring
+static spin_lock_t* lock;
+#endif
+
+void midi_trace_init(void)
+{
+#if CFG_MIDI_DUAL_CORE
+  lock = spin_lock_init(spin_lock_claim_unused(true));
+#endif
+  midi_trace_start();
+}
+
+void midi_trace_record(uint8_t kind, const uint8_t data[4])
+{
+  if (!recording)
+    return;
+#if CFG_MIDI_DUAL_CORE
+  uint32_t saved = spin_lock_blocking(lock);
+#endif
+  midi_trace_record_t* record = &ring[head++ & (CFG_MIDI_TRACE_RECORDS - 1)];
+  record->time_kind = (time_us_32() & MIDI_TRACE_TIME_MASK) | ((uint32_t)kind << 30);
+  memcpy(record->data, data, sizeof(record->data));
+#if CFG_MIDI_DUAL_CORE
+  spin_unlock(lock, saved);
+#endif
+}
+
+void midi_trace_freeze(void)
+{
+  recording = false;
+}
+
+void midi_trace_start(void)
+{
+#if CFG_MIDI_DUAL_CORE
+  uint32_t saved = spin_lock_blocking(lock);
+#endif
+  head = 0;
+  recording = true;
+#if CFG_MIDI_DUAL_CORE
+  spin_unlock(lock, saved);
+#endif
+}
+
+uint32_t midi_trace_peek(uint32_t first, const midi_trace_record_t** records)
+{
+  uint32_t count = head < CFG_MIDI_TRACE_RECORDS ? head : CFG_MIDI_TRACE_RECORDS;
+  if (first >= count)
+    return 0;
+  uint32_t idx = (head - count + first) & (CFG_MIDI_TRACE_RECORDS - 1);
+  uint32_t contiguous = CFG_MIDI_TRACE_RECORDS - idx;
+  *records = &ring[idx];
+  count -= first;
+  return count < contiguous ? count : contiguous;
+}
+#endif
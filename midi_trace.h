@@ -0,0 +1,116 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// A compact binary trace of the MIDI data through the adapter. Each record
+// is 8 bytes: a 30-bit microsecond timestamp, a 2-bit kind, and either a
+// whole USB MIDI event packet or a MIDI port number and one byte. With
+// CFG_MIDI_TRACE set, the firmware records every USB MIDI event packet it
+// reads from the host or sends to it, every byte it receives on a MIDI IN
+// port and every byte it hands to a MIDI OUT port in a RAM ring. The host
+// freezes and reads the ring with vendor specific control requests to the
+// telemetry interface, and saves it as a trace file: a midi_trace_header_t
+// followed by the records, oldest first. host/firmware_sim replays the
+// USB MIDI OUT packets and MIDI IN bytes of a trace file at their recorded
+// times.
+//
+// The timestamps wrap around every 2^30 us, about 17.9 minutes. Readers
+// take each record to follow the one before it by less than that.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MIDI_TRACE_VERSION 1
+#define MIDI_TRACE_TIME_MASK 0x3FFFFFFFu
+
+// Record kinds
+#define MIDI_TRACE_USB_OUT 0  // data: a USB MIDI event packet from the host
+#define MIDI_TRACE_USB_IN  1  // data: a USB MIDI event packet to the host
+#define MIDI_TRACE_DIN_IN  2  // data[0]: MIDI IN port, data[1]: the byte received
+#define MIDI_TRACE_DIN_OUT 3  // data[0]: MIDI OUT port, data[1]: the byte sent
+
+// Vendor specific control requests (bmRequestType vendor, recipient device),
+// numbered after the telemetry requests
+#define MIDI_TRACE_REQUEST_FREEZE 3 // no data: stop recording
+#define MIDI_TRACE_REQUEST_READ   4 // device to host: stop recording, then
+                                    // return the records from record wValue
+                                    // on, oldest first; 0 bytes after the last
+#define MIDI_TRACE_REQUEST_START  5 // no data: empty the ring and record again
+
+typedef struct {
+  uint32_t time_kind;   // bits 0-29: time in microseconds; bits 30-31: kind
+  uint8_t data[4];
+} midi_trace_record_t;
+
+typedef struct {
+  char magic[4];        // "MTRC"
+  uint8_t version;      // MIDI_TRACE_VERSION
+  uint8_t num_cables_in;
+  uint8_t num_cables_out;
+  uint8_t reserved;
+} midi_trace_header_t;
+
+static inline uint32_t midi_trace_time(const midi_trace_record_t* record)
+{
+  return record->time_kind & MIDI_TRACE_TIME_MASK;
+}
+
+static inline uint8_t midi_trace_kind(const midi_trace_record_t* record)
+{
+  return (uint8_t)(record->time_kind >> 30);
+}
+
+// Return the microseconds from the record recorded at time prev_time to record
+static inline uint32_t midi_trace_elapsed(uint32_t prev_time, const midi_trace_record_t* record)
+{
+  return (midi_trace_time(record) - prev_time) & MIDI_TRACE_TIME_MASK;
+}
+
+#if defined(CFG_MIDI_TRACE) && CFG_MIDI_TRACE
+// Start with an empty ring and recording on
+void midi_trace_init(void);
+
+// Record a kind record with the 4 bytes in data, unless recording is off
+void midi_trace_record(uint8_t kind, const uint8_t data[4]);
+
+// Record byte on MIDI port port, for the MIDI_TRACE_DIN_* kinds
+static inline void midi_trace_record_byte(uint8_t kind, uint8_t port, uint8_t byte)
+{
+  uint8_t data[4] = {port, byte, 0, 0};
+  midi_trace_record(kind, data);
+}
+
+// Stop or restart recording. Starting empties the ring.
+void midi_trace_freeze(void);
+void midi_trace_start(void);
+
+// Set *records to point to the records from record first on, oldest first,
+// and return how many of them are stored contiguously there. Freeze the
+// ring before reading it.
+uint32_t midi_trace_peek(uint32_t first, const midi_trace_record_t** records);
+#else
+#define midi_trace_init() do {} while (0)
+#define midi_trace_record(kind, data) do {} while (0)
+#define midi_trace_record_byte(kind, port, byte) do {} while (0)
+#endif
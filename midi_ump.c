@@ -0,0 +1,265 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "tusb.h"
+#include "midi_ump.h"
+
+// Return the number of bytes in a MIDI 1.0 System Common or System Real-Time
+// message with status, or 0 for System Exclusive framing and undefined status
+// bytes, which have no UMP System message
+static uint8_t system_len(uint8_t status)
+{
+  switch (status) {
+    case 0xF1:
+    case 0xF3:
+      return 2;
+    case 0xF2:
+      return 3;
+    case 0xF6:
+    case 0xF8:
+    case 0xFA:
+    case 0xFB:
+    case 0xFC:
+    case 0xFE:
+    case 0xFF:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+// Copy the nbytes byte MIDI 1.0 message with status and data bytes data1
+// and data2 to bytes. Return nbytes.
+static uint8_t put_msg(uint8_t* bytes, uint8_t nbytes, uint8_t status, uint32_t data1, uint32_t data2)
+{
+  bytes[0] = status;
+  bytes[1] = (uint8_t)(data1 & 0x7f);
+  bytes[2] = (uint8_t)(data2 & 0x7f);
+  return nbytes;
+}
+
+// Translate a 7-bit System Exclusive message (M2-104-UM section 7.7)
+static uint8_t sysex7_to_bytes(const uint32_t* words, uint8_t* bytes)
+{
+  uint8_t const form = (words[0] >> 20) & 0xf; // 0 complete, 1 start, 2 continue, 3 end
+  uint8_t const ndata = (words[0] >> 16) & 0xf;
+  if (form > 3 || ndata > 6)
+    return 0;
+  uint8_t const data[6] = {
+    (uint8_t)(words[0] >> 8), (uint8_t)words[0],
+    (uint8_t)(words[1] >> 24), (uint8_t)(words[1] >> 16), (uint8_t)(words[1] >> 8), (uint8_t)words[1],
+  };
+  uint8_t nbytes = 0;
+  if (form <= 1)
+    bytes[nbytes++] = 0xF0;
+  for (uint8_t idx = 0; idx < ndata; idx++) {
+    bytes[nbytes++] = data[idx] & 0x7f;
+  }
+  if (form == 0 || form == 3)
+    bytes[nbytes++] = 0xF7;
+  return nbytes;
+}
+
+// Translate a MIDI 2.0 channel voice message to MIDI 1.0 (M2-104-UM
+// appendix D.3) by dropping the low bits of each value
+static uint8_t midi2_to_bytes(const uint32_t* words, uint8_t* bytes)
+{
+  uint8_t const opcode = (words[0] >> 20) & 0xf;
+  uint8_t const channel = (words[0] >> 16) & 0xf;
+  uint32_t const index = words[0] >> 8;   // the note, controller or bank
+  uint32_t const index2 = words[0];       // the index in the bank
+  uint32_t const data = words[1];
+  uint8_t const status = (uint8_t)((opcode << 4) | channel);
+  switch (opcode) {
+    case 0x8: // Note Off
+    case 0xA: // Poly Pressure
+    case 0xB: // Control Change
+      return put_msg(bytes, 3, status, index, data >> 25);
+    case 0x9: { // Note On; velocity 0 is not Note Off in MIDI 2.0
+      uint32_t const velocity = data >> 25;
+      return put_msg(bytes, 3, status, index, velocity ? velocity : 1);
+    }
+    case 0xC: { // Program Change, after a Bank Select if the bank is valid
+      uint8_t nbytes = 0;
+      if (words[0] & 0x1) {
+        nbytes += put_msg(&bytes[nbytes], 3, (uint8_t)(0xB0 | channel), 0, data >> 8);
+        nbytes += put_msg(&bytes[nbytes], 3, (uint8_t)(0xB0 | channel), 32, data);
+      }
+      return nbytes + put_msg(&bytes[nbytes], 2, status, data >> 24, 0);
+    }
+    case 0xD: // Channel Pressure
+      return put_msg(bytes, 2, status, data >> 25, 0);
+    case 0xE: // Pitch Bend
+      return put_msg(bytes, 3, status, data >> 18, data >> 25);
+    case 0x2:   // Registered Controller (RPN)
+    case 0x3: { // Assignable Controller (NRPN)
+      uint8_t const cc_status = (uint8_t)(0xB0 | channel);
+      uint8_t const cc_msb = opcode == 0x2 ? 101 : 99;
+      uint8_t nbytes = put_msg(bytes, 3, cc_status, cc_msb, index);
+      nbytes += put_msg(&bytes[nbytes], 3, cc_status, cc_msb - 1, index2);
+      nbytes += put_msg(&bytes[nbytes], 3, cc_status, 6, data >> 25);
+      return nbytes + put_msg(&bytes[nbytes], 3, cc_status, 38, data >> 18);
+    }
+    default:
+      return 0; // per-note and relative messages have no MIDI 1.0 equivalent
+  }
+}
+
+uint8_t midi_ump_to_bytes(const uint32_t* words, uint8_t bytes[MIDI_UMP_MAX_BYTES])
+{
+  uint8_t const status = (uint8_t)(words[0] >> 16);
+  switch (words[0] >> 28) {
+    case MIDI_UMP_MT_SYSTEM:
+      return put_msg(bytes, system_len(status), status, words[0] >> 8, words[0]);
+    case MIDI_UMP_MT_MIDI1_CHANNEL_VOICE:
+      if (status < 0x80 || status >= 0xF0)
+        return 0;
+      return put_msg(bytes, (status & 0xE0) == 0xC0 ? 2 : 3, status, words[0] >> 8, words[0]);
+    case MIDI_UMP_MT_DATA_64:
+      return sysex7_to_bytes(words, bytes);
+    case MIDI_UMP_MT_MIDI2_CHANNEL_VOICE:
+      return midi2_to_bytes(words, bytes);
+    default:
+      return 0; // Utility messages such as JR Timestamps, 8-bit SysEx, Flex Data and UMP Stream
+  }
+}
+
+uint8_t midi_ump_from_packet(const uint8_t packet[4], uint32_t words[2])
+{
+  uint8_t const cin = packet[0] & 0x0f;
+  uint32_t const group = (uint32_t)(packet[0] >> 4) << 24;
+  uint32_t const msg = ((uint32_t)packet[1] << 16) | ((uint32_t)packet[2] << 8) | packet[3];
+  switch (cin) {
+    case MIDI_CIN_NOTE_OFF:
+    case MIDI_CIN_NOTE_ON:
+    case MIDI_CIN_POLY_KEYPRESS:
+    case MIDI_CIN_CONTROL_CHANGE:
+    case MIDI_CIN_PROGRAM_CHANGE:
+    case MIDI_CIN_CHANNEL_PRESSURE:
+    case MIDI_CIN_PITCH_BEND_CHANGE:
+      words[0] = ((uint32_t)MIDI_UMP_MT_MIDI1_CHANNEL_VOICE << 28) | group | msg;
+      return 1;
+    case MIDI_CIN_1BYTE_DATA:
+      if (packet[1] < 0xF8)
+        return 0; // a lone data byte has no UMP message
+      // fall through
+    case MIDI_CIN_SYSCOM_2BYTE:
+    case MIDI_CIN_SYSCOM_3BYTE:
+      words[0] = ((uint32_t)MIDI_UMP_MT_SYSTEM << 28) | group | msg;
+      return 1;
+    case MIDI_CIN_SYSEX_END_1BYTE:
+      if (packet[1] != 0xF7) {
+        // single byte System Common
+        words[0] = ((uint32_t)MIDI_UMP_MT_SYSTEM << 28) | group | msg;
+        return 1;
+      }
+      // fall through
+    case MIDI_CIN_SYSEX_START:
+    case MIDI_CIN_SYSEX_END_2BYTE:
+    case MIDI_CIN_SYSEX_END_3BYTE: {
+      // UMP System Exclusive messages leave out 0xF0 and 0xF7 and say
+      // whether they start or end the MIDI 1.0 message instead
+      uint8_t const* data = &packet[1];
+      uint8_t ndata = cin == MIDI_CIN_SYSEX_START ? 3 : cin - MIDI_CIN_SYSEX_START;
+      bool const start = data[0] == 0xF0;
+      bool const end = cin != MIDI_CIN_SYSEX_START;
+      if (start) {
+        data++;
+        ndata--;
+      }
+      if (end)
+        ndata--;
+      uint32_t const form = start ? (end ? 0 : 1) : (end ? 3 : 2);
+      words[0] = ((uint32_t)MIDI_UMP_MT_DATA_64 << 28) | group | (form << 20) | ((uint32_t)ndata << 16) |
+                 (ndata > 0 ? (uint32_t)data[0] << 8 : 0) | (ndata > 1 ? data[1] : 0);
+      words[1] = ndata > 2 ? (uint32_t)data[2] << 24 : 0;
+      return 2;
+    }
+    default:
+      return 0;
+  }
+}
+
+void midi_ump_init(midi_ump_ctx_t* ctx, uint8_t itf)
+{
+  ctx->itf = itf;
+  ctx->words_read = 0;
+  midi_ump_reset(ctx);
+}
+
+void midi_ump_reset(midi_ump_ctx_t* ctx)
+{
+  ctx->nwords = 0;
+  ctx->next_byte = 0;
+  ctx->nbytes = 0;
+  ctx->timestamped = false;
+  ctx->next_timestamped = false;
+  ctx->clock_received = false;
+}
+
+uint32_t midi_ump_dispatch(midi_ump_ctx_t* ctx, midi_demux_write_cb_t write_cb, void* context)
+{
+  uint32_t ndispatched = 0;
+  while (1) {
+    if (ctx->nbytes > 0) {
+      uint32_t const nwritten = write_cb(context, ctx->group, &ctx->bytes[ctx->next_byte], ctx->nbytes);
+      ndispatched += nwritten;
+      ctx->next_byte += (uint8_t)nwritten;
+      ctx->nbytes -= (uint8_t)nwritten;
+      if (ctx->nbytes > 0)
+        break; // leave the rest in the FIFO until write_cb has room
+    }
+    // A message may be split across USB transfers, so keep the words read
+    // so far until the rest arrive
+    do {
+      uint8_t word[4];
+      if (!tud_midi_n_packet_read(ctx->itf, word))
+        return ndispatched;
+      ctx->words[ctx->nwords++] = midi_ump_word(word);
+      ctx->words_read++;
+    } while (ctx->nwords < midi_ump_num_words(ctx->words[0]));
+    ctx->nwords = 0;
+    if ((ctx->words[0] >> 28) == MIDI_UMP_MT_UTILITY) {
+      // A JR Timestamp applies to the next message, whatever its group
+      uint8_t const status = (ctx->words[0] >> 20) & 0xf;
+      if (status == MIDI_UMP_UTILITY_JR_TIMESTAMP) {
+        ctx->next_timestamped = true;
+        ctx->next_timestamp = (uint16_t)ctx->words[0];
+      }
+      else if (status == MIDI_UMP_UTILITY_JR_CLOCK) {
+        ctx->clock_received = true;
+        ctx->clock = (uint16_t)ctx->words[0];
+      }
+      continue;
+    }
+    ctx->group = midi_ump_group(ctx->words[0]);
+    ctx->next_byte = 0;
+    ctx->nbytes = midi_ump_to_bytes(ctx->words, ctx->bytes);
+    ctx->timestamped = ctx->next_timestamped;
+    ctx->timestamp = ctx->next_timestamp;
+    ctx->next_timestamped = false;
+  }
+  return ndispatched;
+}
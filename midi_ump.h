@@ -0,0 +1,137 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// Translates between Universal MIDI Packets (UMP, the MIDI Association's
+// M2-104-UM) and MIDI 1.0. The USB MIDI 2.0 alternate setting of the MIDI
+// Streaming interface carries UMP messages of 1 to 4 32-bit words, each
+// word in little-endian byte order, and the group of each message picks the
+// virtual cable. The adapter's DIN ports only speak MIDI 1.0, so the
+// device does the translation and the host does not have to.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+#include "midi_device_multistream.h"
+
+// UMP message types that carry MIDI 1.0 messages
+#define MIDI_UMP_MT_UTILITY              0x0
+#define MIDI_UMP_MT_SYSTEM               0x1
+#define MIDI_UMP_MT_MIDI1_CHANNEL_VOICE  0x2
+#define MIDI_UMP_MT_DATA_64              0x3   // System Exclusive, 7-bit
+#define MIDI_UMP_MT_MIDI2_CHANNEL_VOICE  0x4
+
+// Utility message status values (M2-104-UM section 7.2)
+#define MIDI_UMP_UTILITY_JR_CLOCK        0x1
+#define MIDI_UMP_UTILITY_JR_TIMESTAMP    0x2
+
+// The most MIDI 1.0 bytes one UMP message becomes: a MIDI 2.0 Registered
+// Controller becomes 4 Control Change messages
+#define MIDI_UMP_MAX_BYTES 12
+
+// Number of 32-bit words in a UMP message for each of the 16 message types
+// (M2-104-UM Table 4), packed 2 bits per entry like the Code Index Number
+// table in midi_device_multistream.c
+#define MIDI_UMP_NUM_WORDS_ENTRY(_mt, _nwords) ((uint32_t)((_nwords) - 1) << (2 * (_mt)))
+#define MIDI_UMP_NUM_WORDS_TABLE (\
+  MIDI_UMP_NUM_WORDS_ENTRY(0x0, 1) | MIDI_UMP_NUM_WORDS_ENTRY(0x1, 1) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0x2, 1) | MIDI_UMP_NUM_WORDS_ENTRY(0x3, 2) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0x4, 2) | MIDI_UMP_NUM_WORDS_ENTRY(0x5, 4) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0x6, 1) | MIDI_UMP_NUM_WORDS_ENTRY(0x7, 1) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0x8, 2) | MIDI_UMP_NUM_WORDS_ENTRY(0x9, 2) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0xA, 2) | MIDI_UMP_NUM_WORDS_ENTRY(0xB, 3) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0xC, 3) | MIDI_UMP_NUM_WORDS_ENTRY(0xD, 4) |\
+  MIDI_UMP_NUM_WORDS_ENTRY(0xE, 4) | MIDI_UMP_NUM_WORDS_ENTRY(0xF, 4))
+
+// Return the UMP word in bytes, as it was sent on the USB
+static inline uint32_t midi_ump_word(const uint8_t bytes[4])
+{
+  return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8) | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Copy UMP word to bytes in the order it goes on the USB
+static inline void midi_ump_word_bytes(uint32_t word, uint8_t bytes[4])
+{
+  bytes[0] = (uint8_t)word;
+  bytes[1] = (uint8_t)(word >> 8);
+  bytes[2] = (uint8_t)(word >> 16);
+  bytes[3] = (uint8_t)(word >> 24);
+}
+
+// Return the number of words in the UMP message that starts with word0
+static inline uint8_t midi_ump_num_words(uint32_t word0)
+{
+  return (uint8_t)(((MIDI_UMP_NUM_WORDS_TABLE >> (2 * (word0 >> 28))) & 0x3) + 1);
+}
+
+// Return the group of the UMP message that starts with word0
+static inline uint8_t midi_ump_group(uint32_t word0)
+{
+  return (uint8_t)((word0 >> 24) & 0xf);
+}
+
+// Translate the UMP message in words to MIDI 1.0 bytes. Return the number of
+// bytes, which is 0 for messages MIDI 1.0 has no equivalent for, such as
+// Jitter Reduction timestamps and MIDI 2.0 per-note controllers. MIDI 2.0
+// channel voice messages lose the extra resolution.
+uint8_t midi_ump_to_bytes(const uint32_t* words, uint8_t bytes[MIDI_UMP_MAX_BYTES]);
+
+// Translate a USB MIDI 1.0 event packet to a UMP message in the group of
+// the packet's virtual cable. Return the number of words, which is 0 for
+// packets UMP has no equivalent for. System Exclusive packets become
+// 7-bit System Exclusive messages of up to 3 bytes each.
+uint8_t midi_ump_from_packet(const uint8_t packet[4], uint32_t words[2]);
+
+// Reads the UMP messages from the USB MIDI receive FIFO of one interface.
+// Initialize it with midi_ump_init() and reset it with midi_ump_reset() when
+// the USB device is unmounted or the host changes the alternate setting.
+typedef struct {
+  uint32_t words[4];                  // the message being read
+  uint8_t nwords;                     // the number of its words read so far
+  uint8_t bytes[MIDI_UMP_MAX_BYTES];  // the last message in MIDI 1.0
+  uint8_t next_byte;                  // index in bytes of the first byte the write callback did not take
+  uint8_t nbytes;                     // the number of bytes it did not take
+  uint8_t group;                      // the last message's group
+  uint8_t itf;                        // the MIDI interface number
+  uint32_t words_read;                // words read from the receive FIFO; the caller may clear it
+  bool timestamped;                   // a JR Timestamp came before the last message
+  uint16_t timestamp;                 // its sender time in units of 32 us
+  bool next_timestamped;              // a JR Timestamp waits for the next message
+  uint16_t next_timestamp;
+  bool clock_received;                // a JR Clock came; the caller clears it
+  uint16_t clock;                     // its sender time in units of 32 us
+} midi_ump_ctx_t;
+
+void midi_ump_init(midi_ump_ctx_t* ctx, uint8_t itf);
+
+// Discard any partly read or partly written message in ctx
+void midi_ump_reset(midi_ump_ctx_t* ctx);
+
+// Like midi_demux_dispatch() for the UMP alternate setting: read whole UMP
+// messages from the receive FIFO and call write_cb once per message with its
+// group as the cable number and its MIDI 1.0 bytes. If write_cb takes fewer
+// bytes than it was passed, keep the rest in ctx and stop reading the FIFO.
+// While write_cb runs, ctx->timestamped says whether a JR Timestamp came
+// before the message, and a JR Clock sets ctx->clock_received.
+// Return the number of bytes write_cb took.
+uint32_t midi_ump_dispatch(midi_ump_ctx_t* ctx, midi_demux_write_cb_t write_cb, void* context);
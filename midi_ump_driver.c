@@ -0,0 +1,147 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#include "tusb.h"
+#include "device/usbd_pvt.h"
+#include "midi_device_multistream.h"
+#include "midi_ump_driver.h"
+
+#if CFG_MIDI_UMP
+
+static struct {
+  tusb_desc_interface_t const* desc_ac; // the Audio Control interface, where midid_open() starts
+  uint16_t max_len;                     // the length of the descriptors from desc_ac on
+  uint8_t itf_ms;                       // the MIDI Streaming interface number
+  uint8_t ep_out;
+  uint8_t ep_in;
+  uint8_t alt;                          // the alternate setting the host selected
+} ump_itf;
+
+bool midi_ump_driver_active(void)
+{
+  return ump_itf.alt == 1;
+}
+
+static void ump_reset(uint8_t rhport)
+{
+  midid_reset(rhport);
+  memset(&ump_itf, 0, sizeof(ump_itf));
+}
+
+static uint16_t ump_open(uint8_t rhport, tusb_desc_interface_t const* desc_itf, uint16_t max_len)
+{
+  uint16_t drv_len = midid_open(rhport, desc_itf, max_len);
+  if (drv_len == 0)
+    return 0;
+  ump_itf.desc_ac = desc_itf;
+  ump_itf.max_len = max_len;
+  ump_itf.alt = 0;
+  // midid_open() took the Audio Control interface and alternate setting 0 of
+  // the MIDI Streaming interface. Note the endpoints it opened.
+  uint8_t const* p_desc = (uint8_t const*)desc_itf;
+  uint8_t const* const end = p_desc + drv_len;
+  for (; p_desc < end; p_desc = tu_desc_next(p_desc)) {
+    if (tu_desc_type(p_desc) == TUSB_DESC_INTERFACE) {
+      ump_itf.itf_ms = ((tusb_desc_interface_t const*)p_desc)->bInterfaceNumber;
+    }
+    else if (tu_desc_type(p_desc) == TUSB_DESC_ENDPOINT) {
+      uint8_t const ep_addr = ((tusb_desc_endpoint_t const*)p_desc)->bEndpointAddress;
+      if (tu_edpt_dir(ep_addr) == TUSB_DIR_IN)
+        ump_itf.ep_in = ep_addr;
+      else
+        ump_itf.ep_out = ep_addr;
+    }
+  }
+  // Take the other alternate settings of the MIDI Streaming interface too.
+  // They must use the same endpoints.
+  while (drv_len < max_len) {
+    if (tu_desc_type(p_desc) == TUSB_DESC_INTERFACE_ASSOCIATION ||
+        (tu_desc_type(p_desc) == TUSB_DESC_INTERFACE &&
+         ((tusb_desc_interface_t const*)p_desc)->bInterfaceNumber != ump_itf.itf_ms))
+      break;
+    drv_len += tu_desc_len(p_desc);
+    p_desc = tu_desc_next(p_desc);
+  }
+  return drv_len;
+}
+
+static bool ump_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const* request)
+{
+  if (request->bmRequestType_bit.type != TUSB_REQ_TYPE_STANDARD ||
+      request->bmRequestType_bit.recipient != TUSB_REQ_RCPT_INTERFACE ||
+      tu_u16_low(request->wIndex) != ump_itf.itf_ms)
+    return midid_control_xfer_cb(rhport, stage, request);
+  if (stage != CONTROL_STAGE_SETUP)
+    return true;
+  switch (request->bRequest) {
+    case TUSB_REQ_SET_INTERFACE: {
+      uint8_t const alt = tu_u16_low(request->wValue);
+      TU_VERIFY(alt <= 1);
+      // The host starts the endpoints over with their data toggles reset,
+      // and anything in the FIFOs is in the old alternate setting's format.
+      // Start tinyusb's driver over the same way.
+      usbd_edpt_close(rhport, ump_itf.ep_out);
+      usbd_edpt_close(rhport, ump_itf.ep_in);
+      midid_reset(rhport);
+      TU_VERIFY(midid_open(rhport, ump_itf.desc_ac, ump_itf.max_len));
+      ump_itf.alt = alt;
+      midi_ump_driver_set_cb(alt == 1);
+      return tud_control_status(rhport, request);
+    }
+    case TUSB_REQ_GET_INTERFACE:
+      return tud_control_xfer(rhport, request, &ump_itf.alt, 1);
+    case TUSB_REQ_GET_DESCRIPTOR:
+      if (tu_u16_high(request->wValue) == TUD_MIDI_UMP_CS_GR_TRM_BLOCK) {
+        uint16_t len;
+        uint8_t const* desc = tud_descriptor_group_terminal_blocks_cb(&len);
+        return tud_control_xfer(rhport, request, (void*)(uintptr_t)desc, tu_min16(len, request->wLength));
+      }
+      return false;
+    default:
+      return false;
+  }
+}
+
+static usbd_class_driver_t const ump_driver = {
+#if CFG_TUSB_DEBUG >= 2
+  .name = "MIDI UMP",
+#endif
+  .init = midid_init,
+  .reset = ump_reset,
+  .open = ump_open,
+  .control_xfer_cb = ump_control_xfer_cb,
+  .xfer_cb = midid_xfer_cb,
+  .sof = NULL,
+};
+
+// Invoked when the device stack starts. tinyusb tries the application's
+// class drivers before its own.
+usbd_class_driver_t const* usbd_app_driver_get_cb(uint8_t* driver_count)
+{
+  *driver_count = 1;
+  return &ump_driver;
+}
+
+#endif
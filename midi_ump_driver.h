@@ -0,0 +1,53 @@
+/*
+ * The MIT License (MIT)
+ *
+ * Copyright (c) 2023 rppicomidi
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+// A tinyusb class driver for the MIDI interface with a USB MIDI 2.0
+// alternate setting. tinyusb's MIDI class driver only knows alternate
+// setting 0, so this driver hands it the MIDI 1.0 part of the interface and
+// takes care of the rest: it claims the descriptors of alternate setting 1,
+// answers the host's requests for the alternate setting and the Group
+// Terminal Block descriptors, and restarts tinyusb's driver when the host
+// switches. Both alternate settings use the same endpoints and FIFOs, so the
+// tud_midi_n_packet_*() functions read and write 4-byte USB MIDI event
+// packets in alternate setting 0 and UMP words in alternate setting 1.
+//
+// tinyusb only gives the MIDI Streaming interface to a driver other than
+// its own when an Interface Association Descriptor groups it with the
+// Audio Control interface; TUD_MIDI_MULTI_UMP_DESCRIPTOR() adds one.
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+// Return true if the host selected the UMP alternate setting
+bool midi_ump_driver_active(void);
+
+// Invoked from tud_task() when the host selects an alternate setting of the
+// MIDI Streaming interface. The receive and transmit FIFOs are empty again,
+// and ump is true for the UMP alternate setting.
+void midi_ump_driver_set_cb(bool ump);
+
+// Invoked when the host reads the Group Terminal Block descriptors. Return a
+// pointer to them and set *len to their total length.
+uint8_t const* tud_descriptor_group_terminal_blocks_cb(uint16_t* len);
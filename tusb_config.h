@@ -95,12 +95,13 @@
 #define CFG_TUD_MSC               0
 #define CFG_TUD_HID               0
 #define CFG_TUD_MIDI              1
-#define CFG_TUD_VENDOR            0
+#define CFG_TUD_VENDOR            1
 
 // Number of virtual MIDI cables IN to the host
 #define CFG_TUD_MIDI_NUMCABLES_IN 2
-// Number of virtual MIDI cables OUT from the host
-#define CFG_TUD_MIDI_NUMCABLES_OUT 6
+// Number of virtual MIDI cables OUT from the host: one per MIDI OUT port
+// and the MIDI CONFIG cable for routing table commands, which must be last
+#define CFG_TUD_MIDI_NUMCABLES_OUT 7
 // Support MIDI port string labels after the serial number string
 // Set this to the first available string descriptor number or
 // 0 if you do not wish to label the MIDI jacks with strings
@@ -109,6 +110,220 @@
 #define CFG_TUD_MIDI_RX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 #define CFG_TUD_MIDI_TX_BUFSIZE   (TUD_OPT_HIGH_SPEED ? 512 : 64)
 
+// The vendor interface carries the telemetry counters in midi_telemetry.h.
+// The host reads them with control requests, so its bulk endpoints are unused.
+#define CFG_TUD_VENDOR_RX_BUFSIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
+#define CFG_TUD_VENDOR_TX_BUFSIZE (TUD_OPT_HIGH_SPEED ? 512 : 64)
+
+//--------------------------------------------------------------------
+// MIDI ADAPTER CONFIGURATION
+//--------------------------------------------------------------------
+
+// Set to 1 to write the MIDI stream bytes from each USB MIDI OUT packet
+// directly into the MIDI OUT port transmit buffers with tud_midi_demux_dispatch().
+// Set to 0 to copy them through an intermediate buffer with
+// tud_midi_demux_stream_read() first.
+#ifndef CFG_MIDI_USB_RX_ZERO_COPY
+#define CFG_MIDI_USB_RX_ZERO_COPY 1
+#endif
+
+// Set to 1 to stop reading the USB MIDI OUT endpoint while a MIDI OUT port's
+// queue is full. The data waits until the port has sent enough bytes to make
+// room, and the USB device NAKs the host's transfers meanwhile, so no data is
+// lost. Set to 0 to throw away the bytes a full queue cannot take instead, so
+// one busy port never holds up the others.
+#ifndef CFG_MIDI_USB_RX_FLOW_CONTROL
+#define CFG_MIDI_USB_RX_FLOW_CONTROL 1
+#endif
+
+// Set to 1 to give the MIDI Streaming interface a USB MIDI 2.0 alternate
+// setting. A host that supports it exchanges Universal MIDI Packets with the
+// adapter, one group per virtual cable, and the adapter translates them to
+// and from the MIDI 1.0 byte streams of the ports. Hosts that only speak
+// MIDI 1.0 keep using alternate setting 0. The descriptors then need an
+// Interface Association Descriptor and the Misc device class, so the USB
+// product ID changes too. See midi_ump_driver.h.
+#ifndef CFG_MIDI_UMP
+#define CFG_MIDI_UMP 0
+#endif
+
+// Set to 1 to service the MIDI ports on the RP2040's second core (core 1)
+// while core 0 runs the USB device stack. The cores pass MIDI stream bytes
+// through lock-free single-producer/single-consumer queues, one per port.
+#ifndef CFG_MIDI_DUAL_CORE
+#define CFG_MIDI_DUAL_CORE 0
+#endif
+
+// Set to 1 to run clk_sys at 48 MHz from the USB PLL, with the system PLL
+// off, while the USB bus is suspended. The MIDI ports keep their baud rate.
+#ifndef CFG_MIDI_SUSPEND_CLOCK_DOWN
+#define CFG_MIDI_SUSPEND_CLOCK_DOWN 1
+#endif
+
+// Set to 1 to let the host enable remote wakeup. Then a MIDI IN port that
+// receives anything but System Real-Time bytes while the bus is suspended
+// wakes the host, and the bytes go to it once the bus resumes.
+#ifndef CFG_MIDI_REMOTE_WAKEUP
+#define CFG_MIDI_REMOTE_WAKEUP 1
+#endif
+
+// Size in bytes of each MIDI IN port's queue to the USB host; must be a power of 2
+#ifndef CFG_MIDI_IN_QUEUE_SIZE
+#define CFG_MIDI_IN_QUEUE_SIZE 256
+#endif
+
+// The longest in microseconds that a MIDI IN byte waits for more bytes to
+// share its USB transfer. Bytes go out as soon as they fill a transfer, or
+// when the oldest one has waited this long. Set it to 0 to send every byte
+// as soon as possible; the MIDI IN ports are polled every CFG_MIDI_SCHED_TICK_US.
+#ifndef CFG_MIDI_USB_IN_LATENCY_BUDGET_US
+#define CFG_MIDI_USB_IN_LATENCY_BUDGET_US 1000
+#endif
+
+// The MIDI OUT port transmit queues borrow blocks of CFG_MIDI_OUT_BLOCK_SIZE
+// bytes from a pool they share; the size must be a power of 2. Each port is
+// sure of CFG_MIDI_OUT_RESERVED_BLOCKS blocks, and can borrow any of the
+// CFG_MIDI_OUT_SHARED_BLOCKS shared blocks that are free, so a long SysEx
+// dump to one port can use the room the idle ports do not need. The pool
+// may have at most 255 blocks.
+#ifndef CFG_MIDI_OUT_BLOCK_SIZE
+#define CFG_MIDI_OUT_BLOCK_SIZE 32
+#endif
+
+#ifndef CFG_MIDI_OUT_RESERVED_BLOCKS
+#define CFG_MIDI_OUT_RESERVED_BLOCKS 2
+#endif
+
+#ifndef CFG_MIDI_OUT_SHARED_BLOCKS
+#define CFG_MIDI_OUT_SHARED_BLOCKS 20
+#endif
+
+// Size in bytes of each MIDI OUT port's priority lane for System Real-Time
+// messages such as MIDI Clock; must be a power of 2
+#ifndef CFG_MIDI_OUT_REALTIME_QUEUE_SIZE
+#define CFG_MIDI_OUT_REALTIME_QUEUE_SIZE 16
+#endif
+
+// The most bytes to keep in a MIDI OUT port's own transmit buffer. A System
+// Real-Time message waits behind at most about this many bytes.
+#ifndef CFG_MIDI_OUT_PACING_BYTES
+#define CFG_MIDI_OUT_PACING_BYTES 4
+#endif
+
+// Bit mask of the MIDI OUT ports that use running status, bit 0 for MIDI OUT A
+// to bit 5 for MIDI OUT F. Running status leaves out each channel message
+// status byte that repeats the one before it, which saves about a third of
+// the bytes in dense Note or Control Change data. Set a port's bit only if
+// the device connected to it handles running status correctly.
+#ifndef CFG_MIDI_RUNNING_STATUS_PORTS
+#define CFG_MIDI_RUNNING_STATUS_PORTS 0
+#endif
+
+// Bit mask of the MIDI OUT ports that regenerate the MIDI Clock, bit 0 for
+// MIDI OUT A. The USB host's clock ticks arrive in 1 ms USB frames; such a
+// port locks on to them and sends them evenly spaced, each
+// CFG_MIDI_CLOCK_REGEN_DELAY_US after its smoothed arrival time (See
+// midi_clock_regen.h). Start, Stop and Continue still go out at once.
+#ifndef CFG_MIDI_CLOCK_REGEN_PORTS
+#define CFG_MIDI_CLOCK_REGEN_PORTS 0
+#endif
+
+// How long a port that regenerates the MIDI Clock holds back each tick. It
+// must be more than the USB frame jitter for the ticks to go out evenly.
+#ifndef CFG_MIDI_CLOCK_REGEN_DELAY_US
+#define CFG_MIDI_CLOCK_REGEN_DELAY_US 1000
+#endif
+
+// Set CFG_MIDI_TIMED_OUT to 1 to let the USB host send MIDI messages ahead of
+// time with the time each should go out on its MIDI OUT port, in a System
+// Exclusive envelope or as UMP Jitter Reduction timestamps (See
+// midi_timed_out.h). Each MIDI OUT port holds up to CFG_MIDI_TIMED_OUT_EVENTS
+// messages waiting for their time.
+#ifndef CFG_MIDI_TIMED_OUT
+#define CFG_MIDI_TIMED_OUT 0
+#endif
+
+#ifndef CFG_MIDI_TIMED_OUT_EVENTS
+#define CFG_MIDI_TIMED_OUT_EVENTS 32
+#endif
+
+// The GPIO pins of the MIDI IN ports and of the MIDI OUT ports, in port
+// order, one per USB MIDI virtual cable (See midi_ports.h). If some MIDI OUT
+// ports must share a PIO state machine, no other MIDI pin may lie between
+// the pins of the ports that share it.
+#ifndef CFG_MIDI_IN_GPIOS
+#define CFG_MIDI_IN_GPIOS 5, 7
+#endif
+
+#ifndef CFG_MIDI_OUT_GPIOS
+#define CFG_MIDI_OUT_GPIOS 4, 6, 10, 18, 3, 27
+#endif
+
+// The default MIDI thru and merge routes, used until the host saves a routing
+// table to flash (See midi_route_table.h). This is a list with a bit mask for
+// each MIDI IN port of the MIDI OUT ports that get a copy of every message
+// the MIDI IN port receives, bit 0 for MIDI OUT A, bit 1 for MIDI OUT B and so
+// on. The copies go out whether or not a USB host is connected, and they
+// still go to the USB host too. For example, 0x0C, 0 sends MIDI IN A to MIDI
+// OUT C and D, and 0x20, 0x20 merges MIDI IN A and B into MIDI OUT F. A MIDI
+// OUT port that is a route's target merges its sources one whole message at
+// a time, and a System Exclusive message holds off the other sources until
+// it ends. The default is no routes.
+#ifndef CFG_MIDI_THRU_ROUTES
+#define CFG_MIDI_THRU_ROUTES 0
+#endif
+
+// The default message filters, used until the host saves a routing table to
+// flash. CFG_MIDI_OUT_FILTERS lists for each MIDI OUT port the messages it
+// does not send, and CFG_MIDI_IN_FILTERS for each MIDI IN port the messages
+// it does not pass on to the USB host. Each is a bit mask of the message
+// types from midi_filter.h, plus MIDI_FILTER_CHANNELS() with a bit mask of
+// the MIDI channels whose channel voice messages to drop. For example,
+// MIDI_FILTER_CLOCK | MIDI_FILTER_ACTIVE_SENSING, 0 keeps MIDI Clock and
+// Active Sensing off MIDI OUT A, and MIDI_FILTER_CHANNELS(0xFFFE) only lets
+// channel 1 through. The MIDI OUT port filters apply to the thru routes too.
+// The default is no filters.
+#ifndef CFG_MIDI_OUT_FILTERS
+#define CFG_MIDI_OUT_FILTERS 0
+#endif
+
+#ifndef CFG_MIDI_IN_FILTERS
+#define CFG_MIDI_IN_FILTERS 0
+#endif
+
+// Microseconds between the scheduler ticks that service the MIDI ports. The
+// default is the time one MIDI byte takes at 31250 baud, so a MIDI IN byte
+// waits at most this long before it goes to the USB host.
+#ifndef CFG_MIDI_SCHED_TICK_US
+#define CFG_MIDI_SCHED_TICK_US 320
+#endif
+
+// Microseconds each scheduler task may run before it must leave the rest of
+// its work for the next pass of the main loop
+#ifndef CFG_MIDI_SCHED_BUDGET_US
+#define CFG_MIDI_SCHED_BUDGET_US 200
+#endif
+
+// Set to 1 to record every USB MIDI event packet and every MIDI port byte
+// with a timestamp in a RAM ring that the host can read over the telemetry
+// interface (See midi_trace.h)
+#ifndef CFG_MIDI_TRACE
+#define CFG_MIDI_TRACE 0
+#endif
+
+// The number of 8 byte records in the trace ring; must be a power of 2. When
+// it is full, each new record replaces the oldest.
+#ifndef CFG_MIDI_TRACE_RECORDS
+#define CFG_MIDI_TRACE_RECORDS 2048
+#endif
+
+// Set to 1 to keep histograms of the latency from MIDI IN to USB and from
+// USB to MIDI OUT and of the CPU cycles each scheduler task takes, which the
+// host can read over the telemetry interface (See midi_profile.h)
+#ifndef CFG_MIDI_PROFILE
+#define CFG_MIDI_PROFILE 0
+#endif
+
 #ifdef __cplusplus
  }
 #endif
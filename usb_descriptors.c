@@ -25,16 +25,18 @@
 
 #include "tusb.h"
 #include "midi_device_multistream.h"
+#include "usb_descriptors.h"
+#include "midi_ump_driver.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
  *
  * Auto ProductID layout's Bitmap:
- *   [MSB]       MIDI | HID | MSC | CDC          [LSB]
+ *   [MSB]       UMP | VENDOR | MIDI | HID | MSC | CDC          [LSB]
  */
 #define _PID_MAP(itf, n)  ( (CFG_TUD_##itf) << (n) )
 #define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) | \
-                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
+                           _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) | (CFG_MIDI_UMP << 5) )
 
 //--------------------------------------------------------------------+
 // Device Descriptors
@@ -44,9 +46,16 @@ tusb_desc_device_t const desc_device =
     .bLength            = sizeof(tusb_desc_device_t),
     .bDescriptorType    = TUSB_DESC_DEVICE,
     .bcdUSB             = 0x0200,
+#if CFG_MIDI_UMP
+    // The MIDI interfaces have an Interface Association Descriptor
+    .bDeviceClass       = TUSB_CLASS_MISC,
+    .bDeviceSubClass    = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol    = MISC_PROTOCOL_IAD,
+#else
     .bDeviceClass       = 0x00,
     .bDeviceSubClass    = 0x00,
     .bDeviceProtocol    = 0x00,
+#endif
     .bMaxPacketSize0    = CFG_TUD_ENDPOINT0_SIZE,
 
     .idVendor           = 0xCafe,
@@ -72,13 +81,6 @@ uint8_t const * tud_descriptor_device_cb(void)
 // Configuration Descriptor
 //--------------------------------------------------------------------+
 
-enum
-{
-  ITF_NUM_MIDI = 0,
-  ITF_NUM_MIDI_STREAMING,
-  ITF_NUM_TOTAL
-};
-
 #ifndef CFG_TUD_MIDI_NUMCABLES_IN
 #define CFG_TUD_MIDI_NUMCABLES_IN 1
 #endif
@@ -87,43 +89,68 @@ enum
 #define CFG_TUD_MIDI_NUMCABLES_OUT 1
 #endif
 
-#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + TUD_MIDI_MULTI_DESC_LEN(CFG_TUD_MIDI_NUMCABLES_IN,CFG_TUD_MIDI_NUMCABLES_OUT))
-
-#if CFG_TUSB_MCU == OPT_MCU_LPC175X_6X || CFG_TUSB_MCU == OPT_MCU_LPC177X_8X || CFG_TUSB_MCU == OPT_MCU_LPC40XX
-  // LPC 17xx and 40xx endpoint type (bulk/interrupt/iso) are fixed by its number
-  // 0 control, 1 In, 2 Bulk, 3 Iso, 4 In etc ...
-  #define EPNUM_MIDI_OUT   0x02
-  #define EPNUM_MIDI_IN   0x02
-#elif CFG_TUSB_MCU == OPT_MCU_FT90X || CFG_TUSB_MCU == OPT_MCU_FT93X
-  // On Bridgetek FT9xx endpoint numbers must be unique...
-  #define EPNUM_MIDI_OUT   0x02
-  #define EPNUM_MIDI_IN   0x03
+#if CFG_MIDI_UMP
+// The MIDI interfaces with the USB MIDI 2.0 alternate setting (See midi_ump_driver.h)
+#define MIDI_DESC_LEN     TUD_MIDI_MULTI_UMP_DESC_LEN
+#define MIDI_DESCRIPTOR   TUD_MIDI_MULTI_UMP_DESCRIPTOR
 #else
-  #define EPNUM_MIDI_OUT   0x01
-  #define EPNUM_MIDI_IN   0x01
+#define MIDI_DESC_LEN     TUD_MIDI_MULTI_DESC_LEN
+#define MIDI_DESCRIPTOR   TUD_MIDI_MULTI_DESCRIPTOR
 #endif
 
+#define CONFIG_TOTAL_LEN  (TUD_CONFIG_DESC_LEN + MIDI_DESC_LEN(CFG_TUD_MIDI_NUMCABLES_IN,CFG_TUD_MIDI_NUMCABLES_OUT) + \
+                           TUD_VENDOR_DESC_LEN)
+
+// Only offer remote wakeup when a MIDI IN port may use it
+#define CONFIG_ATTRIBUTES (CFG_MIDI_REMOTE_WAKEUP ? TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP : 0)
+
+// The telemetry interface's string follows the MIDI jack strings
+#define STRID_TELEMETRY   (CFG_TUD_MIDI_FIRST_PORT_STRIDX + CFG_TUD_MIDI_NUMCABLES_IN + CFG_TUD_MIDI_NUMCABLES_OUT)
+
+
 
 uint8_t const desc_fs_configuration[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
-  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, CONFIG_ATTRIBUTES, 100),
 
   // Interface number, string index, EP Out & EP In address, EP size
-  TUD_MIDI_MULTI_DESCRIPTOR(ITF_NUM_MIDI, 0, EPNUM_MIDI_OUT, (0x80 | EPNUM_MIDI_IN), 64, CFG_TUD_MIDI_NUMCABLES_IN, CFG_TUD_MIDI_NUMCABLES_OUT)
+  MIDI_DESCRIPTOR(ITF_NUM_MIDI, 0, EPNUM_MIDI_OUT, (0x80 | EPNUM_MIDI_IN), 64, CFG_TUD_MIDI_NUMCABLES_IN, CFG_TUD_MIDI_NUMCABLES_OUT),
+
+  // Interface number, string index, EP Out & IN address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_TELEMETRY, STRID_TELEMETRY, EPNUM_TELEMETRY_OUT, (0x80 | EPNUM_TELEMETRY_IN), 64)
 };
 
 #if TUD_OPT_HIGH_SPEED
 uint8_t const desc_hs_configuration[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
-  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, 0x00, 100),
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, CONFIG_ATTRIBUTES, 100),
 
   // Interface number, string index, EP Out & EP In address, EP size
-  TUD_MIDI_MULTI_DESCRIPTOR(ITF_NUM_MIDI, 0, EPNUM_MIDI_OUT, (0x80 | EPNUM_MIDI_IN), 512, CFG_TUD_MIDI_NUMCABLES_IN, CFG_TUD_MIDI_NUMCABLES_OUT)
+  MIDI_DESCRIPTOR(ITF_NUM_MIDI, 0, EPNUM_MIDI_OUT, (0x80 | EPNUM_MIDI_IN), 512, CFG_TUD_MIDI_NUMCABLES_IN, CFG_TUD_MIDI_NUMCABLES_OUT),
+
+  // Interface number, string index, EP Out & IN address, EP size
+  TUD_VENDOR_DESCRIPTOR(ITF_NUM_TELEMETRY, STRID_TELEMETRY, EPNUM_TELEMETRY_OUT, (0x80 | EPNUM_TELEMETRY_IN), 512)
 };
 #endif
 
+#if CFG_MIDI_UMP
+uint8_t const desc_group_terminal_blocks[] =
+{
+  // One block per virtual cable, named after its jack
+  TUD_MIDI_UMP_GTB_DESCRIPTOR(CFG_TUD_MIDI_NUMCABLES_IN, CFG_TUD_MIDI_NUMCABLES_OUT)
+};
+
+// Invoked when received GET DESCRIPTOR for the Group Terminal Blocks
+// Application return pointer to descriptor
+uint8_t const * tud_descriptor_group_terminal_blocks_cb(uint16_t* len)
+{
+  *len = sizeof(desc_group_terminal_blocks);
+  return desc_group_terminal_blocks;
+}
+#endif
+
 // Invoked when received GET CONFIGURATION DESCRIPTOR
 // Application return pointer to descriptor
 // Descriptor contents must exist long enough for transfer to complete
@@ -149,18 +176,45 @@ char const* string_desc_arr [] =
   "TinyUSB",                     // 1: Manufacturer
   "TinyUSB Device",              // 2: Product
   "123456",                      // 3: Serials, should use chip ID
-  "MIDI IN A",
-  "MIDI IN B",
-  "MIDI OUT A",
-  "MIDI OUT B",
-  "MIDI OUT C",
-  "MIDI OUT D",
-  "MIDI OUT E",
-  "MIDI OUT F",
+  // The MIDI jack strings and the telemetry interface's string follow. See
+  // port_string().
 };
 
 static uint16_t _desc_str[32];
 
+// Return the string for string descriptor index, which is past the end of
+// string_desc_arr: "MIDI IN A", "MIDI IN B", ..., "MIDI OUT A", ...,
+// "MIDI CONFIG" for the last USB MIDI OUT virtual cable, then "MIDI
+// Telemetry". Return NULL if there is no such string.
+static const char* port_string(uint8_t index)
+{
+  static char name[12];
+  int port = index - CFG_TUD_MIDI_FIRST_PORT_STRIDX;
+  const char* prefix;
+  if (port < 0)
+    return NULL;
+  if (port < CFG_TUD_MIDI_NUMCABLES_IN) {
+    prefix = "MIDI IN ";
+  }
+  else if ((port -= CFG_TUD_MIDI_NUMCABLES_IN) < CFG_TUD_MIDI_NUMCABLES_OUT - 1) {
+    prefix = "MIDI OUT ";
+  }
+  else if (index == STRID_TELEMETRY - 1) {
+    return "MIDI CONFIG";
+  }
+  else if (index == STRID_TELEMETRY) {
+    return "MIDI Telemetry";
+  }
+  else {
+    return NULL;
+  }
+  size_t len = strlen(prefix);
+  memcpy(name, prefix, len);
+  name[len] = (char)('A' + port);
+  name[len + 1] = '\0';
+  return name;
+}
+
 // Invoked when received GET STRING DESCRIPTOR request
 // Application return pointer to descriptor, whose contents must exist long enough for transfer to complete
 uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
@@ -178,9 +232,15 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
     // Note: the 0xEE index string is a Microsoft OS 1.0 Descriptors.
     // https://docs.microsoft.com/en-us/windows-hardware/drivers/usbcon/microsoft-defined-usb-descriptors
 
-    if ( !(index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0])) ) return NULL;
-
-    const char* str = string_desc_arr[index];
+    const char* str;
+    if ( index < sizeof(string_desc_arr)/sizeof(string_desc_arr[0]) )
+    {
+      str = string_desc_arr[index];
+    }else
+    {
+      str = port_string(index);
+      if ( !str ) return NULL;
+    }
 
     // Cap at max char
     chr_count = (uint8_t) strlen(str);